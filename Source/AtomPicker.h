@@ -0,0 +1,197 @@
+/*
+  ==============================================================================
+
+    AtomPicker.h
+
+    Nearest atoms to a screen point, for picking in the editor. Atoms are
+    binned into a uniform grid over their screen positions with about one
+    atom per cell, so a query looks at a few cells around the point and
+    compares squared distances, whatever the size of the molecule. Cells
+    are searched in growing square rings until no unvisited cell can hold
+    anything nearer than the current best. Building is linear in the number
+    of atoms. Atoms can also be added or moved one at a time, and only an
+    atom placed outside the grid causes a rebuild.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class AtomPicker
+{
+public:
+	static constexpr int maxNearest = 2;
+
+	// Index the atoms at aX[i], aY[i]. Allocates;
+	void build(const std::vector<float>& aX, const std::vector<float>& aY)
+	{
+		x = aX;
+		y = aY;
+		rebuild();
+	}
+
+	// Appends an atom, returning its index;
+	uint32_t add(float aX, float aY)
+	{
+		x.push_back(aX);
+		y.push_back(aY);
+		const uint32_t atom = (uint32_t)x.size() - 1;
+		if (isInsideGrid(aX, aY))
+			cells[getCell(aX, aY)].push_back(atom);
+		else
+			rebuild();
+		return atom;
+	}
+
+	void move(uint32_t aAtom, float aX, float aY)
+	{
+		if (aAtom >= x.size())
+			return;
+
+		if (!isInsideGrid(aX, aY))
+		{
+			x[aAtom] = aX;
+			y[aAtom] = aY;
+			rebuild();
+			return;
+		}
+
+		auto& from = cells[getCell(x[aAtom], y[aAtom])];
+		from.erase(std::find(from.begin(), from.end(), aAtom));
+		x[aAtom] = aX;
+		y[aAtom] = aY;
+		cells[getCell(aX, aY)].push_back(aAtom);
+	}
+
+	uint32_t getNumAtoms() const { return (uint32_t)x.size(); }
+
+	// Up to aNumNearest (at most maxNearest) distinct atoms nearest to (aX, aY), nearest first, written to aNearest.
+	// Returns how many were found;
+	int findNearest(float aX, float aY, uint32_t* aNearest, int aNumNearest) const
+	{
+		aNumNearest = std::min(std::min(aNumNearest, maxNearest), (int)x.size());
+		if (aNumNearest <= 0)
+			return 0;
+
+		float bestDistance[maxNearest];
+		std::fill(bestDistance, bestDistance + maxNearest, std::numeric_limits<float>::max());
+		int numFound = 0;
+
+		const int cellX = getColumn(aX);
+		const int cellY = getRow(aY);
+		for (int ring = 0;; ++ring)
+		{
+			// Cells on the square ring at Chebyshev distance ring from the query's cell;
+			const int left = cellX - ring, right = cellX + ring, top = cellY - ring, bottom = cellY + ring;
+			for (int row = std::max(top, 0); row <= std::min(bottom, numRows - 1); ++row)
+			{
+				const bool isEdgeRow = row == top || row == bottom;
+				const int step = isEdgeRow ? 1 : right - left;
+				for (int column = left; column <= right; column += std::max(step, 1))
+				{
+					if (column < 0 || column >= numColumns)
+						continue;
+
+					for (uint32_t atom : cells[(size_t)row * numColumns + column])
+					{
+						const float dx = x[atom] - aX;
+						const float dy = y[atom] - aY;
+						const float distance = dx * dx + dy * dy;
+
+						// Insertion into the short sorted list of the best so far;
+						int k = std::min(numFound, aNumNearest - 1);
+						if (numFound == aNumNearest && distance >= bestDistance[k])
+							continue;
+						while (k > 0 && bestDistance[k - 1] > distance)
+						{
+							bestDistance[k] = bestDistance[k - 1];
+							aNearest[k] = aNearest[k - 1];
+							--k;
+						}
+						bestDistance[k] = distance;
+						aNearest[k] = atom;
+						numFound = std::min(numFound + 1, aNumNearest);
+					}
+				}
+			}
+
+			// Every unvisited cell lies outside the searched square, or off the grid altogether;
+			const bool isGridCovered = left <= 0 && top <= 0 && right >= numColumns - 1 && bottom >= numRows - 1;
+			if (isGridCovered)
+				return numFound;
+			if (numFound == aNumNearest)
+			{
+				const float limit = getDistanceToUnvisited(aX, aY, left, right, top, bottom);
+				if (limit * limit >= bestDistance[aNumNearest - 1])
+					return numFound;
+			}
+		}
+	}
+
+private:
+	void rebuild()
+	{
+		const size_t numAtoms = x.size();
+		if (numAtoms == 0)
+		{
+			numColumns = numRows = 1;
+			originX = originY = 0.0f;
+			cellSize = 1.0f;
+			cells.assign(1, {});
+			return;
+		}
+
+		const auto rangeX = std::minmax_element(x.begin(), x.end());
+		const auto rangeY = std::minmax_element(y.begin(), y.end());
+		originX = *rangeX.first;
+		originY = *rangeY.first;
+		const float width = std::max(*rangeX.second - originX, 1.0f);
+		const float height = std::max(*rangeY.second - originY, 1.0f);
+
+		// About one atom per cell, but never so many cells that empty ones dominate a sparse layout;
+		cellSize = std::max(std::sqrt(width * height / (float)numAtoms), 1.0f);
+		numColumns = std::min((int)(width / cellSize) + 1, 4096);
+		numRows = std::min((int)(height / cellSize) + 1, 4096);
+		cellSize = std::max(width / (numColumns - 0.5f), height / (numRows - 0.5f));
+
+		cells.assign((size_t)numColumns * numRows, {});
+		for (uint32_t atom = 0; atom != numAtoms; ++atom)
+			cells[getCell(x[atom], y[atom])].push_back(atom);
+	}
+
+	bool isInsideGrid(float aX, float aY) const
+	{
+		return aX >= originX && aY >= originY && aX < originX + numColumns * cellSize && aY < originY + numRows * cellSize;
+	}
+
+	int getColumn(float aX) const { return std::max(0, std::min(numColumns - 1, (int)std::floor((aX - originX) / cellSize))); }
+	int getRow(float aY) const { return std::max(0, std::min(numRows - 1, (int)std::floor((aY - originY) / cellSize))); }
+	size_t getCell(float aX, float aY) const { return (size_t)getRow(aY) * numColumns + getColumn(aX); }
+
+	// Lower bound on the distance from the query to any atom in a cell outside columns aLeft..aRight and rows
+	// aTop..aBottom. Sides at the edge of the grid have no cells beyond them;
+	float getDistanceToUnvisited(float aX, float aY, int aLeft, int aRight, int aTop, int aBottom) const
+	{
+		float limit = std::numeric_limits<float>::max();
+		if (aLeft > 0)
+			limit = std::min(limit, aX - (originX + aLeft * cellSize));
+		if (aRight < numColumns - 1)
+			limit = std::min(limit, originX + (aRight + 1) * cellSize - aX);
+		if (aTop > 0)
+			limit = std::min(limit, aY - (originY + aTop * cellSize));
+		if (aBottom < numRows - 1)
+			limit = std::min(limit, originY + (aBottom + 1) * cellSize - aY);
+		return std::max(limit, 0.0f);
+	}
+
+	std::vector<float> x, y;
+	std::vector<std::vector<uint32_t>> cells;		// Row-major atom lists;
+	float originX = 0.0f, originY = 0.0f, cellSize = 1.0f;
+	int numColumns = 1, numRows = 1;
+};
@@ -0,0 +1,391 @@
+/*
+  ==============================================================================
+
+    BackgroundRecorder.h
+
+    Records the device output, and optionally every atom's displacement at
+    a decimated rate, without any file access on the audio thread. The
+    audio callback copies samples into single-producer rings sized at
+    start(), which is a handful of stores and never locks or allocates;
+    a block that doesn't fit is dropped and counted rather than waited
+    for. A writer thread drains the rings every few milliseconds through
+    a page-aligned staging buffer in whole multiples of writeBlockBytes,
+    unbuffered. WAV files are 32-bit float and pad their header to one
+    page so the sample data is aligned in the file too. A WAV's size
+    fields saturate past 4 GiB; raw files have no such limit. Snapshot
+    files are raw float32 frames of one value per atom.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class BackgroundRecorder
+{
+public:
+	enum Format
+	{
+		Format_Wav,			// 32-bit float WAV;
+		Format_RawFloat		// Interleaved float32, no header;
+	};
+
+	static constexpr size_t writeBlockBytes = 1 << 16;
+	static constexpr size_t pageBytes = 4096;
+
+	~BackgroundRecorder() { stop(); }
+
+	// Allocates the rings, opens the files and starts the writer. aBufferSeconds of audio can queue before blocks
+	// are dropped. A non-empty aSnapshotPath also records aNumAtoms displacements every aSnapshotInterval samples.
+	// Returns false, recording nothing, if a file can't be opened. Message thread;
+	bool start(const std::string& aAudioPath, Format aFormat, int aNumChannels, double aSampleRate, double aBufferSeconds = 4.0,
+			   const std::string& aSnapshotPath = {}, uint32_t aNumAtoms = 0, int aSnapshotInterval = 0)
+	{
+		stop();
+
+		format = aFormat;
+		numChannels = std::max(1, aNumChannels);
+		sampleRate = aSampleRate;
+		numAudioValuesWritten.store(0);
+		numDropped.store(0);
+		numDroppedSnapshots.store(0);
+		isWriteFailed.store(false);
+
+		audio.file = openUnbuffered(aAudioPath);
+		if (audio.file == nullptr)
+			return false;
+		audio.prepare((size_t)(aBufferSeconds * aSampleRate) * numChannels);
+		if (format == Format_Wav)
+			writeWavHeader();
+
+		numSnapshotAtoms = 0;
+		if (!aSnapshotPath.empty() && aNumAtoms > 0 && aSnapshotInterval > 0)
+		{
+			snapshots.file = openUnbuffered(aSnapshotPath);
+			if (snapshots.file == nullptr)
+			{
+				closeFiles();
+				return false;
+			}
+
+			// As many frames as arrive in aBufferSeconds, and never fewer than a few;
+			numSnapshotAtoms = aNumAtoms;
+			snapshotInterval = aSnapshotInterval;
+			samplesSinceSnapshot = snapshotInterval;
+			const size_t numFrames = std::max<size_t>(4, (size_t)(aBufferSeconds * aSampleRate / snapshotInterval));
+			snapshots.prepare(numFrames * numSnapshotAtoms);
+		}
+
+		if (staging == nullptr)
+			staging.reset(static_cast<float*>(alignedAllocate(stagingBytes)));
+
+		isWriterRunning = true;
+		writer = std::thread([this]
+		{
+			std::unique_lock<std::mutex> lock(writerMutex);
+			while (!writerWake.wait_for(lock, std::chrono::milliseconds(writerPeriodMilliseconds), [this] { return !isWriterRunning; }))
+				drain(false);
+		});
+
+		isActive.store(true);
+		return true;
+	}
+
+	// Waits out any push in flight, writes what is queued and closes the files. Message thread;
+	void stop()
+	{
+		if (!writer.joinable())
+			return;
+
+		isActive.store(false);
+		while (numPushing.load() != 0)
+			std::this_thread::yield();
+
+		{
+			std::lock_guard<std::mutex> lock(writerMutex);
+			isWriterRunning = false;
+		}
+		writerWake.notify_one();
+		writer.join();
+
+		drain(true);
+		if (format == Format_Wav && audio.file != nullptr)
+			finishWavHeader();
+		closeFiles();
+	}
+
+	bool isRecording() const { return isActive.load(std::memory_order_relaxed); }
+
+	// Queue aNumSamples of each of aChannels. Channels past aNumChannels record silence. Audio thread;
+	void pushAudio(const float* const* aChannels, int aNumChannels, int aNumSamples)
+	{
+		const PushScope scope(*this);
+		if (!scope.isActive)
+			return;
+
+		const size_t numValues = (size_t)aNumSamples * numChannels;
+		if (audio.getNumFree() < numValues)
+		{
+			numDropped.fetch_add((uint64_t)aNumSamples, std::memory_order_relaxed);
+			return;
+		}
+
+		const uint64_t head = audio.head.load(std::memory_order_relaxed);
+		for (int n = 0; n != aNumSamples; ++n)
+		{
+			for (int c = 0; c != numChannels; ++c)
+				audio.data[(head + (uint64_t)n * numChannels + c) & audio.mask] = c < aNumChannels ? aChannels[c][n] : 0.0f;
+		}
+		audio.head.store(head + numValues, std::memory_order_release);
+	}
+
+	// Call once per block with the block's length in samples. Every snapshotInterval samples this gathers each atom's
+	// displacement from aNodeDisplacement through aAtomToNode; atoms past the recorded count are left out and missing
+	// ones read as zero. Audio thread;
+	void pushSnapshot(const double* aNodeDisplacement, const std::vector<uint32_t>& aAtomToNode, int aNumSamples)
+	{
+		const PushScope scope(*this);
+		if (!scope.isActive || numSnapshotAtoms == 0)
+			return;
+
+		samplesSinceSnapshot += aNumSamples;
+		if (samplesSinceSnapshot < snapshotInterval)
+			return;
+		samplesSinceSnapshot %= snapshotInterval;
+
+		if (snapshots.getNumFree() < numSnapshotAtoms)
+		{
+			numDroppedSnapshots.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		const uint64_t head = snapshots.head.load(std::memory_order_relaxed);
+		const uint32_t numAtoms = (uint32_t)std::min<size_t>(numSnapshotAtoms, aAtomToNode.size());
+		for (uint32_t a = 0; a != numSnapshotAtoms; ++a)
+			snapshots.data[(head + a) & snapshots.mask] = a < numAtoms ? (float)aNodeDisplacement[aAtomToNode[a]] : 0.0f;
+		snapshots.head.store(head + numSnapshotAtoms, std::memory_order_release);
+	}
+
+	// Device samples dropped because the writer fell behind;
+	uint64_t getNumDropped() const { return numDropped.load(std::memory_order_relaxed); }
+	uint64_t getNumDroppedSnapshots() const { return numDroppedSnapshots.load(std::memory_order_relaxed); }
+
+	// True once a write has failed, after which the writer discards what it drains;
+	bool hasFailed() const { return isWriteFailed.load(std::memory_order_relaxed); }
+
+	double getSecondsWritten() const { return (double)(numAudioValuesWritten.load(std::memory_order_relaxed) / numChannels) / sampleRate; }
+
+private:
+	static constexpr size_t stagingBytes = 16 * writeBlockBytes;
+	static constexpr int writerPeriodMilliseconds = 20;
+
+	// Single producer, the audio thread, and single consumer, the writer;
+	struct Stream
+	{
+		std::vector<float> data;
+		uint64_t mask = 0;
+		std::atomic<uint64_t> head { 0 };
+		std::atomic<uint64_t> tail { 0 };
+		FILE* file = nullptr;
+
+		// Capacity rounded up to a power of two, and at least one write block;
+		void prepare(size_t aCapacity)
+		{
+			size_t capacity = writeBlockBytes / sizeof(float);
+			while (capacity < aCapacity)
+				capacity *= 2;
+			data.assign(capacity, 0.0f);
+			mask = capacity - 1;
+			head.store(0);
+			tail.store(0);
+		}
+
+		size_t getNumFree() const { return data.size() - (size_t)(head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire)); }
+	};
+
+	// Counts a push as in flight before checking isActive, so stop() can't free a ring under it;
+	struct PushScope
+	{
+		explicit PushScope(BackgroundRecorder& aRecorder) : recorder(aRecorder)
+		{
+			recorder.numPushing.fetch_add(1);
+			isActive = recorder.isActive.load();
+		}
+		~PushScope() { recorder.numPushing.fetch_sub(1); }
+
+		BackgroundRecorder& recorder;
+		bool isActive;
+	};
+
+	static void* alignedAllocate(size_t aBytes)
+	{
+#if defined(_MSC_VER)
+		return _aligned_malloc(aBytes, pageBytes);
+#else
+		void* memory = nullptr;
+		return posix_memalign(&memory, pageBytes, aBytes) == 0 ? memory : nullptr;
+#endif
+	}
+
+	// Our writes are already large, so the stream's own buffer would only add a copy;
+	static FILE* openUnbuffered(const std::string& aPath)
+	{
+		FILE* file = std::fopen(aPath.c_str(), "wb");
+		if (file != nullptr)
+			std::setvbuf(file, nullptr, _IONBF, 0);
+		return file;
+	}
+
+	static void alignedFree(void* aMemory)
+	{
+#if defined(_MSC_VER)
+		_aligned_free(aMemory);
+#else
+		std::free(aMemory);
+#endif
+	}
+
+	// Copy what is queued to the file through staging[]. Until aIsFinal only whole write blocks go out;
+	void drain(bool aIsFinal)
+	{
+		drainStream(audio, aIsFinal);
+		if (numSnapshotAtoms != 0)
+			drainStream(snapshots, aIsFinal);
+	}
+
+	void drainStream(Stream& aStream, bool aIsFinal)
+	{
+		const size_t blockValues = writeBlockBytes / sizeof(float);
+		const uint64_t head = aStream.head.load(std::memory_order_acquire);
+		uint64_t tail = aStream.tail.load(std::memory_order_relaxed);
+		size_t numValues = (size_t)(head - tail);
+		if (!aIsFinal)
+			numValues -= numValues % blockValues;
+
+		while (numValues != 0)
+		{
+			const size_t numChunk = std::min(numValues, stagingBytes / sizeof(float));
+			for (size_t v = 0; v != numChunk; ++v)
+				staging.get()[v] = aStream.data[(tail + v) & aStream.mask];
+			tail += numChunk;
+			aStream.tail.store(tail, std::memory_order_release);
+			numValues -= numChunk;
+
+			if (!isWriteFailed.load(std::memory_order_relaxed) && std::fwrite(staging.get(), sizeof(float), numChunk, aStream.file) != numChunk)
+				isWriteFailed.store(true, std::memory_order_relaxed);
+			if (&aStream == &audio)
+				numAudioValuesWritten.store(numAudioValuesWritten.load(std::memory_order_relaxed) + numChunk, std::memory_order_relaxed);
+		}
+	}
+
+	static void put16(uint8_t* aBytes, uint16_t aValue)
+	{
+		aBytes[0] = (uint8_t)aValue;
+		aBytes[1] = (uint8_t)(aValue >> 8);
+	}
+
+	static void put32(uint8_t* aBytes, uint32_t aValue)
+	{
+		for (int b = 0; b != 4; ++b)
+			aBytes[b] = (uint8_t)(aValue >> (8 * b));
+	}
+
+	static void putTag(uint8_t* aBytes, const char* aTag) { std::copy(aTag, aTag + 4, aBytes); }
+
+	// RIFF, an 18-byte fmt chunk, fact, then JUNK padding so the data chunk's samples start at pageBytes. Sizes are
+	// filled in by finishWavHeader();
+	void writeWavHeader()
+	{
+		uint8_t header[pageBytes] = {};
+		putTag(header, "RIFF");
+		putTag(header + 8, "WAVE");
+
+		putTag(header + 12, "fmt ");
+		put32(header + 16, 18);
+		put16(header + 20, 3);		// IEEE float;
+		put16(header + 22, (uint16_t)numChannels);
+		put32(header + 24, (uint32_t)sampleRate);
+		put32(header + 28, (uint32_t)sampleRate * numChannels * sizeof(float));
+		put16(header + 32, (uint16_t)(numChannels * sizeof(float)));
+		put16(header + 34, 32);
+		put16(header + 36, 0);
+
+		putTag(header + wavFactOffset, "fact");
+		put32(header + wavFactOffset + 4, 4);
+
+		putTag(header + 50, "JUNK");
+		put32(header + 54, (uint32_t)(pageBytes - 8 - 58));
+
+		putTag(header + pageBytes - 8, "data");
+		if (std::fwrite(header, 1, pageBytes, audio.file) != pageBytes)
+			isWriteFailed.store(true);
+	}
+
+	void finishWavHeader()
+	{
+		const uint64_t numFrames = numAudioValuesWritten.load() / numChannels;
+		const uint64_t dataBytes = numFrames * numChannels * sizeof(float);
+		auto saturate = [](uint64_t aValue) { return (uint32_t)std::min<uint64_t>(aValue, UINT32_MAX); };
+
+		uint8_t size[4];
+		put32(size, saturate(pageBytes - 8 + dataBytes));
+		std::fseek(audio.file, 4, SEEK_SET);
+		std::fwrite(size, 1, 4, audio.file);
+
+		put32(size, saturate(numFrames));
+		std::fseek(audio.file, wavFactOffset + 8, SEEK_SET);
+		std::fwrite(size, 1, 4, audio.file);
+
+		put32(size, saturate(dataBytes));
+		std::fseek(audio.file, pageBytes - 4, SEEK_SET);
+		std::fwrite(size, 1, 4, audio.file);
+	}
+
+	void closeFiles()
+	{
+		for (Stream* stream : { &audio, &snapshots })
+		{
+			if (stream->file != nullptr)
+				std::fclose(stream->file);
+			stream->file = nullptr;
+		}
+	}
+
+	static constexpr int wavFactOffset = 38;
+
+	Format format = Format_Wav;
+	int numChannels = 2;
+	double sampleRate = 44100.0;
+
+	Stream audio;
+	Stream snapshots;
+	uint32_t numSnapshotAtoms = 0;
+	int snapshotInterval = 0;
+	int samplesSinceSnapshot = 0;		// Audio thread only;
+
+	std::unique_ptr<float, void (*)(void*)> staging { nullptr, &alignedFree };
+
+	std::atomic<bool> isActive { false };
+	std::atomic<int> numPushing { 0 };
+	std::atomic<uint64_t> numDropped { 0 };
+	std::atomic<uint64_t> numDroppedSnapshots { 0 };
+	std::atomic<uint64_t> numAudioValuesWritten { 0 };		// Written by the writer thread only;
+	std::atomic<bool> isWriteFailed { false };
+
+	std::thread writer;
+	std::mutex writerMutex;
+	std::condition_variable writerWake;
+	bool isWriterRunning = false;
+};
@@ -0,0 +1,262 @@
+/*
+  ==============================================================================
+
+    CompactMoleculeSolver.h
+
+    Opt-in low-bandwidth storage for very large molecules, with the same
+    interface as MoleculeSolver. The three rotating time levels are
+    replaced by two arrays:
+
+        position   u_n at full StateType precision, updated in place
+        history    u_n - u_{n-1}, the N-1 level relative to N, in HistoryCodec
+
+    Level n-1 only enters the damping and leapfrog terms, as a difference
+    from u_n. Storing that difference keeps 16-bit codecs accurate, where
+    storing u_{n-1} itself would lose the small velocity to rounding.
+
+    Row i's new position can only replace u_n once no later row reads the
+    old value. That is row i + bandwidth, so new values wait in a small
+    ring until then. The topology should be in a bandwidth-reduced order
+    (see MoleculeOrdering.h), otherwise the ring grows to the whole
+    molecule. Per-bond weights are stored in WeightCodec.
+
+    The engine's Precision_Half runs it through ReducedPrecisionSweep.h as
+    float positions with fp16 history and weights. A ringing molecule's
+    velocities there are near fp16's subnormals, so load() scales history
+    by a power of two that puts the block's largest values mid-range.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "HalfFloat.h"
+#include "MoleculeBoundary.h"
+#include "MoleculeOrdering.h"
+
+template <typename StateType, typename HistoryCodec, typename WeightCodec = ExactCodec<StateType>>
+class CompactMoleculeSolver
+{
+public:
+	void prepare(const MoleculeTopology& aTopology, double aInternalRate, double aDeltaX)
+	{
+		topology = &aTopology;
+		deltaT = 1.0 / aInternalRate;
+		deltaX = aDeltaX;
+
+		weight.resize(aTopology.neighbours.size());
+		for (uint32_t i = 0; i != aTopology.numNodes; ++i)
+			for (uint32_t e = aTopology.rowStart[i]; e != aTopology.rowStart[i + 1]; ++e)
+				weight[e] = WeightCodec::encode((StateType)(aTopology.stiffness[e] * aTopology.invMass[i]));
+
+		lag = getBandwidth(aTopology);
+		uint32_t ringSize = 1;
+		while (ringSize < lag + 1)
+			ringSize *= 2;
+		ringMask = ringSize - 1;
+		pending.assign(ringSize, (StateType)0);
+
+		position.assign(aTopology.numNodes, (StateType)0);
+		history.assign(aTopology.numNodes, HistoryCodec::encode((StateType)0));
+		setParameters(waveSpeed, genDamp);
+	}
+
+	void reset()
+	{
+		std::fill(position.begin(), position.end(), (StateType)0);
+		std::fill(history.begin(), history.end(), HistoryCodec::encode((StateType)0));
+	}
+
+	void setParameters(double aWaveSpeed, double aGenDamp)
+	{
+		waveSpeed = aWaveSpeed;
+		genDamp = aGenDamp;
+		setCoefficients(waveSpeed * waveSpeed * (deltaT * deltaT) / (deltaX * deltaX), 2.0 * genDamp * deltaT);
+	}
+
+	// As MoleculeSolver::setCoefficients();
+	void setCoefficients(double aLapCoeff, double aDampCoeff)
+	{
+		lapCoeff = (StateType)aLapCoeff;
+		keepCoeff = (StateType)(1.0 - aDampCoeff);
+	}
+
+	// Replace the two latest time levels, keeping u_n - u_{n-1} as history scaled to their largest values;
+	void load(const double* aUNMOne, const double* aUN)
+	{
+		const uint32_t numNodes = topology->numNodes;
+		double peak = 0.0;
+		for (uint32_t i = 0; i != numNodes; ++i)
+			peak = std::max(peak, std::max(std::abs(aUN[i]), std::abs(aUN[i] - aUNMOne[i])));
+		setHistoryRange(peak);
+
+		for (uint32_t i = 0; i != numNodes; ++i)
+		{
+			position[i] = (StateType)aUN[i];
+			history[i] = HistoryCodec::encode((StateType)((aUN[i] - aUNMOne[i]) * historyScale));
+		}
+	}
+
+	void store(double* aUNMOne, double* aUN) const
+	{
+		for (uint32_t i = 0; i != topology->numNodes; ++i)
+		{
+			aUN[i] = position[i];
+			aUNMOne[i] = (double)position[i] - (double)HistoryCodec::decode(history[i]) * invHistoryScale;
+		}
+	}
+
+	// Driven and tapped nodes outside the topology or clamped are ignored;
+	void setNodes(uint32_t aInputNode, uint32_t aOutputNode)
+	{
+		inputNode = aInputNode;
+		outputNode = aOutputNode;
+	}
+
+	// As MoleculeSolver::process();
+	double process(const float* aInput, float* aOutput, int aNumSamples)
+	{
+		const uint32_t numNodes = topology->numNodes;
+		const uint32_t numClamped = topology->numClamped;
+		StateType* u = position.data();
+		typename HistoryCodec::Stored* velocity = history.data();
+		const bool isDriven = inputNode >= numClamped && inputNode < numNodes;
+
+		double energy = 0.0;
+		for (int n = 0; n != aNumSamples; ++n)
+		{
+			const StateType drivenBefore = isDriven ? u[inputNode] : (StateType)0;
+			energy += sweep();
+
+			if (isDriven)
+			{
+				energy += (double)aInput[n] * aInput[n] - (double)u[inputNode] * u[inputNode];
+				u[inputNode] = (StateType)aInput[n];
+				velocity[inputNode] = HistoryCodec::encode(((StateType)aInput[n] - drivenBefore) * historyScale);
+			}
+			aOutput[n] = outputNode >= numClamped && outputNode < numNodes ? (float)u[outputNode] : 0.0f;
+		}
+		return energy;
+	}
+
+	// As MoleculeSolver's BoundaryNodes process(). A driven node's history follows the value it is set to;
+	double process(const float* aInput, float* const* aOutputs, int aNumSamples, const BoundaryNodes& aBoundary)
+	{
+		// Driving harder than the molecule is ringing needs more range;
+		float maxWeight = 0.0f, maxInput = 0.0f;
+		for (const auto& d : aBoundary.driven)
+			maxWeight = std::max(maxWeight, std::abs(d.weight));
+		for (int n = 0; n != aNumSamples; ++n)
+			maxInput = std::max(maxInput, std::abs(aInput[n]));
+		if ((double)maxWeight * maxInput > historyRange)
+			rescaleHistory((double)maxWeight * maxInput);
+
+		StateType* u = position.data();
+		typename HistoryCodec::Stored* velocity = history.data();
+
+		double energy = 0.0;
+		for (int n = 0; n != aNumSamples; ++n)
+		{
+			energy += sweep();
+
+			// The swept value less its increment is the node's value before the step;
+			for (const auto& d : aBoundary.driven)
+			{
+				const StateType before = u[d.index] - (StateType)HistoryCodec::decode(velocity[d.index]) * invHistoryScale;
+				velocity[d.index] = HistoryCodec::encode(((StateType)(d.weight * aInput[n]) - before) * historyScale);
+			}
+			aBoundary.apply(u, aInput[n], aOutputs, n);
+		}
+		return energy;
+	}
+
+	StateType getDisplacement(uint32_t aNode) const { return position[aNode]; }
+
+private:
+	// One step of every free node, in place. Returns the sum of squared new displacements;
+	double sweep()
+	{
+		const uint32_t numNodes = topology->numNodes;
+		const uint32_t numClamped = topology->numClamped;
+		const uint32_t* rowStart = topology->rowStart.data();
+		const uint32_t* neighbours = topology->neighbours.data();
+		const typename WeightCodec::Stored* weights = weight.data();
+		StateType* u = position.data();
+		typename HistoryCodec::Stored* velocity = history.data();
+		StateType* ring = pending.data();
+		const StateType scaledLapCoeff = lapCoeff * historyScale;
+
+		double energy = 0.0;
+		auto updateRow = [&](uint32_t i)
+		{
+			const StateType ui = u[i];
+			StateType laplacian = 0;
+			for (uint32_t e = rowStart[i]; e != rowStart[i + 1]; ++e)
+				laplacian += (StateType)WeightCodec::decode(weights[e]) * (u[neighbours[e]] - ui);
+
+			// Same update as MoleculeSolver, with u - u_{n-1} read from history;
+			const typename HistoryCodec::Stored stored = HistoryCodec::encode(keepCoeff * (StateType)HistoryCodec::decode(velocity[i]) + scaledLapCoeff * laplacian);
+			velocity[i] = stored;
+			const StateType f = ui + (StateType)HistoryCodec::decode(stored) * invHistoryScale;
+			ring[i & ringMask] = f;
+			energy += (double)f * f;
+		};
+
+		// The first lag free rows have nothing old enough to store; after that, row i - lag has had its last reader;
+		const uint32_t firstStored = std::min(numNodes, numClamped + lag);
+		for (uint32_t i = numClamped; i < firstStored; ++i)
+			updateRow(i);
+		for (uint32_t i = firstStored; i < numNodes; ++i)
+		{
+			updateRow(i);
+			u[i - lag] = ring[(i - lag) & ringMask];
+		}
+		for (uint32_t r = std::max(numClamped, numNodes > lag ? numNodes - lag : 0u); r < numNodes; ++r)
+			u[r] = ring[r & ringMask];
+		return energy;
+	}
+
+	// Choose the power of two that puts aPeak near 2^historyPeakExponent once scaled;
+	void setHistoryRange(double aPeak)
+	{
+		const int exponent = aPeak > 0.0 ? std::max(-64, std::min(64, historyPeakExponent - std::ilogb(aPeak))) : 0;
+		historyScale = (StateType)std::ldexp(1.0, exponent);
+		invHistoryScale = (StateType)std::ldexp(1.0, -exponent);
+		historyRange = aPeak;
+	}
+
+	void rescaleHistory(double aPeak)
+	{
+		const StateType previousScale = historyScale;
+		setHistoryRange(aPeak);
+		const StateType ratio = historyScale / previousScale;
+		for (auto& h : history)
+			h = HistoryCodec::encode((StateType)HistoryCodec::decode(h) * ratio);
+	}
+
+	const MoleculeTopology* topology = nullptr;
+	double deltaT = 1.0 / 44100.0;
+	double deltaX = 0.00001;
+	double waveSpeed = 0.015;
+	double genDamp = 0.0001;
+	StateType lapCoeff = 0;
+	StateType keepCoeff = 1;
+	uint32_t inputNode = 0;
+	uint32_t outputNode = 0;
+
+	std::vector<typename WeightCodec::Stored> weight;		// Stiffness / mass of the row's node, per bond;
+	std::vector<StateType> position;
+	std::vector<typename HistoryCodec::Stored> history;
+	static constexpr int historyPeakExponent = 4;			// Leaves fp16 2^11 of headroom and 2^18 above its subnormals;
+	StateType historyScale = 1;								// History is stored times this;
+	StateType invHistoryScale = 1;
+	double historyRange = 0.0;								// The largest value historyScale was chosen for;
+	uint32_t lag = 0;										// Rows between computing a position and storing it;
+	uint32_t ringMask = 0;
+	std::vector<StateType> pending;							// New positions of the last lag + 1 rows, by row & ringMask;
+};
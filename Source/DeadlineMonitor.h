@@ -0,0 +1,191 @@
+/*
+  ==============================================================================
+
+    DeadlineMonitor.h
+
+    How close the audio callback runs to its deadline. Each block and each
+    stage within it is timed with the CPU timestamp counter and binned as a
+    fraction of the block's duration, so p50/p99/p99.9 load and the number
+    of overruns can be read from any thread while audio runs. The audio
+    thread is the only writer: bins are relaxed atomics and recording never
+    locks or allocates. Ticks are calibrated against steady_clock in
+    prepare(), which is also what non-x86 builds count in.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define MOLECULE_HAS_TSC 1
+#endif
+
+class DeadlineMonitor
+{
+public:
+	enum Stage
+	{
+		Stage_Excitation,		// Input signal, live input and MIDI;
+		Stage_Simulation,		// Molecule and voice sweeps;
+		Stage_Output,			// Resampling and channel copies;
+		Stage_Block,			// The whole callback;
+		numStages
+	};
+
+	static constexpr int numBins = 512;
+	static constexpr double maxBinnedLoad = 2.0;		// Loads above this share the last bin;
+
+	static uint64_t now()
+	{
+#if defined(MOLECULE_HAS_TSC)
+		return __rdtsc();
+#else
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	// Spins for about 20 ms to measure the tick rate. Call off the audio thread;
+	void prepare(double aSampleRate)
+	{
+		sampleRate = aSampleRate;
+
+		const auto startTime = std::chrono::steady_clock::now();
+		const uint64_t startTicks = now();
+		std::chrono::duration<double> elapsed {};
+		while (elapsed.count() < 0.02)
+			elapsed = std::chrono::steady_clock::now() - startTime;
+		ticksPerSecond = (double)(now() - startTicks) / elapsed.count();
+	}
+
+	// Start timing a block of aNumSamples device samples. Audio thread only;
+	void beginBlock(int aNumSamples)
+	{
+		if (isResetRequested.exchange(false, std::memory_order_acquire))
+			clear();
+
+		blockStart = now();
+		budgetTicks = aNumSamples / sampleRate * ticksPerSecond;
+		for (auto& t : stageTicks)
+			t = 0;
+	}
+
+	// Add aTicks to aStage for the current block. Stages may be entered several times per block;
+	void addStage(Stage aStage, uint64_t aTicks) { stageTicks[aStage] += aTicks; }
+
+	// Elapsed fraction of the current block's budget;
+	double getBlockLoad() const { return budgetTicks > 0.0 ? (double)(now() - blockStart) / budgetTicks : 0.0; }
+
+	void endBlock()
+	{
+		if (budgetTicks <= 0.0)
+			return;
+
+		stageTicks[Stage_Block] = now() - blockStart;
+		for (int s = 0; s != numStages; ++s)
+			record(histograms[s], stageTicks[s] / budgetTicks);
+
+		if ((double)stageTicks[Stage_Block] > budgetTicks)
+			store(numOverruns, numOverruns.load(std::memory_order_relaxed) + 1);
+		store(numBlocks, numBlocks.load(std::memory_order_relaxed) + 1);
+	}
+
+	// Times one callback, including early returns;
+	struct BlockScope
+	{
+		BlockScope(DeadlineMonitor& aMonitor, int aNumSamples) : monitor(aMonitor) { monitor.beginBlock(aNumSamples); }
+		~BlockScope() { monitor.endBlock(); }
+
+		DeadlineMonitor& monitor;
+	};
+
+	// Any thread. The audio thread clears the counts at its next block;
+	void reset() { isResetRequested.store(true, std::memory_order_release); }
+
+	uint64_t getNumBlocks() const { return numBlocks.load(std::memory_order_relaxed); }
+	uint64_t getNumOverruns() const { return numOverruns.load(std::memory_order_relaxed); }
+
+	// Load as a fraction of the block duration below which aPercentile percent of blocks fell, to bin resolution.
+	// Any thread;
+	double getPercentile(Stage aStage, double aPercentile) const
+	{
+		const auto& bins = histograms[aStage];
+		uint64_t total = 0;
+		for (const auto& b : bins)
+			total += b.load(std::memory_order_relaxed);
+		if (total == 0)
+			return 0.0;
+
+		const double target = aPercentile * 0.01 * (double)total;
+		uint64_t count = 0;
+		for (int b = 0; b != numBins; ++b)
+		{
+			count += bins[b].load(std::memory_order_relaxed);
+			if ((double)count >= target)
+				return (b + 1) * maxBinnedLoad / numBins;
+		}
+		return maxBinnedLoad;
+	}
+
+	// Percentiles per stage, counters and aContext, which describes the molecule and device being measured;
+	nlohmann::json toJson(const nlohmann::json& aContext) const
+	{
+		static const char* const stageNames[numStages] = { "excitation", "simulation", "output", "block" };
+
+		nlohmann::json result = aContext;
+		result["ticks_per_second"] = ticksPerSecond;
+		result["blocks"] = getNumBlocks();
+		result["overruns"] = getNumOverruns();
+		for (int s = 0; s != numStages; ++s)
+		{
+			const Stage stage = (Stage)s;
+			result["load"][stageNames[s]] = { { "p50", getPercentile(stage, 50.0) }, { "p99", getPercentile(stage, 99.0) },
+											  { "p99.9", getPercentile(stage, 99.9) } };
+		}
+		return result;
+	}
+
+private:
+	typedef std::atomic<uint64_t> Counter;
+
+	// Single writer, so a relaxed load and store stand in for a locked read-modify-write;
+	static void store(Counter& aCounter, uint64_t aValue) { aCounter.store(aValue, std::memory_order_relaxed); }
+
+	static void record(Counter* aBins, double aLoad)
+	{
+		const int b = aLoad >= maxBinnedLoad ? numBins - 1 : (int)(aLoad * (numBins / maxBinnedLoad));
+		store(aBins[b], aBins[b].load(std::memory_order_relaxed) + 1);
+	}
+
+	void clear()
+	{
+		for (auto& bins : histograms)
+			for (auto& b : bins)
+				store(b, 0);
+		store(numBlocks, 0);
+		store(numOverruns, 0);
+	}
+
+	double sampleRate = 44100.0;
+	double ticksPerSecond = 1e9;
+
+	// Audio thread only;
+	uint64_t blockStart = 0;
+	double budgetTicks = 0.0;
+	uint64_t stageTicks[numStages] = {};
+
+	Counter histograms[numStages][numBins] = {};
+	Counter numBlocks { 0 };
+	Counter numOverruns { 0 };
+	std::atomic<bool> isResetRequested { false };
+};
@@ -0,0 +1,96 @@
+/*
+  ==============================================================================
+
+    HalfFloat.h
+
+    16-bit storage codecs for CompactMoleculeSolver. A codec has a Stored
+    type plus encode() and decode(), and values are decoded to float in
+    registers. HalfCodec uses F16C when the build targets it, otherwise a
+    portable round-to-nearest-even conversion with identical results.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// Full precision, for comparing the storage layout on its own;
+template <typename ValueType>
+struct ExactCodec
+{
+	typedef ValueType Stored;
+
+	static Stored encode(ValueType aValue) { return aValue; }
+	static ValueType decode(Stored aStored) { return aStored; }
+};
+
+// IEEE binary16: 11 significant bits, range up to 65504;
+struct HalfCodec
+{
+	typedef uint16_t Stored;
+
+	static Stored encode(float aValue)
+	{
+#if defined(__F16C__)
+		return (Stored)_cvtss_sh(aValue, _MM_FROUND_TO_NEAREST_INT);
+#else
+		uint32_t bits;
+		std::memcpy(&bits, &aValue, sizeof(bits));
+		const uint32_t sign = (bits >> 16) & 0x8000u;
+		bits &= 0x7fffffffu;
+
+		// 65520 and up round to infinity; NaN stays quiet NaN;
+		if (bits >= 0x47800000u)
+			return (Stored)(sign | (bits > 0x7f800000u ? 0x7e00u : 0x7c00u));
+
+		// Below the smallest normal half, adding 0.5 lets the FPU round the mantissa into place;
+		if (bits < 0x38800000u)
+		{
+			float f;
+			std::memcpy(&f, &bits, sizeof(f));
+			f += 0.5f;
+			std::memcpy(&bits, &f, sizeof(bits));
+			return (Stored)(sign | (bits - 0x3f000000u));
+		}
+
+		// Rebias the exponent and round to nearest even on the 13 dropped bits;
+		const uint32_t isMantissaOdd = (bits >> 13) & 1u;
+		bits += 0xc8000fffu + isMantissaOdd;
+		return (Stored)(sign | (bits >> 13));
+#endif
+	}
+
+	static float decode(Stored aStored)
+	{
+#if defined(__F16C__)
+		return _cvtsh_ss(aStored);
+#else
+		const uint32_t sign = (uint32_t)(aStored & 0x8000u) << 16;
+		const uint32_t exponent = (aStored >> 10) & 0x1fu;
+		const uint32_t mantissa = aStored & 0x3ffu;
+
+		uint32_t bits;
+		if (exponent == 0)
+		{
+			// Zero or subnormal, mantissa * 2^-24;
+			const float f = (float)mantissa * 5.9604644775390625e-8f;
+			std::memcpy(&bits, &f, sizeof(bits));
+			bits |= sign;
+		}
+		else if (exponent == 31)
+			bits = sign | 0x7f800000u | (mantissa << 13);
+		else
+			bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+		float f;
+		std::memcpy(&f, &bits, sizeof(f));
+		return f;
+#endif
+	}
+};
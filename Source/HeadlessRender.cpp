@@ -0,0 +1,210 @@
+/*
+  ==============================================================================
+
+    HeadlessRender.cpp
+
+    Renders molecules through MoleculeEngine with no JUCE and no audio
+    device: each file is loaded, struck at its driven atom and played for
+    a second, and the peak and RMS of the output printed. Each is played
+    again at every reduced precision, printing its SNR against the double
+    render. The compile-time StaticMoleculeBatch is also played against
+    MoleculeBatch on the same molecule, printing the time per step of each.
+    Exits non-zero if a molecule fails to load, renders silence or
+    anything not finite, a reduced precision falls below its minimum SNR,
+    or the two batches disagree, so the CMake build runs it as its test. Also a
+    starting point for offline renders and for embedding the engine
+    elsewhere.
+
+        molsynth_render file.pdb [file.json ...]
+
+  ==============================================================================
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "MoleculeEngine.h"
+#include "StaticMolecule.h"
+
+static const char* const precisionNames[MoleculeEngine::numPrecisions] = { "double", "float", "float, double sum", "float, compensated", "half history" };
+
+// SNR against the double render below which a precision is broken rather than merely less accurate. Float keeps
+// 70-80 dB on every bundled molecule and the half-float history around 30 dB;
+static const double minimumSnr[MoleculeEngine::numPrecisions] = { 0.0, 50.0, 50.0, 50.0, 25.0 };
+
+// Renders one second of aPath at aPrecision after a strike, keeping the first channel in aOutput. Returns false if it
+// could not be loaded;
+static bool renderPrecision(MoleculeEngine& aEngine, const char* aPath, MoleculeEngine::Precision aPrecision, std::vector<float>& aOutput)
+{
+	constexpr double sampleRate = 48000.0;
+	constexpr int blockSize = 512;
+	constexpr int numChannels = 2;
+
+	if (!aEngine.load(aPath))
+		return false;
+	aEngine.setPrecision(aPrecision);
+
+	// The app's driven atom and pickup, moved onto the last atoms of molecules too small to have them;
+	const uint32_t numAtoms = aEngine.getNumSimulatedAtoms();
+	const uint32_t pickup = std::min(34u, numAtoms - 1);
+	aEngine.setDrivenAtoms({ { std::min(14u, numAtoms > 1 ? numAtoms - 2 : 0u), 1.0f } });
+	aEngine.setPickupCentres(pickup, pickup);
+
+	aEngine.prepare(sampleRate, blockSize);
+	aEngine.setParam(MoleculeEngine::Param_CpuBudget, 100.0);		// Stay on the loaded molecule, however slow the machine;
+	aEngine.strike();
+
+	std::vector<float> channels[numChannels];
+	float* pointers[numChannels];
+	for (int c = 0; c != numChannels; ++c)
+	{
+		channels[c].resize(blockSize);
+		pointers[c] = channels[c].data();
+	}
+
+	aOutput.clear();
+	const int numBlocks = (int)(sampleRate / blockSize);
+	for (int b = 0; b != numBlocks; ++b)
+	{
+		aEngine.process(pointers, numChannels, blockSize);
+		aOutput.insert(aOutput.end(), channels[0].begin(), channels[0].end());
+	}
+	return true;
+}
+
+// Renders one second of aPath after a strike, in double and then each reduced precision, which is compared with the
+// double render. Returns false if any is silent or unstable;
+static bool renderMolecule(const char* aPath)
+{
+	std::vector<float> reference, reduced;
+	for (int p = 0; p != MoleculeEngine::numPrecisions; ++p)
+	{
+		MoleculeEngine engine;
+		std::vector<float>& rendered = p == MoleculeEngine::Precision_Double ? reference : reduced;
+		if (!renderPrecision(engine, aPath, (MoleculeEngine::Precision)p, rendered))
+		{
+			std::printf("%s: could not load\n", aPath);
+			return false;
+		}
+
+		double sumSquares = 0.0, sumReferenceSquares = 0.0, sumErrorSquares = 0.0;
+		float peak = 0.0f;
+		bool isFinite = true;
+		for (size_t n = 0; n != rendered.size(); ++n)
+		{
+			const float v = rendered[n];
+			isFinite = isFinite && std::isfinite(v);
+			peak = std::max(peak, std::abs(v));
+			sumSquares += (double)v * v;
+			sumReferenceSquares += (double)reference[n] * reference[n];
+			sumErrorSquares += ((double)v - reference[n]) * ((double)v - reference[n]);
+		}
+
+		const double rms = std::sqrt(sumSquares / (double)rendered.size());
+		const double snr = 10.0 * std::log10(std::max(sumReferenceSquares, 1e-30) / std::max(sumErrorSquares, 1e-30));
+		const bool isAccurate = snr >= minimumSnr[p];
+		const bool isPassed = isFinite && peak > 0.0f && isAccurate;
+		const char* failure = isPassed ? "" : (!isFinite ? "  NOT FINITE" : peak == 0.0f ? "  SILENT" : "  INACCURATE");
+		if (p == MoleculeEngine::Precision_Double)
+			std::printf("%s: %u atoms, %zu bonds, peak %.3g, RMS %.3g%s\n", aPath, engine.getNumSimulatedAtoms(), engine.getNumSimulatedBonds(), peak, rms,
+						failure);
+		else
+			std::printf("  %-20s SNR against double %6.1f dB, at least %.0f%s\n", precisionNames[p], snr, minimumSnr[p], failure);
+		if (!isPassed)
+			return false;
+	}
+	return true;
+}
+
+// Plays every lane of aBatch for aNumSamples after an impulse at its driven node, in blocks of 256. Returns the
+// nanoseconds per step;
+template <typename Batch>
+static double playBatch(Batch& aBatch, std::vector<float> (&aOutputs)[4], int aNumSamples)
+{
+	constexpr int blockSize = 256;
+	std::vector<float> inputs[4];
+	const float* inputPointers[4];
+	float* outputPointers[4];
+	for (int l = 0; l != 4; ++l)
+	{
+		inputs[l].assign(aNumSamples, 0.0f);
+		inputs[l][0] = 1.0f;
+		aOutputs[l].assign(aNumSamples, 0.0f);
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	for (int n = 0; n < aNumSamples; n += blockSize)
+	{
+		for (int l = 0; l != 4; ++l)
+		{
+			inputPointers[l] = inputs[l].data() + n;
+			outputPointers[l] = aOutputs[l].data() + n;
+		}
+		aBatch.process(inputPointers, outputPointers, std::min(blockSize, aNumSamples - n));
+	}
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / aNumSamples;
+}
+
+// StaticMoleculeBatch against MoleculeBatch on the topology it describes, lanes differing in speed, damping, driven
+// and tapped atom. They compute the same terms and agree to the bit here, but are only held to well within float
+// output precision, as the compiler may contract either one's arithmetic differently;
+static bool checkStaticBatch()
+{
+	constexpr double internalRate = 44100.0;
+	constexpr double deltaX = 0.00001;
+	constexpr int numSamples = 44100;
+
+	const MoleculeTopology topology = makeTopology<InputJsonMolecule>();
+	MoleculeBatch<double, 4> runtime;
+	StaticMoleculeBatch<InputJsonMolecule, double, 4> fixed;
+	runtime.prepare(topology, internalRate, deltaX);
+	fixed.prepare(internalRate, deltaX);
+	for (int l = 0; l != 4; ++l)
+	{
+		MoleculeBatch<double, 4>::LaneParameters parameters;
+		parameters.waveSpeed = 0.015 * (l + 1);
+		parameters.genDamp = 0.0001 * (l + 1);
+		parameters.inputNode = 1 + l;
+		parameters.outputNode = 1 + (l + 2) % (InputJsonMolecule::numNodes - 1);
+		runtime.setLaneParameters(l, parameters);
+		fixed.setLaneParameters(l, parameters);
+	}
+
+	std::vector<float> runtimeOutputs[4], fixedOutputs[4];
+	const double runtimeNs = playBatch(runtime, runtimeOutputs, numSamples);
+	const double fixedNs = playBatch(fixed, fixedOutputs, numSamples);
+
+	float peak = 0.0f, difference = 0.0f;
+	for (int l = 0; l != 4; ++l)
+	{
+		for (int n = 0; n != numSamples; ++n)
+		{
+			peak = std::max(peak, std::abs(runtimeOutputs[l][n]));
+			difference = std::max(difference, std::abs(runtimeOutputs[l][n] - fixedOutputs[l][n]));
+		}
+	}
+
+	const bool isPassed = peak > 0.0f && difference <= 1e-5f * peak;
+	std::printf("static batch: %u atoms, 4 lanes, %.0f ns per step against %.0f for MoleculeBatch, largest difference %.3g of peak %.3g%s\n",
+				InputJsonMolecule::numNodes, fixedNs, runtimeNs, difference, peak, isPassed ? "" : peak == 0.0f ? "  SILENT" : "  MISMATCH");
+	return isPassed;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::fprintf(stderr, "usage: %s file.pdb [file.json ...]\n", argv[0]);
+		return 2;
+	}
+
+	int numFailed = 0;
+	for (int a = 1; a != argc; ++a)
+		numFailed += renderMolecule(argv[a]) ? 0 : 1;
+	numFailed += checkStaticBatch() ? 0 : 1;
+	return numFailed == 0 ? 0 : 1;
+}
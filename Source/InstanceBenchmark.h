@@ -0,0 +1,143 @@
+/*
+  ==============================================================================
+
+    InstanceBenchmark.h
+
+    A headless host for MoleculePlugin. For each molecule it creates a
+    number of plugin instances, as a session with the synth on several
+    tracks would, loads the molecule into each and plays a note through
+    all of them. Load times show whether later instances found the
+    molecule in MoleculeCache, and the cache's counts how many reads and
+    compiles the instances shared. Every instance's output is compared
+    with that of one more instance given its own read and compile of the
+    molecule, which sharing must not change by a single bit. The CPU
+    budget is at its most lenient so that every instance plays at full
+    detail, as coarsening depends on timing. Run with
+    `MolecularSynthesis --instances [N] [file.pdb ...]`.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MoleculePlugin.h"
+
+// Full detail unless a block takes longer than it lasts;
+inline void setMaxCpuBudget(MoleculePlugin& aPlugin)
+{
+	for (auto* parameter : aPlugin.getParameters())
+		if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(parameter))
+			if (ranged->paramID == "cpuBudget")
+				ranged->setValueNotifyingHost(1.0f);
+}
+
+// Loads aPath into aNumInstances plugins and renders aNumBlocks blocks from each after a note-on;
+inline void benchmarkInstances(const std::string& aPath, int aNumInstances, int aNumBlocks, FILE* aOutput)
+{
+	constexpr double sampleRate = 48000.0;
+	constexpr int blockSize = 256;
+
+	MoleculeCache& cache = MoleculeCache::getInstance();
+	const size_t numReads = cache.getNumReads(), numCompiles = cache.getNumCompiles(), numHits = cache.getNumHits();
+
+	std::fprintf(aOutput, "%s\n", aPath.c_str());
+	std::vector<std::unique_ptr<MoleculePlugin>> instances;
+	for (int i = 0; i != aNumInstances; ++i)
+	{
+		instances.push_back(std::make_unique<MoleculePlugin>());
+		const auto start = std::chrono::steady_clock::now();
+		const bool isLoaded = instances.back()->loadMoleculeFile(aPath);
+		const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if (!isLoaded)
+		{
+			std::fprintf(aOutput, "  could not load\n");
+			return;
+		}
+		std::fprintf(aOutput, "  instance %d loaded in %8.2f ms\n", i, elapsed.count());
+	}
+	std::fprintf(aOutput, "  %u atoms; %zu reads, %zu compiles, %zu cache hits\n", instances.front()->getEngine().getNumSimulatedAtoms(),
+				 cache.getNumReads() - numReads, cache.getNumCompiles() - numCompiles, cache.getNumHits() - numHits);
+
+	// Read and compiled outside the cache, so nothing is shared with the instances;
+	auto reference = std::make_unique<MoleculePlugin>();
+	LoadedMolecule unshared;
+	if (!MoleculeEngine::readMolecule(aPath, unshared))
+	{
+		std::fprintf(aOutput, "  could not load\n");
+		return;
+	}
+	reference->getEngine().loadMolecule(unshared.bonds);
+
+	juce::AudioBuffer<float> buffer(2, blockSize), referenceBuffer(2, blockSize);
+	juce::MidiBuffer noteOn, none;
+	noteOn.addEvent(juce::MidiMessage::noteOn(1, 60, 0.8f), 0);
+	for (auto& instance : instances)
+	{
+		setMaxCpuBudget(*instance);
+		instance->prepareToPlay(sampleRate, blockSize);
+	}
+	setMaxCpuBudget(*reference);
+	reference->prepareToPlay(sampleRate, blockSize);
+
+	// Instances take turns block by block, as a host's tracks do;
+	double totalMs = 0.0, worstMs = 0.0;
+	float peak = 0.0f;
+	int numDiffering = 0;
+	bool isCoarsened = false;
+	for (int b = 0; b != aNumBlocks; ++b)
+	{
+		referenceBuffer.clear();
+		reference->processBlock(referenceBuffer, b == 0 ? noteOn : none);
+		isCoarsened = isCoarsened || reference->getEngine().getDetailLevel() != 0;
+
+		for (auto& instance : instances)
+		{
+			buffer.clear();
+			const auto start = std::chrono::steady_clock::now();
+			instance->processBlock(buffer, b == 0 ? noteOn : none);
+			const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			totalMs += elapsed.count();
+			worstMs = std::max(worstMs, elapsed.count());
+			peak = std::max(peak, buffer.getMagnitude(0, blockSize));
+			isCoarsened = isCoarsened || instance->getEngine().getDetailLevel() != 0;
+
+			for (int c = 0; c != buffer.getNumChannels(); ++c)
+			{
+				if (std::memcmp(buffer.getReadPointer(c), referenceBuffer.getReadPointer(c), sizeof(float) * blockSize) != 0)
+				{
+					++numDiffering;
+					break;
+				}
+			}
+		}
+	}
+
+	const double blockMs = 1000.0 * blockSize / sampleRate;
+	std::fprintf(aOutput, "  %d blocks of %d: %.3f ms mean, %.3f ms worst per instance block (%.3f ms available); peak %.4f\n", aNumBlocks, blockSize,
+				 totalMs / ((double)aNumBlocks * aNumInstances), worstMs, blockMs, peak);
+	if (isCoarsened)
+		std::fprintf(aOutput, "  an instance coarsened under load, so outputs can't be compared\n");
+	else if (numDiffering == 0)
+		std::fprintf(aOutput, "  output bit-identical to the unshared instance\n");
+	else
+		std::fprintf(aOutput, "  output differs from the unshared instance in %d of %d instance blocks\n", numDiffering, aNumBlocks * aNumInstances);
+}
+
+// Every molecule in aPdbPaths, aNumInstances at a time;
+inline void runInstanceBenchmark(const std::vector<std::string>& aPdbPaths, int aNumInstances, FILE* aOutput)
+{
+	std::fprintf(aOutput, "%d plugin instances per molecule.\n", aNumInstances);
+	for (const auto& path : aPdbPaths)
+		benchmarkInstances(path, aNumInstances, 200, aOutput);
+}
@@ -0,0 +1,376 @@
+/*
+  ==============================================================================
+
+    KernelTuner.h
+
+    Picks the fastest StencilKernel layout for the loaded molecule. A worker
+    thread builds every candidate, checks it against CSR, times a few
+    thousand steps of each and keeps the winner for the caller to take with
+    takeResult(), so it decides when the audio thread sees it. The caller
+    shares the topology rather than handing over a copy, and kernels are
+    immutable, so engines playing the same molecule can share the winner
+    (see KernelChoice). The choice is also cached per molecule and CPU
+    model in a file, so next time the molecule loads the winner is built
+    straight away without timing anything.
+
+    Temporal tiling (TemporalTiler.h) is one more candidate when the caller
+    passes a tiler for the molecule. It is timed over the same steps and
+    only selected when it beats every layout, since whether it pays off
+    depends on the machine's caches more than on the molecule's size.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "StencilKernels.h"
+#include "TemporalTiler.h"
+#include "TraceRecorder.h"
+
+class KernelTuner
+{
+public:
+	static constexpr double tuningWorkPerCandidate = 4.0e6;		// Bond and node updates per timed run;
+	static constexpr int numTimedRuns = 3;
+	static constexpr const char* tilingName = "Temporal tiling";
+
+	// The worker starts with the first tuneAsync();
+	KernelTuner() = default;
+
+	~KernelTuner()
+	{
+		if (!worker.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			shouldExit = true;
+		}
+		jobReady.notify_one();
+		worker.join();
+	}
+
+	// Where decisions are remembered, keyed by aCpuModel. Without a path nothing is cached;
+	void setCache(const std::string& aPath, const std::string& aCpuModel)
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		cachePath = aPath;
+		cpuModel = aCpuModel;
+	}
+
+	// The winner of one request: a kernel, or tiling with no kernel;
+	struct Result
+	{
+		std::shared_ptr<const StencilKernel> kernel;
+		bool isTiled = false;		// The tiler passed to tuneAsync() measured faster than every kernel;
+		uint32_t tag = 0;			// As passed to tuneAsync();
+	};
+
+	// Queue aTopology for tuning, replacing any pending request or result not yet taken. The tuner reads it until the
+	// result is taken, and must not be modified meanwhile. aTiler, if given, is a tiler prepared for aTopology to time
+	// as well, which the tuner keeps. aTag is returned with the result;
+	void tuneAsync(std::shared_ptr<const MoleculeTopology> aTopology, uint32_t aTag, std::unique_ptr<TemporalTiler> aTiler = nullptr)
+	{
+		cancel();
+		if (aTopology == nullptr || aTopology->numNodes < 2)
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			pendingTopology = std::move(aTopology);
+			pendingTiler = aTiler != nullptr && aTiler->isActive() ? std::move(aTiler) : nullptr;
+			pendingTag = aTag;
+			pendingGeneration = generation.load();
+			hasPendingJob = true;
+		}
+		jobReady.notify_one();
+		if (!worker.joinable())
+			worker = std::thread([this] { run(); });
+	}
+
+	// Drop any pending request and result not yet taken. A tuning run in progress stops at its next candidate;
+	void cancel()
+	{
+		std::unique_ptr<Result> superseded;
+		std::lock_guard<std::mutex> lock(jobMutex);
+		++generation;
+		hasPendingJob = false;
+		pendingTopology.reset();
+		superseded = std::move(completed);
+	}
+
+	// The result for the last request, once tuning finishes, or nullptr;
+	std::unique_ptr<Result> takeResult()
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		return std::move(completed);
+	}
+
+	// Stable key for a molecule: FNV-1a over its structure, clamping and masses;
+	static std::string getTopologyKey(const MoleculeTopology& aTopology)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		auto mix = [&hash](const void* aData, size_t aNumBytes)
+		{
+			const unsigned char* bytes = static_cast<const unsigned char*>(aData);
+			for (size_t b = 0; b != aNumBytes; ++b)
+				hash = (hash ^ bytes[b]) * 1099511628211ull;
+		};
+		mix(&aTopology.numNodes, sizeof(aTopology.numNodes));
+		mix(&aTopology.numClamped, sizeof(aTopology.numClamped));
+		mix(aTopology.rowStart.data(), aTopology.rowStart.size() * sizeof(uint32_t));
+		mix(aTopology.neighbours.data(), aTopology.neighbours.size() * sizeof(uint32_t));
+		mix(aTopology.stiffness.data(), aTopology.stiffness.size() * sizeof(float));
+		mix(aTopology.mass.data(), aTopology.mass.size() * sizeof(float));
+
+		char key[17];
+		std::snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+		return key;
+	}
+
+private:
+	void run()
+	{
+		TRACE_THREAD("Kernel tuner");
+		for (;;)
+		{
+			std::shared_ptr<const MoleculeTopology> topology;
+			std::unique_ptr<TemporalTiler> tiler;
+			uint32_t jobGeneration = 0, jobTag = 0;
+			std::string jobCachePath, jobCpuModel;
+			{
+				std::unique_lock<std::mutex> lock(jobMutex);
+				jobReady.wait(lock, [this] { return shouldExit || hasPendingJob; });
+				if (shouldExit)
+					return;
+				topology = std::move(pendingTopology);
+				tiler = std::move(pendingTiler);
+				jobGeneration = pendingGeneration;
+				jobTag = pendingTag;
+				jobCachePath = cachePath;
+				jobCpuModel = cpuModel;
+				hasPendingJob = false;
+			}
+
+			auto winner = std::make_unique<Result>(tune(*topology, tiler.get(), jobGeneration, jobCachePath, jobCpuModel));
+			if (winner->kernel == nullptr && !winner->isTiled)
+				continue;
+			winner->tag = jobTag;
+
+			// Superseded while tuning, the winner is freed here without anyone having seen it;
+			std::lock_guard<std::mutex> lock(jobMutex);
+			if (jobGeneration == generation.load())
+			{
+				completed = std::move(winner);
+				TRACE_INSTANT("Kernel selected");
+			}
+		}
+	}
+
+	Result tune(const MoleculeTopology& aTopology, TemporalTiler* aTiler, uint32_t aGeneration, const std::string& aCachePath, const std::string& aCpuModel)
+	{
+		TRACE_SCOPE("Tune kernels");
+		std::vector<std::unique_ptr<StencilKernel>> candidates = makeStencilKernels(aTopology);
+		const std::string key = getTopologyKey(aTopology);
+
+		// The file can be edited by hand, so anything but a name where one is expected is a miss;
+		const nlohmann::json cache = loadCache(aCachePath);
+		std::string cachedName;
+		const auto machine = cache.find(aCpuModel);
+		if (machine != cache.end() && machine->is_object())
+		{
+			const auto entry = machine->find(key);
+			if (entry != machine->end() && entry->is_string())
+				cachedName = entry->get<std::string>();
+		}
+		if (!cachedName.empty())
+		{
+			if (cachedName == tilingName && aTiler != nullptr)
+				return { nullptr, true, 0 };
+			for (auto& candidate : candidates)
+			{
+				if (candidate->getName() == cachedName)
+					return { std::move(candidate), false, 0 };
+			}
+		}
+
+		// Shared starting state, far from rest so no candidate can skip work on zeros;
+		const uint32_t numNodes = aTopology.numNodes;
+		std::vector<double> initial[2];
+		for (int t = 0; t != 2; ++t)
+		{
+			initial[t].resize(numNodes);
+			for (uint32_t i = 0; i != numNodes; ++i)
+				initial[t][i] = i < aTopology.numClamped ? 0.0 : 0.001 * std::sin(0.37 * i + t);
+		}
+		const double lapCoeff = 0.2;
+		const double dampCoeff = 1.0e-4;
+
+		std::vector<double> reference(numNodes, 0.0);
+		candidates[0]->step(initial[1].data(), initial[0].data(), reference.data(), lapCoeff, dampCoeff);
+
+		const int numSteps = (int)std::max(200.0, std::min(20000.0, tuningWorkPerCandidate / (double)aTopology.getSweepCost()));
+		std::vector<double> state[3];
+		for (auto& s : state)
+			s.resize(numNodes);
+
+		size_t idxWinner = 0;
+		double bestSeconds = 1.0e30;
+		for (size_t c = 0; c != candidates.size(); ++c)
+		{
+			if (aGeneration != generation.load())
+				return {};
+
+			// A layout that disagrees with CSR is a bug, never a winner;
+			std::vector<double> check(numNodes, 0.0);
+			candidates[c]->step(initial[1].data(), initial[0].data(), check.data(), lapCoeff, dampCoeff);
+			bool isCorrect = true;
+			for (uint32_t i = aTopology.numClamped; i < numNodes; ++i)
+				isCorrect = isCorrect && std::abs(check[i] - reference[i]) <= 1.0e-9 * (1.0 + std::abs(reference[i]));
+			if (!isCorrect)
+				continue;
+
+			double seconds = 1.0e30;
+			for (int r = 0; r != numTimedRuns; ++r)
+			{
+				state[0] = initial[0];
+				state[1] = initial[1];
+				int idxNMOne = 0, idxN = 1, idxNPOne = 2;
+				double energy = 0.0;
+
+				const auto start = std::chrono::steady_clock::now();
+				for (int n = 0; n != numSteps; ++n)
+				{
+					energy += candidates[c]->step(state[idxN].data(), state[idxNMOne].data(), state[idxNPOne].data(), lapCoeff, dampCoeff);
+					idxNMOne = (idxNMOne + 1) % 3;
+					idxN = (idxN + 1) % 3;
+					idxNPOne = (idxNPOne + 1) % 3;
+				}
+				const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+				// Keeps the loop from being optimised out;
+				if (std::isnan(energy))
+					break;
+				seconds = std::min(seconds, elapsed.count());
+			}
+
+			if (seconds < bestSeconds)
+			{
+				bestSeconds = seconds;
+				idxWinner = c;
+			}
+		}
+
+		const bool isTiled = aTiler != nullptr && aGeneration == generation.load()
+							 && timeTiler(*aTiler, initial, reference, numSteps, lapCoeff, dampCoeff, aTopology.numClamped) < bestSeconds;
+
+		if (!aCachePath.empty())
+			saveChoice(aCachePath, aCpuModel, key, isTiled ? std::string(tilingName) : candidates[idxWinner]->getName());
+
+		if (isTiled)
+			return { nullptr, true, 0 };
+		return { std::move(candidates[idxWinner]), false, 0 };
+	}
+
+	// Best of numTimedRuns runs of aNumSteps steps, as for the kernels, or a huge time if the tiler's first step
+	// disagrees with aReference;
+	static double timeTiler(TemporalTiler& aTiler, const std::vector<double>* aInitial, const std::vector<double>& aReference, int aNumSteps,
+							double aLapCoeff, double aDampCoeff, uint32_t aNumClamped)
+	{
+		const size_t numNodes = aReference.size();
+		const BoundaryNodes noBoundary;
+		const float input[TemporalTiler::maxDepth] = {};
+		std::vector<double> state[3];
+
+		double seconds = 1.0e30;
+		for (int r = 0; r != numTimedRuns + 1; ++r)
+		{
+			state[0] = aInitial[0];
+			state[1] = aInitial[1];
+			state[2].assign(numNodes, 0.0);
+			double* levels[3] = { state[0].data(), state[1].data(), state[2].data() };
+			int idxNMOne = 0, idxN = 1, idxNPOne = 2;
+			double energy = 0.0;
+
+			// The first run is one step, checked against CSR;
+			const int numSteps = r == 0 ? 1 : aNumSteps;
+			const auto start = std::chrono::steady_clock::now();
+			for (int n = 0; n < numSteps; n += TemporalTiler::maxDepth)
+				energy += aTiler.process(levels, idxNMOne, idxN, idxNPOne, input, nullptr, std::min(TemporalTiler::maxDepth, numSteps - n),
+										 noBoundary, aLapCoeff, aDampCoeff);
+			const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+			if (r == 0)
+			{
+				for (size_t i = aNumClamped; i < numNodes; ++i)
+				{
+					if (std::abs(state[idxN][i] - aReference[i]) > 1.0e-9 * (1.0 + std::abs(aReference[i])))
+						return 1.0e30;
+				}
+			}
+			else if (!std::isnan(energy))
+			{
+				seconds = std::min(seconds, elapsed.count());
+			}
+		}
+		return seconds;
+	}
+
+	// Tuners in one process share the file, so each merges its choice into what is there under a process-wide lock,
+	// and replaces the file by renaming so readers in other processes never see it half written;
+	static void saveChoice(const std::string& aPath, const std::string& aCpuModel, const std::string& aKey, const std::string& aName)
+	{
+		static std::mutex fileMutex;
+		std::lock_guard<std::mutex> lock(fileMutex);
+		nlohmann::json cache = loadCache(aPath);
+		if (!cache[aCpuModel].is_object())
+			cache[aCpuModel] = nlohmann::json::object();
+		cache[aCpuModel][aKey] = aName;
+
+		const std::string temporaryPath = aPath + ".tmp";
+		{
+			std::ofstream flCache(temporaryPath);
+			flCache << cache.dump(1, '\t');
+			if (!flCache)
+				return;
+		}
+		std::rename(temporaryPath.c_str(), aPath.c_str());
+	}
+
+	static nlohmann::json loadCache(const std::string& aPath)
+	{
+		std::ifstream flCache(aPath);
+		nlohmann::json cache = nlohmann::json::parse(flCache, nullptr, false);
+		return cache.is_object() ? cache : nlohmann::json::object();
+	}
+
+	std::thread worker;
+	std::mutex jobMutex;
+	std::condition_variable jobReady;
+	bool shouldExit = false;
+	bool hasPendingJob = false;
+	std::shared_ptr<const MoleculeTopology> pendingTopology;
+	std::unique_ptr<TemporalTiler> pendingTiler;
+	uint32_t pendingTag = 0;
+	uint32_t pendingGeneration = 0;
+	std::string cachePath;
+	std::string cpuModel;
+	std::unique_ptr<Result> completed;		// Guarded by jobMutex;
+
+	// Bumped by every request, so older runs stop early and their results are dropped. Written under jobMutex;
+	std::atomic<uint32_t> generation { 0 };
+};
@@ -0,0 +1,123 @@
+/*
+  ==============================================================================
+
+    LiveExcitation.h
+
+    Incoming device audio as the excitation signal, so the molecule can be
+    played as an effect. Gain and an optional one-pole lowpass are applied
+    in place on the device buffer. When the internal rate equals the device
+    rate the simulation then reads that buffer directly. Otherwise a
+    PolyphaseResampler converts it to the internal rate through a small
+    queue. The queue absorbs the one-sample wobble between the number of
+    device samples a chunk consumes and the number it produces.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "PolyphaseResampler.h"
+
+class LiveExcitation
+{
+public:
+	// Allocates the queue for chunks of up to aMaxChunk device samples. Not for the audio thread while it plays;
+	void allocate(int aMaxChunk)
+	{
+		maxChunk = aMaxChunk;
+		capacity = 2 * aMaxChunk + queuePriming + PolyphaseResampler::numTaps;
+		queue.assign(capacity, 0.0f);
+		reset();
+	}
+
+	// The most device samples process() may push at once;
+	int getMaxChunk() const { return maxChunk; }
+
+	// Resample with aTable, from the device rate to the internal rate, which must outlive its use here. The queue and
+	// filter carry on, so it is safe to call from the audio thread while it plays;
+	void setTable(const PolyphaseResampler::Table& aTable)
+	{
+		deviceRate = aTable.inputRate;
+		internalRate = aTable.outputRate;
+		resampler.setTable(aTable);
+	}
+
+	void reset()
+	{
+		resampler.reset();
+		filterState = 0.0f;
+
+		// A little headroom so rounding never leaves a chunk one sample short;
+		numQueued = std::min(queuePriming, capacity);
+		std::fill(queue.begin(), queue.begin() + numQueued, 0.0f);
+	}
+
+	// True when the conditioned device buffer can be read as it is;
+	bool isDirect() const { return deviceRate == internalRate; }
+
+	// Scale aNumSamples device samples by aGain in place, lowpassed at aCutoff Hz unless that is at or above Nyquist;
+	void condition(float* aSamples, int aNumSamples, float aGain, float aCutoff)
+	{
+		if (aCutoff >= 0.5 * deviceRate)
+		{
+			for (int n = 0; n != aNumSamples; ++n)
+				aSamples[n] *= aGain;
+			return;
+		}
+
+		const float coeff = 1.0f - (float)std::exp(-2.0 * 3.14159265358979323846 * aCutoff / deviceRate);
+		float state = filterState;
+		for (int n = 0; n != aNumSamples; ++n)
+		{
+			state += coeff * (aGain * aSamples[n] - state);
+			aSamples[n] = state;
+		}
+		filterState = state;
+	}
+
+	// Queue conditioned device samples for read(). The oldest are dropped if the queue is full;
+	void push(const float* aSamples, int aNumSamples)
+	{
+		if (numQueued + aNumSamples > capacity)
+		{
+			const int numDropped = std::min(numQueued, numQueued + aNumSamples - capacity);
+			std::copy(queue.begin() + numDropped, queue.begin() + numQueued, queue.begin());
+			numQueued -= numDropped;
+			aNumSamples = std::min(aNumSamples, capacity);
+		}
+		std::copy(aSamples, aSamples + aNumSamples, queue.begin() + numQueued);
+		numQueued += aNumSamples;
+	}
+
+	// aNumSamples samples at the internal rate. A queue that runs short is padded with silence;
+	void read(float* aOutput, int aNumSamples)
+	{
+		const int numRequired = resampler.getNumInputSamplesRequired(aNumSamples);
+		if (numQueued < numRequired)
+		{
+			std::fill(queue.begin() + numQueued, queue.begin() + numRequired, 0.0f);
+			numQueued = numRequired;
+		}
+
+		resampler.process(queue.data(), numRequired, aOutput, aNumSamples);
+		std::copy(queue.begin() + numRequired, queue.begin() + numQueued, queue.begin());
+		numQueued -= numRequired;
+	}
+
+private:
+	static constexpr int queuePriming = 4;
+
+	double deviceRate = 44100.0;
+	double internalRate = 44100.0;
+	PolyphaseResampler resampler;
+	float filterState = 0.0f;
+
+	std::vector<float> queue;		// Device samples, sized by allocate();
+	int capacity = 0;
+	int maxChunk = 0;
+	int numQueued = 0;
+};
@@ -8,6 +8,9 @@
 
 #include <JuceHeader.h>
 #include "MolecularSynthesis.h"
+#include "InstanceBenchmark.h"
+#include "PerfBenchmark.h"
+#include "PrecisionBenchmark.h"
 
 class Application    : public juce::JUCEApplication
 {
@@ -18,14 +21,51 @@ public:
     const juce::String getApplicationName() override       { return "MolecularSynthesis"; }
     const juce::String getApplicationVersion() override    { return "1.0.0"; }
 
-    void initialise (const juce::String&) override
+    void initialise (const juce::String& commandLine) override
     {
+        // --benchmark [file.pdb ...] prints the precision comparison, --perf [file.pdb ...] the hardware counters per
+        // kernel layout and --instances [N] [file.pdb ...] how N plugin instances load and play, then quit. All default
+        // to the bundled molecules;
+        if (commandLine.contains ("--benchmark"))
+        {
+            runPrecisionBenchmark (getBenchmarkPaths (commandLine, "--benchmark"), stdout);
+            quit();
+            return;
+        }
+        if (commandLine.contains ("--perf"))
+        {
+            runPerfBenchmark (getBenchmarkPaths (commandLine, "--perf"), stdout);
+            quit();
+            return;
+        }
+        if (commandLine.contains ("--instances"))
+        {
+            const int numInstances = commandLine.fromFirstOccurrenceOf ("--instances", false, false).trim().getIntValue();
+            runInstanceBenchmark (getBenchmarkPaths (commandLine, "--instances"), numInstances > 0 ? numInstances : 8, stdout);
+            quit();
+            return;
+        }
+
         mainWindow.reset (new MainWindow ("MolecularSynthesis", new MolecularSynthesis, *this));
     }
 
     void shutdown() override                         { mainWindow = nullptr; }
 
 private:
+    static std::vector<std::string> getBenchmarkPaths (const juce::String& commandLine, const juce::String& flag)
+    {
+        std::vector<std::string> paths;
+        auto args = juce::StringArray::fromTokens (commandLine.fromFirstOccurrenceOf (flag, false, false), true);
+        for (auto& arg : args)
+            if (arg.unquoted().endsWithIgnoreCase (".pdb"))
+                paths.push_back (arg.unquoted().toStdString());
+
+        if (paths.empty())
+            for (auto& file : juce::File::getCurrentWorkingDirectory().getChildFile ("../../Source/resources").findChildFiles (juce::File::findFiles, false, "*.pdb"))
+                paths.push_back (file.getFullPathName().toStdString());
+        return paths;
+    }
+
     class MainWindow    : public juce::DocumentWindow
     {
     public:
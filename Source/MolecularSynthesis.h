@@ -34,199 +34,110 @@
 #include <nlohmann/json.hpp>
 #include <string>
 #include <algorithm>
+#include <array>
+#include <vector>
 
-#define SIGNAL_PERIOD 20
-
-// for convenience
-using json = nlohmann::json;
+#include "MoleculeEngine.h"
+#include "StaticMolecule.h"
+#include "MoleculeRenderer.h"
+#include "AtomPicker.h"
 
 //==============================================================================
+// The GUI over MoleculeEngine: controls, the molecule view and editor, MIDI input and recording. Everything that
+// makes sound is in the engine;
 class MolecularSynthesis : public AudioAppComponent,
 									public juce::Slider::Listener,
                                     private Timer
 {
 public:
-	struct Atom		//@ToDo - Extend this to operate in more dimensions? So have arrays of position, velocity, acceleration;
-	{
-		uint32_t numConnections = 0;
-		Atom* connections[300];
-		double mass;
-		double force[3];
-		double position[3];
-		double velocity[3];
-		double acceleration[3];
-
-		float posX;
-		float posY;
-	};
-
-	void defaultMolecule(Atom& aMolecule)
-	{
-		aMolecule.mass = 2.0;
-		aMolecule.force[0] = 0.0;
-		aMolecule.force[1] = 0.0;
-		aMolecule.force[2] = 0.0;
-		aMolecule.position[0] = 0.01;
-		aMolecule.position[1] = 0.01;
-		aMolecule.position[2] = 0.01;
-		aMolecule.velocity[0] = 0.0;
-		aMolecule.velocity[1] = 0.0;
-		aMolecule.velocity[2] = 0.0;
-		aMolecule.acceleration[0] = 0.0;
-		aMolecule.acceleration[1] = 0.0;
-		aMolecule.acceleration[2] = 0.0;
-	}
-
-	// Parse .pdb file containing CONECT entries. Populates aMolecules with connections;
-	void parsePDB(std::string aPath, Atom aMolecule[])
+	// Load aPath into the engine and take each atom's coordinates and element for the view, laid out flat as in the
+	// editor when the file has no coordinates;
+	void loadMolecule(const std::string& aPath)
 	{
-		std::ifstream flPdb(aPath);
-
-		//size_t numAtoms = 0;
-		std::string line;
-
-		while (std::getline(flPdb, line))
+		if (!engine.load(aPath))
 		{
-			std::string throwaway;
-			std::stringstream ss(line);
-			ss >> throwaway;
-			if (throwaway.find("CONECT") != std::string::npos)
-			{
-				size_t numBonds = 0;
-				uint32_t idxAtom;
-				ss >> idxAtom;
-				idxAtom -= 1;
-
-				// Default initalization of molecule;
-				defaultMolecule(aMolecule[idxAtom]);
-
-				uint32_t idxBond;
-				while (ss >> idxBond)
-				{
-					aMolecule[idxAtom].connections[numBonds++] = &(aMolecule[idxBond-1]);
-				}
-				aMolecule[idxAtom].numConnections = numBonds;
-				numAtoms++;
-			}
+			juce::Logger::outputDebugString("Could not read " + juce::String(aPath));
+			return;
 		}
-	}
-
-	// Parse .json file containing custom format for molecule contents and connections. Populates aMolecules with connections;
-	void parseJSON(std::string aPath, Atom aMolecule[])
-	{
-		std::ifstream i(aPath);
-		json jsonInput;
-		i >> jsonInput;
-
-		numAtoms = jsonInput["molecule"].size();
 
-		for (uint32_t i = 0; i != numAtoms; ++i)
+		const std::shared_ptr<const LoadedMolecule> loaded = engine.getSource();
+		modelPositions = loaded->positions;
+		if (modelPositions.empty())
 		{
-			aMolecule[i].numConnections = jsonInput["molecule"][i]["connections"].size();
-			for (uint32_t j = 0; j != aMolecule[i].numConnections; ++j)
-			{
-				aMolecule[i].connections[j] = &(aMolecule[jsonInput["molecule"][i]["connections"][j]]);
-			}
-			aMolecule[i].mass = jsonInput["molecule"][i]["mass"];
-			aMolecule[i].force[0] = 0.0;
-			aMolecule[i].force[1] = 0.0;
-			aMolecule[i].force[2] = 0.0;
-			aMolecule[i].position[0] = 0.01;
-			aMolecule[i].position[1] = 0.01;
-			aMolecule[i].position[2] = 0.01;
-			aMolecule[i].velocity[0] = 0.0;
-			aMolecule[i].velocity[1] = 0.0;
-			aMolecule[i].velocity[2] = 0.0;
-			aMolecule[i].acceleration[0] = 0.0;
-			aMolecule[i].acceleration[1] = 0.0;
-			aMolecule[i].acceleration[2] = 0.0;
-		}
-
-		aMolecule[inputPos].force[0] = 0.2;
-		aMolecule[inputPos].force[1] = 0.2;
-		aMolecule[inputPos].force[2] = 0.2;
-		aMolecule[inputPos].position[0] = 0.2;
-		aMolecule[inputPos].position[1] = 0.2;
-		aMolecule[inputPos].position[2] = 0.2;
+			modelPositions.assign(loaded->getNumAtoms(), { 0.0f, 0.0f, 0.0f });
+			for (uint32_t i = 0; i != std::min(loaded->getNumAtoms(), InputJsonMolecule::numNodes); ++i)
+				modelPositions[i] = { InputJsonMolecule::posX[i], -InputJsonMolecule::posY[i], 0.0f };
+		}
+		elements = loaded->elements;
 	}
+
     //==============================================================================
 	MolecularSynthesis()
        #ifdef JUCE_DEMO_RUNNER
         : AudioAppComponent (getSharedAudioDeviceManager (0, 2))
        #endif
     {
-        setSize (600, 600);
+		TRACE_THREAD("Message");
+        setSize (controlsWidth + moleculeViewWidth, 600);
+
+		// Remember the fastest kernel layout per molecule and machine;
+		auto flKernelCache = juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory).getChildFile("MolecularSynthesis").getChildFile("kernel_cache.json");
+		flKernelCache.getParentDirectory().createDirectory();
+		engine.setKernelCache(flKernelCache.getFullPathName().toStdString(), juce::SystemStats::getCpuModel().toStdString());
+
+#if MOLSYNTH_TRACING
+		TraceRecorder::getInstance().start(flKernelCache.getSiblingFile("trace.json").getFullPathName().toStdString());
+#endif
+
+		// Loaded before audio starts, so the first block already has a molecule;
+		loadMolecule("../../Source/resources/graphene_with_bonds.pdb");
+		//loadMolecule("../../Source/input.json");
+		//loadMolecule("../../Source/resources/1gwd.pdb");
+		//loadMolecule("../../Source/resources/buckyball.pdb");
+		//loadMolecule("../../Source/resources/nanotube.pdb");
+		//loadMolecule("../../Source/resources/helicene.pdb");
 
-        for (auto i = 0; i < numElementsInArray (waveValues); ++i)
-            zeromem (waveValues[i], sizeof (waveValues[i]));
+		inputPos = 14;
+		outputPos = 34;
+		outputPosRight = outputPos;		// Both channels at one atom, as the mono tap was copied to both;
+		engine.setDrivenAtoms({ { (uint32_t)inputPos, 1.0f } });
+		engine.setPickupCentres((uint32_t)outputPos, (uint32_t)outputPosRight);
+		engine.setSnapshotRecorder(&recorder);
+		engine.attachVisualiser();
 
         // specify the number of input and output channels that we want to open
         setAudioChannels (2, 2);
         startTimerHz (60);
 
-		//parseMolecule("../../Source/input.json", molecule);
-		//parsePDB("../../Source/resources/graphene_with_bonds.pdb", molecule);
-
-		flOutput.open("data2.bin", std::ios::out | std::ios::binary);
-
-		deltaT = 1 / sampleRate;
-		deltaX = 0.00001;
-		inputPos = 14;
-		outputPos = 34;
-		for (uint32_t i = 0; i != (int)sampleRate; ++i)
-		{
-			input[i] = 0.0;
-			if (i < 5)
-				input[i] = 50.0;
-		}
-
-		// Generate Sawtooth Signal;
-		int m = SIGNAL_PERIOD;
-		int x = 0;
-		int i = 0;
-		while (i < m * 3)
+		// Every MIDI input plays the voice pool;
+		for (const auto& device : juce::MidiInput::getAvailableDevices())
 		{
-			sawtooth[i] = x / (float)m;
-			x++;
-			x = x % m;
-			i++;
+			deviceManager.setMidiInputDeviceEnabled(device.identifier, true);
+			deviceManager.addMidiInputDeviceCallback(device.identifier, &midiCollector);
 		}
 
-		//Init some positions;
-
-		molecule[0].posX = 330;
-		molecule[0].posY = 300;
-		molecule[1].posX = 270;
-		molecule[1].posY = 300;
-		molecule[2].posX = 300;
-		molecule[2].posY = 270;
-		molecule[3].posX = 300;
-		molecule[3].posY = 240;
-		molecule[4].posX = 270;
-		molecule[4].posY = 210;
-		molecule[5].posX = 330;
-		molecule[5].posY = 210;
+		const uint32_t numAtoms = getNumAtoms();
 
 		// Radio Buttons;
 
 		//addAndMakeVisible(btnExcite);
-		//btnExcite.setBounds(20, 40, getWidth() - 30, 20);
+		//btnExcite.setBounds(20, 40, controlsWidth - 30, 20);
 		//btnExcite.onClick = [this] { updateToggleState(&btnExcite, "Excite");   };
 
 		//addAndMakeVisible(btnCreate);
-		//btnCreate.setBounds(20, 60, getWidth() - 30, 20);
+		//btnCreate.setBounds(20, 60, controlsWidth - 30, 20);
 		//btnCreate.onClick = [this] { updateToggleState(&btnCreate, "Create");   };
 
 		//addAndMakeVisible(btnConnect);
-		//btnConnect.setBounds(20, 80, getWidth() - 30, 20);
+		//btnConnect.setBounds(20, 80, controlsWidth - 30, 20);
 		//btnConnect.onClick = [this] { updateToggleState(&btnConnect, "Connect");   };
 
 		//addAndMakeVisible(btnSetInputPos);
-		//btnSetInputPos.setBounds(20, 100, getWidth() - 30, 20);
+		//btnSetInputPos.setBounds(20, 100, controlsWidth - 30, 20);
 		//btnSetInputPos.onClick = [this] { updateToggleState(&btnSetInputPos, "InputPos");   };
 
 		//addAndMakeVisible(btnSetOutputPos);
-		//btnSetOutputPos.setBounds(20, 120, getWidth() - 30, 20);
+		//btnSetOutputPos.setBounds(20, 120, controlsWidth - 30, 20);
 		//btnSetOutputPos.onClick = [this] { updateToggleState(&btnSetOutputPos, "OutputPos");   };
 
 		//btnExcite.setRadioGroupId(idRadioButton);
@@ -236,20 +147,25 @@ public:
 		//btnSetOutputPos.setRadioGroupId(idRadioButton);
 
 		addAndMakeVisible(btnImpulse);
-		btnImpulse.setBounds(20, 40, getWidth() - 30, 20);
+		btnImpulse.setBounds(20, 40, controlsWidth - 30, 20);
 		btnImpulse.onClick = [this] { updateToggleState(&btnImpulse, "Impulse");   };
 
 		addAndMakeVisible(btnSin);
-		btnSin.setBounds(20, 60, getWidth() - 30, 20);
+		btnSin.setBounds(20, 60, controlsWidth - 30, 20);
 		btnSin.onClick = [this] { updateToggleState(&btnSin, "Sin");   };
 
 		addAndMakeVisible(btnSaw);
-		btnSaw.setBounds(20, 80, getWidth() - 30, 20);
+		btnSaw.setBounds(20, 80, controlsWidth - 30, 20);
 		btnSaw.onClick = [this] { updateToggleState(&btnSaw, "Saw");   };
 
+		addAndMakeVisible(btnLiveInput);
+		btnLiveInput.setBounds(20, 100, controlsWidth - 30, 20);
+		btnLiveInput.onClick = [this] { updateToggleState(&btnLiveInput, "Live Input");   };
+
 		btnImpulse.setRadioGroupId(idRadioButton);
 		btnSin.setRadioGroupId(idRadioButton);
 		btnSaw.setRadioGroupId(idRadioButton);
+		btnLiveInput.setRadioGroupId(idRadioButton);
 
 
 		// Sliders;
@@ -257,18 +173,18 @@ public:
 		addAndMakeVisible(lblInputPos);
 		lblInputPos.setText("Input Pos: ", juce::dontSendNotification);
 		lblInputPos.attachToComponent(&sldInputPos, true);
-		
+
 		addAndMakeVisible(sldInputPos);
-		sldInputPos.setBounds(20, 140, getWidth() - 30, 20);
+		sldInputPos.setBounds(20, 140, controlsWidth - 30, 20);
 		sldInputPos.setRange(0, numAtoms, 1);
 		sldInputPos.addListener(this);
 
 		addAndMakeVisible(lblOutputPos);
-		lblOutputPos.setText("Output Pos: ", juce::dontSendNotification);
+		lblOutputPos.setText("Output Pos L: ", juce::dontSendNotification);
 		lblOutputPos.attachToComponent(&sldOutputPos, true);
 
 		addAndMakeVisible(sldOutputPos);
-		sldOutputPos.setBounds(20, 160, getWidth() - 30, 20);
+		sldOutputPos.setBounds(20, 160, controlsWidth - 30, 20);
 		sldOutputPos.setRange(0, numAtoms, 1);
 		sldOutputPos.addListener(this);
 
@@ -277,7 +193,7 @@ public:
 		lblWaveSpeed.attachToComponent(&sldWaveSpeed, true);
 
 		addAndMakeVisible(sldWaveSpeed);
-		sldWaveSpeed.setBounds(20, 180, getWidth() - 30, 20);
+		sldWaveSpeed.setBounds(20, 180, controlsWidth - 30, 20);
 		sldWaveSpeed.setRange(0.000001, 1.0);
 		sldWaveSpeed.addListener(this);
 
@@ -286,10 +202,116 @@ public:
 		lblGenDamping.attachToComponent(&sldGenDamping, true);
 
 		addAndMakeVisible(sldGenDamping);
-		sldGenDamping.setBounds(20, 200, getWidth() - 30, 20);
+		sldGenDamping.setBounds(20, 200, controlsWidth - 30, 20);
 		sldGenDamping.setRange(0.0, 2.0);
 		sldGenDamping.addListener(this);
 
+		addAndMakeVisible(lblInternalRate);
+		lblInternalRate.setText("Internal Rate: ", juce::dontSendNotification);
+		lblInternalRate.attachToComponent(&sldInternalRate, true);
+
+		addAndMakeVisible(sldInternalRate);
+		sldInternalRate.setBounds(20, 220, controlsWidth - 30, 20);
+		sldInternalRate.setRange(MoleculeEngine::minInternalRate, MoleculeEngine::maxInternalRate, 100.0);
+		sldInternalRate.setSkewFactorFromMidPoint(48000.0);
+		sldInternalRate.setValue(engine.getParam(MoleculeEngine::Param_InternalRate), juce::dontSendNotification);
+		sldInternalRate.setTextValueSuffix(" Hz");
+		sldInternalRate.addListener(this);
+
+		addAndMakeVisible(lblCpuBudget);
+		lblCpuBudget.setText("CPU Budget: ", juce::dontSendNotification);
+		lblCpuBudget.attachToComponent(&sldCpuBudget, true);
+
+		addAndMakeVisible(sldCpuBudget);
+		sldCpuBudget.setBounds(20, 240, controlsWidth - 30, 20);
+		sldCpuBudget.setRange(0.05, 1.0, 0.01);
+		sldCpuBudget.setValue(engine.getParam(MoleculeEngine::Param_CpuBudget), juce::dontSendNotification);
+		sldCpuBudget.addListener(this);
+
+		addAndMakeVisible(lblDetailLevel);
+		lblDetailLevel.setBounds(20, 260, controlsWidth - 30, 20);
+
+		addAndMakeVisible(btnJit);
+		btnJit.setBounds(20, 280, 250, 20);
+		btnJit.onClick = [this] { engine.setJitEnabled(btnJit.getToggleState()); };
+
+		addAndMakeVisible(cmbPrecision);
+		cmbPrecision.setBounds(280, 280, controlsWidth - 290, 20);
+		cmbPrecision.addItemList({ "Double precision", "Float, to compare", "Float with double sum, to compare" }, 1);
+		cmbPrecision.setSelectedItemIndex(engine.getPrecision(), juce::dontSendNotification);
+		cmbPrecision.onChange = [this] { engine.setPrecision((MoleculeEngine::Precision)cmbPrecision.getSelectedItemIndex()); };
+
+		addAndMakeVisible(btnClamp);
+		btnClamp.setBounds(20, 300, controlsWidth - 30, 20);
+		btnClamp.onClick = [this] { interactiveState = btnClamp.getToggleState() ? State_Clamp : State_Excite; };
+
+		addAndMakeVisible(lblOutputPosRight);
+		lblOutputPosRight.setText("Output Pos R: ", juce::dontSendNotification);
+		lblOutputPosRight.attachToComponent(&sldOutputPosRight, true);
+
+		addAndMakeVisible(sldOutputPosRight);
+		sldOutputPosRight.setBounds(20, 320, controlsWidth - 30, 20);
+		sldOutputPosRight.setRange(0, numAtoms, 1);
+		sldOutputPosRight.addListener(this);
+
+		addAndMakeVisible(lblPickupSpread);
+		lblPickupSpread.setText("Pickup Spread: ", juce::dontSendNotification);
+		lblPickupSpread.attachToComponent(&sldPickupSpread, true);
+
+		addAndMakeVisible(sldPickupSpread);
+		sldPickupSpread.setBounds(20, 340, controlsWidth - 30, 20);
+		sldPickupSpread.setRange(0.0, 4.0, 0.1);
+		sldPickupSpread.setTextValueSuffix(" bonds");
+		sldPickupSpread.addListener(this);
+
+		addAndMakeVisible(lblInputGain);
+		lblInputGain.setText("Input Gain: ", juce::dontSendNotification);
+		lblInputGain.attachToComponent(&sldInputGain, true);
+
+		addAndMakeVisible(sldInputGain);
+		sldInputGain.setBounds(20, 360, controlsWidth - 30, 20);
+		sldInputGain.setRange(0.0, 4.0, 0.01);
+		sldInputGain.setValue(engine.getParam(MoleculeEngine::Param_InputGain), juce::dontSendNotification);
+		sldInputGain.addListener(this);
+
+		addAndMakeVisible(lblInputFilter);
+		lblInputFilter.setText("Input Lowpass: ", juce::dontSendNotification);
+		lblInputFilter.attachToComponent(&sldInputFilter, true);
+
+		// The top of the range is above Nyquist at common device rates, which turns the filter off;
+		addAndMakeVisible(sldInputFilter);
+		sldInputFilter.setBounds(20, 380, controlsWidth - 30, 20);
+		sldInputFilter.setRange(20.0, 24000.0, 1.0);
+		sldInputFilter.setSkewFactorFromMidPoint(1000.0);
+		sldInputFilter.setValue(engine.getParam(MoleculeEngine::Param_InputCutoff), juce::dontSendNotification);
+		sldInputFilter.setTextValueSuffix(" Hz");
+		sldInputFilter.addListener(this);
+
+		addAndMakeVisible(btnMidiAtoms);
+		btnMidiAtoms.setBounds(20, 400, controlsWidth - 30, 20);
+		btnMidiAtoms.onClick = [this] { engine.setMidiKeysSelectAtoms(btnMidiAtoms.getToggleState()); };
+
+		addAndMakeVisible(lblDeadline);
+		lblDeadline.setBounds(20, 420, controlsWidth - 30, 20);
+
+		addAndMakeVisible(btnExportTimings);
+		btnExportTimings.setBounds(20, 440, 150, 20);
+		btnExportTimings.onClick = [this] { exportTimings(); };
+
+		addAndMakeVisible(btnResetTimings);
+		btnResetTimings.setBounds(180, 440, 150, 20);
+		btnResetTimings.onClick = [this] { engine.getDeadlineMonitor().reset(); };
+
+		addAndMakeVisible(btnRecord);
+		btnRecord.setBounds(20, 460, 150, 20);
+		btnRecord.setClickingTogglesState(true);
+		btnRecord.onClick = [this] { setRecording(btnRecord.getToggleState()); };
+
+		addAndMakeVisible(btnRecordSnapshots);
+		btnRecordSnapshots.setBounds(180, 460, 150, 20);
+
+		addAndMakeVisible(lblRecording);
+		lblRecording.setBounds(340, 460, controlsWidth - 350, 20);
 
     }
 	void updateToggleState(juce::Button* button, juce::String name)
@@ -346,7 +368,7 @@ public:
 
 			juce::Logger::outputDebugString(name + " Button changed to " + stateString);
 
-			exciteState = State_Impulse;
+			engine.setExcitation(MoleculeEngine::Excitation_Impulse);
 		}
 		else if (name.contains("Sin"))
 		{
@@ -355,7 +377,7 @@ public:
 
 			juce::Logger::outputDebugString(name + " Button changed to " + stateString);
 
-			exciteState = State_Sin;
+			engine.setExcitation(MoleculeEngine::Excitation_Sin);
 		}
 		else if (name.contains("Saw"))
 		{
@@ -364,7 +386,16 @@ public:
 
 			juce::Logger::outputDebugString(name + " Button changed to " + stateString);
 
-			exciteState = State_Saw;
+			engine.setExcitation(MoleculeEngine::Excitation_Saw);
+		}
+		else if (name.contains("Live Input"))
+		{
+			auto state = button->getToggleState();
+			juce::String stateString = state ? "ON" : "OFF";
+
+			juce::Logger::outputDebugString(name + " Button changed to " + stateString);
+
+			engine.setExcitation(MoleculeEngine::Excitation_LiveInput);
 		}
 	}
 	void sliderValueChanged(juce::Slider* slider) override
@@ -372,439 +403,403 @@ public:
 		if (slider == &sldInputPos)
 		{
 			inputPos = sldInputPos.getValue();
-			//sldWaveSpeed.setValue(1.0 / sldWaveSpeed.getValue(), juce::dontSendNotification);
+			engine.setDrivenAtoms({ { (uint32_t)inputPos, 1.0f } });
 		}
 		if (slider == &sldOutputPos)
 		{
-			inputPos = sldOutputPos.getValue();
-			//sldWaveSpeed.setValue(1.0 / sldWaveSpeed.getValue(), juce::dontSendNotification);
+			outputPos = sldOutputPos.getValue();
+			engine.setPickupCentres((uint32_t)outputPos, (uint32_t)outputPosRight);
+		}
+		if (slider == &sldOutputPosRight)
+		{
+			outputPosRight = sldOutputPosRight.getValue();
+			engine.setPickupCentres((uint32_t)outputPos, (uint32_t)outputPosRight);
+		}
+		if (slider == &sldPickupSpread)
+		{
+			engine.setPickupSpread((float)sldPickupSpread.getValue());
 		}
 		if (slider == &sldWaveSpeed)
 		{
-			waveSpeed = sldWaveSpeed.getValue();
-			waveSpeed = waveSpeed * waveSpeed;
+			const double waveSpeed = sldWaveSpeed.getValue();
+			engine.setParam(MoleculeEngine::Param_WaveSpeed, waveSpeed * waveSpeed);
 		}
 		if (slider == &sldGenDamping)
 		{
-			genDamp = sldGenDamping.getValue();
-			genDamp = genDamp * genDamp;
+			const double genDamp = sldGenDamping.getValue();
+			engine.setParam(MoleculeEngine::Param_Damping, genDamp * genDamp);
+		}
+		if (slider == &sldInternalRate)
+		{
+			engine.setParam(MoleculeEngine::Param_InternalRate, sldInternalRate.getValue());
+		}
+		if (slider == &sldCpuBudget)
+		{
+			engine.setParam(MoleculeEngine::Param_CpuBudget, sldCpuBudget.getValue());
+		}
+		if (slider == &sldInputGain)
+		{
+			engine.setParam(MoleculeEngine::Param_InputGain, sldInputGain.getValue());
+		}
+		if (slider == &sldInputFilter)
+		{
+			engine.setParam(MoleculeEngine::Param_InputCutoff, sldInputFilter.getValue());
 		}
 	}
 
-
     ~MolecularSynthesis() override
     {
+#if MOLSYNTH_TRACING
+		TraceRecorder::getInstance().stop();
+#endif
+		recorder.stop();
+		for (const auto& device : juce::MidiInput::getAvailableDevices())
+			deviceManager.removeMidiInputDeviceCallback(device.identifier, &midiCollector);
         shutdownAudio();
     }
 
     //==============================================================================
     void prepareToPlay (int samplesPerBlockExpected, double newSampleRate) override
     {
-        sampleRate = newSampleRate;
-        expectedSamplesPerBlock = samplesPerBlockExpected;
-
-		parsePDB("../../Source/resources/graphene_with_bonds.pdb", molecule);
-		//parsePDB("../../Source/resources/1gwd.pdb", molecule);
-		//parsePDB("../../Source/resources/buckyball.pdb", molecule);
-		//parsePDB("../../Source/resources/nanotube.pdb", molecule);
-		//parsePDB("../../Source/resources/helicene.pdb", molecule);
-
-		isReady = true;
+		midiCollector.reset(newSampleRate);
+		midiMessages.ensureSize(4096);
+		engine.prepare(newSampleRate, samplesPerBlockExpected);
     }
 
-    /*  This method generates the actual audio samples.
-        In this example the buffer is filled with a sine wave whose frequency and
-        amplitude are controlled by the mouse position.
-     */
     void getNextAudioBlock (const AudioSourceChannelInfo& bufferToFill) override
     {
-        bufferToFill.clearActiveBufferRegion();
+		TRACE_THREAD("Audio");
+		TRACE_SCOPE("Audio block");
 
-		auto ind = waveTableIndex;
+		midiCollector.removeNextBlockOfMessages(midiMessages, bufferToFill.numSamples);
+		for (const auto metadata : midiMessages)
+		{
+			const auto message = metadata.getMessage();
+			if (message.isNoteOn())
+				engine.queueNote(message.getNoteNumber(), message.getFloatVelocity(), metadata.samplePosition);
+			else if (message.isNoteOff())
+				engine.queueNote(message.getNoteNumber(), 0.0f, metadata.samplePosition);
+			else if (message.isAllNotesOff() || message.isAllSoundOff())
+				engine.queueAllNotesOff();
+		}
 
-		auto* channelDataOne = bufferToFill.buffer->getWritePointer(0, bufferToFill.startSample);
-		auto* channelDataTwo = bufferToFill.buffer->getWritePointer(1, bufferToFill.startSample);
+		float* channels[maxDeviceChannels];
+		const int numChannels = std::min(bufferToFill.buffer->getNumChannels(), (int)maxDeviceChannels);
+		for (int c = 0; c != numChannels; ++c)
+			channels[c] = bufferToFill.buffer->getWritePointer(c, bufferToFill.startSample);
+		engine.process(channels, numChannels, bufferToFill.numSamples);
+		for (int c = numChannels; c < bufferToFill.buffer->getNumChannels(); ++c)
+			bufferToFill.buffer->clear(c, bufferToFill.startSample, bufferToFill.numSamples);
 
-		if (isReady)
+		// The recorder only copies into its ring, so every block is captured, silent ones included;
+		if (recorder.isRecording())
 		{
-			for (auto n = 0; n < bufferToFill.numSamples; ++n)
-			{
-				// Prepare input signal;
-				if (isExcite)
-				{
-					int m = SIGNAL_PERIOD;
-
-					float signal = 0.0;
-					if (idxSignal < m)
-					{
-						if (exciteState == State_Sin)
-						{
-							signal = sin(idxSignal / (float)(m));
-							input[n] = signal;
-						}
-						else if (exciteState == State_Saw)
-						{
-							signal = sawtooth[idxSignal];
-							input[n] = signal;
-						}
-						idxSignal++;
-					}
-					else
-						idxSignal = 0;
-				}
-				else
-				{
-					input[n] = 0.0;
-				}
-
-				for (uint32_t i = 1; i != numAtoms; ++i)
-				{
-					// Old ODE way;
-					//if (i == outputPos)
-					//	springForceY += input[n];
-					//springForceY = -kOde * molecule[i].position[idxRotationN];
-					//forceY = springForceY + molecule[i].mass * GRAVITY;
-
-					// Novel way; (This is the way)
-					float forceY = 0.0;
-					float tempForce = 0.0;
-					for (uint32_t j = 0; j != molecule[i].numConnections; ++j)
-					{
-						tempForce += molecule[i].connections[j]->force[idxRotationN];
-					}
-					forceY = waveSpeed*waveSpeed * ((tempForce - molecule[i].numConnections * molecule[i].force[idxRotationN]) / (deltaX * deltaX));
-					forceY = forceY - (2 * genDamp * ((molecule[i].force[idxRotationN] - molecule[i].force[idxRotationNMOne]) / deltaT));
-
-					//forceY = molecule[i].mass * forceY;
-					forceY = forceY * (deltaT*deltaT);
-					forceY = forceY + 2 * molecule[i].force[idxRotationN] - molecule[i].force[idxRotationNMOne];
-					//forceY *= (1 - damping);
-					if (i == inputPos)
-						forceY = input[n];
-
-					// @ToDo - Need range check?
-					//forceY = std::max(-1.0f, std::min(1.0f, forceY));
-
-					molecule[i].force[idxRotationNPOne] = forceY;
-					//molecule[i].velocity[idxRotationNPOne] = velocityY;
-					//molecule[i].position[idxRotationNPOne] = molecule[i].position[idxRotationN] + molecule[i].velocity[idxRotationNPOne] * deltaT;		//@Highlight - Used velocity from next step just calculated here.
-					//molecule[i].acceleration[idxRotationNPOne] = accelerationY;																			//@ToDo - Currently don't need this???
-
-					if (i == outputPos)
-					{
-						output[n] = molecule[i].force[idxRotationNPOne];
-						//output[n] = molecule[i].position[idxRotationNPOne];
-					}
-				}
-				idxRotationNMOne = (idxRotationNMOne + 1) % 3;
-				idxRotationN = (idxRotationN + 1) % 3;
-				idxRotationNPOne = (idxRotationNPOne + 1) % 3;
-
-				float sample = output[n];
-				channelDataOne[n] = sample;
-				channelDataTwo[n] = sample;
-				//flOutput.write(&((char)sample), sizeof(float));
-			}
+			const float* recorded[MoleculeEngine::maxOutputChannels];
+			const int numRecorded = std::min(numChannels, (int)MoleculeEngine::maxOutputChannels);
+			for (int c = 0; c != numRecorded; ++c)
+				recorded[c] = channels[c];
+			recorder.pushAudio(recorded, numRecorded, bufferToFill.numSamples);
 		}
-
-        waveTableIndex = (int) (waveTableIndex + bufferToFill.numSamples) % wavetableSize;
     }
 
+	// Start or stop recording the device output to a timestamped WAV in the app data directory, with per-atom
+	// snapshots beside it when btnRecordSnapshots is on;
+	void setRecording(bool aIsRecording)
+	{
+		if (!aIsRecording)
+		{
+			recorder.stop();
+			return;
+		}
+
+		auto dir = juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory).getChildFile("MolecularSynthesis");
+		dir.createDirectory();
+		const juce::String name = "recording-" + juce::Time::getCurrentTime().formatted("%Y%m%d-%H%M%S");
+
+		int numChannels = 2;
+		if (auto* device = deviceManager.getCurrentAudioDevice())
+			numChannels = jlimit(1, (int)MoleculeEngine::maxOutputChannels, device->getActiveOutputChannels().countNumberOfSetBits());
+
+		const double sampleRate = engine.getSampleRate();
+		std::string snapshotPath;
+		uint32_t numAtoms = 0;
+		const int snapshotInterval = jmax(1, (int)(sampleRate / snapshotsPerSecond));
+		if (btnRecordSnapshots.getToggleState())
+		{
+			numAtoms = engine.getNumSimulatedAtoms();
+			snapshotPath = dir.getChildFile(name + ".f32").getFullPathName().toStdString();
+
+			// Frame layout, for whoever reads the raw snapshot file back;
+			nlohmann::json layout;
+			layout["atoms"] = numAtoms;
+			layout["interval_samples"] = snapshotInterval;
+			layout["sample_rate"] = sampleRate;
+			layout["format"] = "float32 little-endian, one value per atom per frame";
+			std::ofstream(dir.getChildFile(name + ".json").getFullPathName().toStdString()) << layout.dump(4);
+		}
+
+		if (!recorder.start(dir.getChildFile(name + ".wav").getFullPathName().toStdString(), BackgroundRecorder::Format_Wav, numChannels,
+							sampleRate, 4.0, snapshotPath, numAtoms, snapshotInterval))
+		{
+			btnRecord.setToggleState(false, juce::dontSendNotification);
+			lblRecording.setText("Could not open " + dir.getFullPathName(), juce::dontSendNotification);
+		}
+	}
+
+	// Write the deadline histograms, with the device and molecule they were measured on, next to the kernel cache;
+	void exportTimings()
+	{
+		nlohmann::json context;
+		context["cpu"] = juce::SystemStats::getCpuModel().toStdString();
+		context["sample_rate"] = engine.getSampleRate();
+		context["block_size"] = engine.getBlockSize();
+		context["internal_rate"] = engine.getInternalSampleRate();
+		context["nodes"] = engine.getNumNodes(0);
+		context["bonds"] = engine.getNumSimulatedBonds();
+
+		auto flTimings = juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory).getChildFile("MolecularSynthesis").getChildFile("deadline.json");
+		flTimings.getParentDirectory().createDirectory();
+		std::ofstream(flTimings.getFullPathName().toStdString()) << engine.getDeadlineMonitor().toJson(context).dump(4);
+		juce::Logger::outputDebugString("Timings written to " + flTimings.getFullPathName());
+	}
+
     void releaseResources() override
     {
         // This gets automatically called when audio device parameters change
-        // or device is restarted.
-        stopTimer();
+        // or device is restarted. The timer keeps running, as it installs
+        // edits and drives the GUI whether or not audio is playing.
     }
 
 
     //==============================================================================
     void paint (Graphics& g) override
     {
+		TRACE_SCOPE("Paint");
         // (Our component is opaque, so we must completely fill the background with a solid colour)
         g.fillAll (getLookAndFeel().findColour (ResizableWindow::backgroundColourId));
 
-        auto nextPos = pos + delta;
-
-        if (nextPos.x < 10 || nextPos.x + 10 > (float) getWidth())
-        {
-            delta.x = -delta.x;
-            nextPos.x = pos.x + delta.x;
-        }
-
-        if (nextPos.y < 50 || nextPos.y + 10 > (float) getHeight())
-        {
-            delta.y = -delta.y;
-            nextPos.y = pos.y + delta.y;
-        }
-
-        if (! dragging)
-        {
-            writeInterpolatedValue (pos, nextPos);
-            pos = nextPos;
-        }
-        else
-        {
-            pos = lastMousePosition;
-        }
-
-        // draw a circle
+		// Only what timerCallback() marked dirty is repainted, and the renderer skips atoms outside it;
+		moleculeRenderer.paint(g);
+
         g.setColour (getLookAndFeel().findColour (Slider::thumbColourId));
-		//for (uint32_t i = 0; i != numAtoms; ++i)
-		//{
-		//	if(i == inputPos)
-		//		g.setColour(Colour(0, 255, 0));
-		//	else if(i == outputPos)
-		//		g.setColour(Colour(255, 0, 0));
-		//	else
-		//		g.setColour(getLookAndFeel().findColour(Slider::thumbColourId));
-
-		//	//g.fillEllipse(pos.x + molecule[i].posX, pos.y + molecule[i].posY + (molecule[i].force[0] * 70), 20.f, 20.f);
-		//	g.fillEllipse(molecule[i].posX, molecule[i].posY + (molecule[i].force[0] * 70), 20.f, 20.f);
-		//}
-
-		//for (uint32_t i = 0; i != numLines; ++i)
-		//{
-		//	g.drawLine(lines[i].pos1[0], lines[i].pos2[0], lines[i].pos1[1], lines[i].pos2[1], 2);
-		//}
-
-        /*g.fillEllipse (pos.x - (30), pos.y + (molecule[0].force[0]*70), 20.f, 20.f);
-		g.fillEllipse(pos.x + (30), pos.y + (molecule[1].force[0] * 70), 20.f, 20.f);
-		g.fillEllipse(pos.x, pos.y - (30) + (molecule[2].force[0] * 70), 20.f, 20.f);
-		g.fillEllipse(pos.x, pos.y - (60) + (molecule[3].force[0] * 70), 20.f, 20.f);
-
-		g.fillEllipse(pos.x - (30), pos.y - (90) + (molecule[4].force[0] * 70), 20.f, 20.f);
-		g.fillEllipse(pos.x + (30), pos.y - (90) + (molecule[5].force[0] * 70), 20.f, 20.f);*/
-
-		//g.fillEllipse(pos.x - (30), pos.y + (molecule[0].force[0] * 70), 20.f*molecule[0].mass, 20.f*molecule[0].mass);
-		//g.fillEllipse(pos.x + (30), pos.y + (molecule[1].force[0] * 70), 20.f*molecule[1].mass, 20.f*molecule[1].mass);
-		//g.fillEllipse(pos.x, pos.y - (30) + (molecule[2].force[0] * 70), 20.f*molecule[2].mass, 20.f*molecule[2].mass);
-		//g.fillEllipse(pos.x, pos.y - (60) + (molecule[3].force[0] * 70), 20.f*molecule[3].mass, 20.f*molecule[3].mass);
-
-		//g.fillEllipse(pos.x - (30), pos.y - (90) + (molecule[4].force[0] * 70), 20.f*molecule[4].mass, 20.f*molecule[4].mass);
-		//g.fillEllipse(pos.x + (30), pos.y - (90) + (molecule[5].force[0] * 70), 20.f*molecule[5].mass, 20.f*molecule[5].mass);
-
-		//g.drawLine(10+pos.x - (30), 10+pos.y + (molecule[1].force[0] * 70), 10+pos.x + (30), 10+pos.y + (molecule[2].force[0] * 70), 2);
-
-		//float centreX = pos.x;
-		//float centreY = pos.y;
-		//for (uint32_t i = 0; i != numAtoms; ++i)
-		//{
-		//	float atomX = centreX;
-		//	float atomY = centreY;
-		//	atomX += 30 * (i % 3);
-		//	if((i / 3)
-		//	atomY += 30 * (i / 3);
-		//	g.fillEllipse(atomX, atomY, 20.f, 20.f);
-		//}
+		drawSnapshot(g, engine.getSnapshotPublisher().getSnapshot(), 20.0f, (float)snapshotStripY, controlsWidth - 30.0f, getHeight() - 10.0f - snapshotStripY);
     }
 
+	void resized() override
+	{
+		moleculeRenderer.setBounds(juce::Rectangle<int>(controlsWidth, 10, getWidth() - controlsWidth - 10, getHeight() - 20));
+		updateScreenPositions();
+		repaint();
+	}
+
+	// Output level as a bar along the top of the area, and each atom's displacement below it, binned to pixel columns
+	// in atom order and scaled to the snapshot's peak. Bins run over the snapshot's values, which sample every
+	// atomStride-th atom;
+	void drawSnapshot(Graphics& g, const MoleculeSnapshot& aSnapshot, float aX, float aY, float aWidth, float aHeight)
+	{
+		if (aWidth < 1.0f || aHeight < 10.0f)
+			return;
+
+		const float levelDb = 20.0f * std::log10(std::max(aSnapshot.rms, 1.0e-6f));
+		g.fillRect(aX, aY, aWidth * jlimit(0.0f, 1.0f, (levelDb + 60.0f) / 60.0f), 4.0f);
+
+		if (aSnapshot.numAtoms == 0 || aSnapshot.peak <= 0.0f)
+			return;
+
+		const float centreY = aY + 6.0f + 0.5f * (aHeight - 6.0f);
+		const float scale = 0.5f * (aHeight - 6.0f) / aSnapshot.peak;
+		const uint32_t numValues = aSnapshot.getNumValues();
+		const int numColumns = std::min((int)aWidth, (int)numValues);
+		for (int x = 0; x != numColumns; ++x)
+		{
+			// The displacement of largest magnitude among the column's atoms;
+			const uint32_t first = (uint32_t)((uint64_t)x * numValues / numColumns);
+			const uint32_t last = (uint32_t)((uint64_t)(x + 1) * numValues / numColumns);
+			float value = 0.0f;
+			for (uint32_t a = first; a != last; ++a)
+				if (std::abs(aSnapshot.displacement[a]) > std::abs(value))
+					value = aSnapshot.displacement[a];
+
+			const float columnX = aX + (x + 0.5f) * aWidth / numColumns;
+			g.drawLine(columnX, centreY, columnX, centreY - value * scale, 1.0f);
+		}
+	}
+
     // Mouse handling..
     void mouseDown (const MouseEvent& e) override
     {
 		if (interactiveState == State_Excite)
 		{
-			lastMousePosition = e.position;
-			mouseDrag(e);
-			dragging = true;
-
-			isExcite = true;
+			engine.setGate(true);
 
-			if (exciteState == State_Impulse)
-				input[0] = 1.0;
+			if (engine.getExcitation() == MoleculeEngine::Excitation_Impulse)
+				engine.strike();
 		}
 		else if (interactiveState == State_Create)
 		{
-			molecule[numAtoms].numConnections = 0;
-			defaultMolecule(molecule[numAtoms]);
-
-			molecule[numAtoms].posX = e.position.x;
-			molecule[numAtoms].posY = e.position.y;
-
-			++numAtoms;
+			const auto model = moleculeRenderer.getModelPosition(e.position, {});
+			modelPositions.push_back({ model.x, model.y, model.z });
+			elements.push_back({ 'C', 0, 0 });
+			atomPicker.add(e.position.x, e.position.y);
+			engine.addAtom();
 		}
 		else if (interactiveState == State_Connect)
 		{
-			Atom* firstClosest = &(molecule[0]);
-			Atom* secondClosest = &(molecule[1]);
-
-			for (uint32_t i = 0; i != numAtoms; ++i)
-			{
-				float distMolecule = sqrt((molecule[i].posX - e.position.x) * (molecule[i].posX - e.position.x) + (molecule[i].posY - e.position.y) * (molecule[i].posY - e.position.y));
-				float distFirstClosest = sqrt((firstClosest->posX - e.position.x) * (firstClosest->posX - e.position.x) + (firstClosest->posY - e.position.y) * (firstClosest->posY - e.position.y));
-				float distSecondClosest = sqrt((secondClosest->posX - e.position.x) * (secondClosest->posX - e.position.x) + (secondClosest->posY - e.position.y) * (secondClosest->posY - e.position.y));
-				if (distMolecule < distFirstClosest)
-				{
-					firstClosest = &(molecule[i]);
-				}
-				else if (distMolecule < distSecondClosest)
-				{
-					secondClosest = &(molecule[i]);
-				}
-			}
-
-			firstClosest->connections[firstClosest->numConnections++] = secondClosest;
-			secondClosest->connections[secondClosest->numConnections++] = firstClosest;
-
-			Line line;
-			line.pos1[0] = firstClosest->posX+10.0;
-			line.pos2[0] = firstClosest->posY + 20.0;
-			line.pos1[1] = secondClosest->posX + 10.0;
-			line.pos2[1] = secondClosest->posY + 20.0;
-			lines[numLines++] = line;
+			uint32_t nearest[2];
+			if (atomPicker.findNearest(e.position.x, e.position.y, nearest, 2) == 2)
+				engine.addBond(nearest[0], nearest[1]);
 		}
 		else if (interactiveState == State_InputPos)
 		{
 			uint32_t idxInputPos;
-			Atom* firstClosest = &(molecule[0]);
-			for (uint32_t i = 0; i != numAtoms; ++i)
-			{
-				float distMolecule = sqrt((molecule[i].posX - e.position.x) * (molecule[i].posX - e.position.x) + (molecule[i].posY - e.position.y) * (molecule[i].posY - e.position.y));
-				float distFirstClosest = sqrt((firstClosest->posX - e.position.x) * (firstClosest->posX - e.position.x) + (firstClosest->posY - e.position.y) * (firstClosest->posY - e.position.y));
-				if (distMolecule < distFirstClosest)
-				{
-					idxInputPos = i;
-					firstClosest = &(molecule[i]);
-				}
-			}
+			if (atomPicker.findNearest(e.position.x, e.position.y, &idxInputPos, 1) == 0)
+				return;
 
 			inputPos = idxInputPos;
+			engine.setDrivenAtoms({ { (uint32_t)inputPos, 1.0f } });
 		}
 		else if (interactiveState == State_OutputPos)
 		{
 			uint32_t idxOutputPos;
-			Atom* firstClosest = &(molecule[0]);
-			for (uint32_t i = 0; i != numAtoms; ++i)
-			{
-				float distMolecule = sqrt((molecule[i].posX - e.position.x) * (molecule[i].posX - e.position.x) + (molecule[i].posY - e.position.y) * (molecule[i].posY - e.position.y));
-				float distFirstClosest = sqrt((firstClosest->posX - e.position.x) * (firstClosest->posX - e.position.x) + (firstClosest->posY - e.position.y) * (firstClosest->posY - e.position.y));
-				if (distMolecule < distFirstClosest)
-				{
-					idxOutputPos = i;
-					firstClosest = &(molecule[i]);
-				}
-			}
+			if (atomPicker.findNearest(e.position.x, e.position.y, &idxOutputPos, 1) == 0)
+				return;
 
 			outputPos = idxOutputPos;
+			engine.setPickupCentres((uint32_t)outputPos, (uint32_t)outputPosRight);
 		}
-    }
-
-    void mouseDrag (const MouseEvent& e) override
-    {
-        dragging = true;
-
-		if (e.position != lastMousePosition)
+		else if (interactiveState == State_Clamp)
 		{
-			// calculate movement vector
-			delta = e.position - lastMousePosition;
-			lastMousePosition = e.position;
+			uint32_t idxClosest;
+			if (atomPicker.findNearest(e.position.x, e.position.y, &idxClosest, 1) != 0)
+				engine.toggleClampedAtom(idxClosest);
 		}
-			
     }
 
     void mouseUp (const MouseEvent&) override
     {
-        dragging = false;
-		isExcite = false;
+		engine.setGate(false);
     }
 
-    void writeInterpolatedValue (Point<float> lastPosition,
-                                 Point<float> currentPosition)
+    void timerCallback() override
     {
-        Point<float> start, finish;
-
-        if (lastPosition.getX() > currentPosition.getX())
-        {
-            finish = lastPosition;
-            start  = currentPosition;
-        }
-        else
-        {
-            start  = lastPosition;
-            finish = currentPosition;
-        }
-
-        for (auto i = 0; i < steps; ++i)
-        {
-            auto p = start + ((finish - start) * i) / (int) steps;
-
-            auto index = (bufferIndex + i) % wavetableSize;
-            waveValues[1][index] = yToAmplitude (p.y);
-            waveValues[0][index] = xToAmplitude (p.x);
-        }
-
-        bufferIndex = (bufferIndex + steps) % wavetableSize;
-    }
+		TRACE_SCOPE("Timer");
 
-    float indexToX (int indexValue) const noexcept
-    {
-        return (float) indexValue;
-    }
+		// Edits are compiled in the background and the simulation switches molecule when one is installed. The
+		// renderer follows every edit on the next tick;
+		engine.update();
 
-    float amplitudeToY (float amp) const noexcept
-    {
-        return (float) getHeight() - (amp + 1.0f) * (float) getHeight() / 2.0f;
-    }
+		const size_t idxCurrentLevel = engine.getDetailLevel();
+		if (const uint32_t numNodes = engine.getNumNodes(idxCurrentLevel))
+			lblDetailLevel.setText("Detail level " + juce::String((int)idxCurrentLevel) + ": " + juce::String((int)numNodes) + " nodes", juce::dontSendNotification);
 
-    float xToAmplitude (float x) const noexcept
-    {
-        return jlimit (-1.0f, 1.0f, 2.0f * ((float) getWidth() - x) / (float) getWidth() - 1.0f);
-    }
+		const DeadlineMonitor& deadlineMonitor = engine.getDeadlineMonitor();
+		auto percent = [&deadlineMonitor](double aPercentile) { return juce::String(100.0 * deadlineMonitor.getPercentile(DeadlineMonitor::Stage_Block, aPercentile), 1) + "%"; };
+		lblDeadline.setText("Block load p50 " + percent(50.0) + ", p99 " + percent(99.0) + ", p99.9 " + percent(99.9) + ", "
+							+ juce::String((juce::int64)deadlineMonitor.getNumOverruns()) + " overruns", juce::dontSendNotification);
 
-    float yToAmplitude (float y) const noexcept
-    {
-        return jlimit (-1.0f, 1.0f, 2.0f * ((float) getHeight() - y) / (float) getHeight() - 1.0f);
-    }
+		if (recorder.isRecording())
+		{
+			juce::String status = juce::String(recorder.getSecondsWritten(), 1) + " s written";
+			if (recorder.getNumDropped() != 0 || recorder.getNumDroppedSnapshots() != 0)
+				status = status + ", " + juce::String((juce::int64)recorder.getNumDropped()) + " samples and "
+						 + juce::String((juce::int64)recorder.getNumDroppedSnapshots()) + " snapshots dropped";
+			if (recorder.hasFailed())
+				status = "Write failed";
+			lblRecording.setText(status, juce::dontSendNotification);
+		}
 
-    void timerCallback() override
-    {
-        repaint();
+		const uint32_t currentEdit = engine.getEditGeneration();
+		if (rendererGeneration != currentEdit)
+		{
+			rendererGeneration = currentEdit;
+			updateRenderer();
+		}
+
+		// Repaint only atoms that moved or changed role, and the strip when a new snapshot has arrived;
+		repaint(moleculeRenderer.setRoles(getAtomRoles()));
+		MoleculeSnapshotPublisher& snapshotPublisher = engine.getSnapshotPublisher();
+		if (snapshotPublisher.update())
+		{
+			repaint(moleculeRenderer.update(snapshotPublisher.getSnapshot()));
+			repaint(0, snapshotStripY, controlsWidth, getHeight() - snapshotStripY);
+		}
     }
 
+	// Atoms in the molecule being edited, which the view and picker show ahead of the simulation;
+	uint32_t getNumAtoms() const { return engine.getTopology().getNumAtoms(); }
+
+	// Hand the renderer the molecule's model coordinates and bonds;
+	void updateRenderer()
+	{
+		const EditableTopology& topology = engine.getTopology();
+		const uint32_t numAtoms = getNumAtoms();
+		std::vector<MoleculeRenderer::RenderAtom> renderAtoms(numAtoms);
+		std::vector<MoleculeRenderer::Bond> bonds;
+		for (uint32_t i = 0; i != numAtoms; ++i)
+		{
+			const auto& position = modelPositions[i];
+			renderAtoms[i] = { position[0], position[1], position[2], MoleculeRenderer::getElementColour(elements[i].data()) };
+			const uint32_t* neighbours = topology.getNeighbours(i);
+			for (uint32_t j = 0; j != topology.getNumNeighbours(i); ++j)
+			{
+				if (i < neighbours[j])
+					bonds.push_back({ i, neighbours[j] });
+			}
+		}
+
+		moleculeRenderer.setMolecule(std::move(renderAtoms), std::move(bonds));
+		updateScreenPositions();
+		repaint(moleculeRenderer.getBounds());
+	}
+
+	// Picking in mouseDown() works on the atoms where they are drawn, so the picker is rebuilt whenever the view changes;
+	void updateScreenPositions()
+	{
+		const uint32_t numAtoms = getNumAtoms();
+		std::vector<float> screenX(numAtoms), screenY(numAtoms);
+		for (uint32_t i = 0; i != numAtoms; ++i)
+		{
+			const Point<float> position = moleculeRenderer.getScreenPosition(i);
+			screenX[i] = position.x;
+			screenY[i] = position.y;
+		}
+		atomPicker.build(screenX, screenY);
+	}
+
+	std::vector<MoleculeRenderer::Role> getAtomRoles() const
+	{
+		const MoleculeBoundary& boundary = engine.getBoundary();
+		const uint32_t numAtoms = getNumAtoms();
+		std::vector<MoleculeRenderer::Role> roles(numAtoms, MoleculeRenderer::Role_Free);
+		for (const auto& pickup : boundary.pickups)
+			for (const auto& p : pickup)
+				if (p.index < numAtoms)
+					roles[p.index] = MoleculeRenderer::Role_Pickup;
+		for (const auto& d : boundary.driven)
+			if (d.index < numAtoms)
+				roles[d.index] = MoleculeRenderer::Role_Driven;
+		for (uint32_t c : boundary.clamped)
+			if (c < numAtoms)
+				roles[c] = MoleculeRenderer::Role_Clamped;
+		return roles;
+	}
+
 private:
     //==============================================================================
-    enum
-    {
-        wavetableSize = 36000,
-        steps = 10
-    };
-
-    Point<float> pos   = { 299.0f, 299.0f };
-    Point<float> delta = { 0.0f, 0.0f };
-    int waveTableIndex = 0;
-    int bufferIndex    = 0;
-    double sampleRate  = 0.0;
-    int expectedSamplesPerBlock = 0;
-    Point<float> lastMousePosition;
-    float waveValues[2][wavetableSize];
-    bool dragging = false;
-
-	bool isReady = false;
-	bool isExcite = false;
-
-	// Sawtooth;
-	uint32_t idxSignal = 0;
-	float sawtooth[SIGNAL_PERIOD*3];
-
-	// Lump-Mass-Spring Vars;
-	double deltaT = 1 / sampleRate;
-	double deltaX = 0.00001;
+	MoleculeEngine engine;
+	static constexpr int maxDeviceChannels = 32;
+
+	// The molecule as shown, by atom: model coordinates in Ångström and element symbol;
+	std::vector<std::array<float, 3>> modelPositions;
+	std::vector<std::array<char, 3>> elements;
+
+	// Driven atom and pickup centres as the sliders and clicks set them;
 	int inputPos = 0;
 	int outputPos = 0;
-	float input[48000];
-	float output[48000];
-
-	const double GRAVITY = 10.000;
-	double kOde = 704000.0;
-	double waveSpeed = 0.015;
-	double genDamp = 0.0001;
-	double damping = 0.0001;
+	int outputPosRight = 0;
 
-	int idxRotationNMOne = 0;
-	int idxRotationN = 1;
-	int idxRotationNPOne = 2;
-	uint32_t numAtoms = 0;
-	Atom molecule[10000];
+	juce::MidiMessageCollector midiCollector;
+	juce::MidiBuffer midiMessages;
 
 	enum Interactive_State
 	{
@@ -812,24 +807,11 @@ private:
 		State_Create,
 		State_Connect,
 		State_InputPos,
-		State_OutputPos
-	};
-
-	enum Excite_State
-	{
-		State_Impulse,
-		State_Sin,
-		State_Saw
-	};
-
-	struct Line
-	{
-		float pos1[2];
-		float pos2[2];
+		State_OutputPos,
+		State_Clamp
 	};
 
 	// Interactions;
-	Excite_State exciteState = State_Impulse;
 	Interactive_State interactiveState = State_Excite;
 	int idRadioButton = 1100;
 	//juce::ToggleButton btnExcite{ "Excite" };
@@ -841,6 +823,11 @@ private:
 	juce::ToggleButton btnImpulse{ "Impulse" };
 	juce::ToggleButton btnSin{ "Sin" };
 	juce::ToggleButton btnSaw{ "Saw" };
+	juce::ToggleButton btnLiveInput{ "Live Input" };
+	juce::ToggleButton btnMidiAtoms{ "MIDI notes select atoms" };
+	juce::ToggleButton btnJit{ "Specialised kernel (JIT)" };
+	juce::ComboBox cmbPrecision;
+	juce::ToggleButton btnClamp{ "Clamp atoms on click" };
 
 	juce::Label  lblInputPos;
 	juce::Slider sldInputPos;
@@ -848,16 +835,48 @@ private:
 	juce::Label  lblOutputPos;
 	juce::Slider sldOutputPos;
 
+	juce::Label  lblOutputPosRight;
+	juce::Slider sldOutputPosRight;
+
+	juce::Label  lblPickupSpread;
+	juce::Slider sldPickupSpread;
+
+	juce::Label  lblInputGain;
+	juce::Slider sldInputGain;
+
+	juce::Label  lblInputFilter;
+	juce::Slider sldInputFilter;
+
 	juce::Label  lblWaveSpeed;
 	juce::Slider sldWaveSpeed;
 
 	juce::Label  lblGenDamping;
 	juce::Slider sldGenDamping;
 
-	uint32_t numLines = 0;
-	Line lines[1000];
-
-	std::ofstream flOutput;
+	juce::Label  lblInternalRate;
+	juce::Slider sldInternalRate;
+
+	juce::Label  lblCpuBudget;
+	juce::Slider sldCpuBudget;
+	juce::Label  lblDetailLevel;
+	juce::Label  lblDeadline;
+	juce::TextButton btnExportTimings{ "Export timings" };
+	juce::TextButton btnResetTimings{ "Reset timings" };
+
+	// Device output, and optionally atom displacements, streamed to disk off the audio thread;
+	static constexpr double snapshotsPerSecond = 100.0;
+
+	// Controls on the left, the molecule on the right and the snapshot strip below the controls;
+	static constexpr int controlsWidth = 600;
+	static constexpr int moleculeViewWidth = 500;
+	static constexpr int snapshotStripY = 490;
+	MoleculeRenderer moleculeRenderer;
+	AtomPicker atomPicker;		// Screen positions of the atoms, message thread only;
+	uint32_t rendererGeneration = UINT32_MAX;		// Message thread only;
+	BackgroundRecorder recorder;
+	juce::TextButton btnRecord{ "Record" };
+	juce::ToggleButton btnRecordSnapshots{ "With atom snapshots" };
+	juce::Label lblRecording;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MolecularSynthesis)
 };
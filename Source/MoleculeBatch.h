@@ -0,0 +1,274 @@
+/*
+  ==============================================================================
+
+    MoleculeBatch.h
+
+    Runs numLanes independent instances of the same molecule in lock-step,
+    for offline rendering and polyphony. State is laid out [node][lane], so
+    each neighbour gather is shared by every lane and the lane loops map onto
+    SIMD registers. Each lane has its own wave speed, damping, driven node and
+    output tap. Injections add a signal to any free node of a lane; the
+    update is linear, so notes sharing a lane cost nothing extra.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "MoleculeTopology.h"
+
+template <typename SampleType, int numLanes>
+class MoleculeBatch
+{
+public:
+	struct LaneParameters
+	{
+		double waveSpeed = 0.015;
+		double genDamp = 0.0001;
+		uint32_t inputNode = 0;
+		uint32_t outputNode = 0;
+	};
+
+	// Added to one node of one lane after every step, on top of the lane's driven input;
+	struct Injection
+	{
+		uint32_t node;
+		int lane;
+		const float* signal;		// One value per step of the process() call;
+	};
+
+	void prepare(const MoleculeTopology& aTopology, double aInternalRate, double aDeltaX)
+	{
+		topology = &aTopology;
+		deltaX = aDeltaX;
+
+		for (auto& d : displacement)
+			d.assign(aTopology.numNodes, LaneBlock {});
+		transferScratch.assign(aTopology.numNodes, LaneBlock {});
+
+		setInternalRate(aInternalRate);
+		reset();
+	}
+
+	// Recomputes each lane's coefficients, leaving its state as it is. Doesn't allocate;
+	void setInternalRate(double aInternalRate)
+	{
+		deltaT = 1.0 / aInternalRate;
+		for (int l = 0; l != numLanes; ++l)
+			setLaneParameters(l, lanes[l]);
+	}
+
+	// Take over every lane of aPrevious, a batch for an earlier topology of the same atoms, moving its state atom by
+	// atom as aPreviousAtomToNode and aAtomToNode map them. Lanes keep their parameters, so the caller remaps any
+	// driven and tapped nodes. Doesn't allocate;
+	void carryOver(const MoleculeBatch& aPrevious, const std::vector<uint32_t>& aPreviousAtomToNode, const std::vector<uint32_t>& aAtomToNode)
+	{
+		reset();
+		const size_t numCarried = std::min(aPreviousAtomToNode.size(), aAtomToNode.size());
+		for (int t = 0; t != 3; ++t)
+		{
+			const std::vector<LaneBlock>& from = aPrevious.displacement[(aPrevious.idxRotationNMOne + t) % 3];
+			std::vector<LaneBlock>& to = displacement[(idxRotationNMOne + t) % 3];
+			for (size_t a = 0; a != numCarried; ++a)
+			{
+				if (aAtomToNode[a] >= topology->numClamped)
+					to[aAtomToNode[a]] = from[aPreviousAtomToNode[a]];
+			}
+		}
+
+		for (int l = 0; l != numLanes; ++l)
+		{
+			setLaneParameters(l, aPrevious.lanes[l]);
+			laneEnergy[l] = aPrevious.laneEnergy[l];
+		}
+	}
+
+	// Move to aCoarse, the next coarser level of the topology playing, with aParent mapping its nodes onto aCoarse's.
+	// Each coarse node takes the mass-weighted mean of its members, as the single-instance state does. Doesn't
+	// allocate;
+	void restrictTo(const MoleculeTopology& aCoarse, const std::vector<uint32_t>& aParent)
+	{
+		for (auto& d : displacement)
+		{
+			std::fill(transferScratch.begin(), transferScratch.begin() + aCoarse.numNodes, LaneBlock {});
+			for (uint32_t i = 0; i != topology->numNodes; ++i)
+			{
+				const SampleType m = (SampleType)topology->mass[i];
+				for (int l = 0; l != numLanes; ++l)
+					transferScratch[aParent[i]].lane[l] += m * d[i].lane[l];
+			}
+			for (uint32_t c = 0; c != aCoarse.numNodes; ++c)
+			{
+				const SampleType m = (SampleType)aCoarse.invMass[c];
+				for (int l = 0; l != numLanes; ++l)
+					d[c].lane[l] = transferScratch[c].lane[l] * m;
+			}
+		}
+		topology = &aCoarse;
+		clearClamped();
+	}
+
+	// Move to aFine, the next finer level, with aParent mapping its nodes onto the topology playing. Each fine node
+	// takes its parent's state. Doesn't allocate, as no level is larger than the one prepared;
+	void prolongTo(const MoleculeTopology& aFine, const std::vector<uint32_t>& aParent)
+	{
+		for (auto& d : displacement)
+		{
+			for (uint32_t i = 0; i != aFine.numNodes; ++i)
+				transferScratch[i] = d[aParent[i]];
+			std::copy(transferScratch.begin(), transferScratch.begin() + aFine.numNodes, d.begin());
+		}
+		topology = &aFine;
+		clearClamped();
+	}
+
+	void reset()
+	{
+		for (auto& d : displacement)
+			std::fill(d.begin(), d.end(), LaneBlock {});
+		std::fill(laneEnergy, laneEnergy + numLanes, (SampleType)0);
+	}
+
+	// Silence one lane, leaving the others ringing;
+	void resetLane(int aLane)
+	{
+		for (auto& d : displacement)
+			for (auto& block : d)
+				block.lane[aLane] = (SampleType)0;
+		laneEnergy[aLane] = (SampleType)0;
+	}
+
+	// Driven and tapped nodes outside the topology are ignored;
+	void setLaneParameters(int aLane, const LaneParameters& aParameters)
+	{
+		lanes[aLane] = aParameters;
+		lapCoeff[aLane] = (SampleType)(aParameters.waveSpeed * aParameters.waveSpeed * (deltaT * deltaT) / (deltaX * deltaX));
+		dampCoeff[aLane] = (SampleType)(2.0 * aParameters.genDamp * deltaT);
+	}
+
+	const LaneParameters& getLaneParameters(int aLane) const { return lanes[aLane]; }
+
+	// Mean square displacement per node of each lane at the end of the last process() call;
+	SampleType getLaneEnergy(int aLane) const { return laneEnergy[aLane]; }
+
+	// aInputs[lane][n] drives each lane's input node, aOutputs[lane][n] receives each lane's tap. Injections into
+	// clamped or driven nodes are ignored, as the boundary overrides them;
+	void process(const float* const* aInputs, float* const* aOutputs, int aNumSamples, const Injection* aInjections = nullptr,
+				 int aNumInjections = 0)
+	{
+		const uint32_t numNodes = topology->numNodes;
+		const uint32_t numClamped = topology->numClamped;
+		const uint32_t* rowStart = topology->rowStart.data();
+		const uint32_t* neighbours = topology->neighbours.data();
+		const float* stiffness = topology->stiffness.data();
+		const float* degree = topology->degree.data();
+		const float* invMass = topology->invMass.data();
+
+		// Local copies keep the lane loops free of aliasing with the state arrays. Energy is measured once per
+		// block rather than accumulated per node, as a reduction inside the sweep defeats vectorisation;
+		LaneBlock lap, damp, energy;
+		for (int l = 0; l != numLanes; ++l)
+		{
+			lap.lane[l] = lapCoeff[l];
+			damp.lane[l] = dampCoeff[l];
+		}
+
+		for (int n = 0; n != aNumSamples; ++n)
+		{
+			const LaneBlock* uN = displacement[idxRotationN].data();
+			const LaneBlock* uNMOne = displacement[idxRotationNMOne].data();
+			LaneBlock* uNPOne = displacement[idxRotationNPOne].data();
+
+			// Clamped nodes are never swept, as in the single-instance kernel;
+			for (uint32_t i = numClamped; i < numNodes; ++i)
+			{
+				LaneBlock tempForce;
+				for (uint32_t e = rowStart[i]; e != rowStart[i + 1]; ++e)
+				{
+					const LaneBlock& uNeighbour = uN[neighbours[e]];
+					const SampleType k = (SampleType)stiffness[e];
+					for (int l = 0; l != numLanes; ++l)
+						tempForce.lane[l] += k * uNeighbour.lane[l];
+				}
+
+				const SampleType d = (SampleType)degree[i];
+				const SampleType m = (SampleType)invMass[i];
+				const LaneBlock& uNi = uN[i];
+				const LaneBlock& uNMOnei = uNMOne[i];
+				LaneBlock& uNPOnei = uNPOne[i];
+				for (int l = 0; l != numLanes; ++l)
+				{
+					const SampleType forceY = lap.lane[l] * m * (tempForce.lane[l] - d * uNi.lane[l])
+						- damp.lane[l] * (uNi.lane[l] - uNMOnei.lane[l])
+						+ 2 * uNi.lane[l] - uNMOnei.lane[l];
+					uNPOnei.lane[l] = forceY;
+				}
+			}
+
+			// Per-lane boundary conditions are applied after the sweep so the lane loops stay branch-free;
+			for (int k = 0; k != aNumInjections; ++k)
+			{
+				const Injection& injection = aInjections[k];
+				if (injection.node >= numClamped && injection.node < numNodes)
+					uNPOne[injection.node].lane[injection.lane] += (SampleType)injection.signal[n];
+			}
+			for (int l = 0; l != numLanes; ++l)
+			{
+				if (lanes[l].inputNode >= numClamped && lanes[l].inputNode < numNodes)
+					uNPOne[lanes[l].inputNode].lane[l] = (SampleType)aInputs[l][n];
+				aOutputs[l][n] = lanes[l].outputNode < numNodes ? (float)uNPOne[lanes[l].outputNode].lane[l] : 0.0f;
+			}
+
+			idxRotationNMOne = (idxRotationNMOne + 1) % 3;
+			idxRotationN = (idxRotationN + 1) % 3;
+			idxRotationNPOne = (idxRotationNPOne + 1) % 3;
+		}
+
+		const LaneBlock* uN = displacement[idxRotationN].data();
+		for (uint32_t i = 0; i < numNodes; ++i)
+			for (int l = 0; l != numLanes; ++l)
+				energy.lane[l] += uN[i].lane[l] * uN[i].lane[l];
+		for (int l = 0; l != numLanes; ++l)
+			laneEnergy[l] = energy.lane[l] / (SampleType)std::max(1u, numNodes);
+	}
+
+	// Current displacement of aNode in aLane;
+	SampleType getDisplacement(uint32_t aNode, int aLane) const
+	{
+		return displacement[idxRotationN][aNode].lane[aLane];
+	}
+
+	static constexpr int getNumLanes() { return numLanes; }
+
+private:
+	// One node's state across all lanes, aligned so each block loads as whole vectors;
+	struct alignas(sizeof(SampleType) * numLanes) LaneBlock
+	{
+		SampleType lane[numLanes] = {};
+	};
+
+	void clearClamped()
+	{
+		for (auto& d : displacement)
+			std::fill(d.begin(), d.begin() + std::min((size_t)topology->numClamped, d.size()), LaneBlock {});
+	}
+
+	const MoleculeTopology* topology = nullptr;
+	double deltaT = 1.0 / 44100.0;
+	double deltaX = 0.00001;
+
+	LaneParameters lanes[numLanes];
+	SampleType lapCoeff[numLanes] = {};
+	SampleType dampCoeff[numLanes] = {};
+	SampleType laneEnergy[numLanes] = {};
+
+	std::vector<LaneBlock> displacement[3];
+	std::vector<LaneBlock> transferScratch;		// For moving between levels;
+	int idxRotationNMOne = 0;
+	int idxRotationN = 1;
+	int idxRotationNPOne = 2;
+};
@@ -0,0 +1,137 @@
+/*
+  ==============================================================================
+
+    MoleculeBoundary.h
+
+    Atoms with a fixed role in the simulation. Clamped atoms are numbered
+    first when the topology is built (see MoleculeTopology::numClamped), so
+    the bulk sweep simply starts after them. Driven atoms and pickups are
+    short weighted node lists applied once per step after the sweep, while
+    the new level is still in cache, so no kernel tests a node's role
+    inside its loop and a pickup costs a few loads rather than a sweep.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "MoleculeTopology.h"
+
+// An atom or node and how strongly it couples to a signal;
+struct WeightedIndex
+{
+	uint32_t index;
+	float weight;
+};
+
+// Roles by loaded atom index;
+struct MoleculeBoundary
+{
+	std::vector<WeightedIndex> driven;					// Set to weight * excitation every step;
+	std::vector<uint32_t> clamped;						// Held at rest and never updated;
+	std::vector<std::vector<WeightedIndex>> pickups;	// Per output channel, summed weighted displacements;
+};
+
+// Nodes within three standard deviations of aCentre, counting distance in bonds, with Gaussian weights that sum to
+// one. aSigma of zero picks aCentre alone;
+inline std::vector<WeightedIndex> makeGaussianRegion(const MoleculeTopology& aTopology, uint32_t aCentre, float aSigma)
+{
+	std::vector<WeightedIndex> region;
+	if (aCentre >= aTopology.numNodes)
+		return region;
+
+	// Breadth first out to the cut-off, noting each node's distance;
+	const uint32_t maxHops = (uint32_t)(3.0f * std::max(0.0f, aSigma));
+	std::vector<uint32_t> hops(aTopology.numNodes, UINT32_MAX);
+	std::vector<uint32_t> queue(1, aCentre);
+	hops[aCentre] = 0;
+	for (size_t head = 0; head != queue.size(); ++head)
+	{
+		const uint32_t i = queue[head];
+		if (hops[i] == maxHops)
+			continue;
+		for (uint32_t e = aTopology.rowStart[i]; e != aTopology.rowStart[i + 1]; ++e)
+		{
+			const uint32_t j = aTopology.neighbours[e];
+			if (hops[j] == UINT32_MAX)
+			{
+				hops[j] = hops[i] + 1;
+				queue.push_back(j);
+			}
+		}
+	}
+
+	float sum = 0.0f;
+	for (uint32_t i : queue)
+	{
+		const float h = (float)hops[i];
+		const float weight = aSigma > 0.0f ? std::exp(-0.5f * h * h / (aSigma * aSigma)) : 1.0f;
+		region.push_back({ i, weight });
+		sum += weight;
+	}
+	for (auto& r : region)
+		r.weight /= sum;
+	return region;
+}
+
+// The driven atoms and pickups of a MoleculeBoundary as nodes of one level;
+struct BoundaryNodes
+{
+	std::vector<WeightedIndex> driven;
+	std::vector<std::vector<WeightedIndex>> pickups;
+	uint32_t numChannels = 0;
+
+	// Makes assign() allocation-free for lists up to aBoundary's size;
+	void reserve(const MoleculeBoundary& aBoundary)
+	{
+		driven.reserve(aBoundary.driven.size());
+		if (pickups.size() < aBoundary.pickups.size())
+			pickups.resize(aBoundary.pickups.size());
+		for (size_t c = 0; c != aBoundary.pickups.size(); ++c)
+			pickups[c].reserve(aBoundary.pickups[c].size());
+	}
+
+	// Map aBoundary through aAtomToNode. Atoms that don't exist are dropped, and so are driven atoms on clamped nodes,
+	// as clamping wins. Atoms sharing a coarse node add their pickup weights;
+	void assign(const MoleculeBoundary& aBoundary, const std::vector<uint32_t>& aAtomToNode, uint32_t aNumClamped, uint32_t aNumNodes)
+	{
+		driven.clear();
+		for (const auto& d : aBoundary.driven)
+		{
+			if (d.index < aAtomToNode.size() && aAtomToNode[d.index] >= aNumClamped && aAtomToNode[d.index] < aNumNodes)
+				driven.push_back({ aAtomToNode[d.index], d.weight });
+		}
+
+		numChannels = (uint32_t)std::min(pickups.size(), aBoundary.pickups.size());
+		for (uint32_t c = 0; c != numChannels; ++c)
+		{
+			pickups[c].clear();
+			for (const auto& p : aBoundary.pickups[c])
+			{
+				if (p.index < aAtomToNode.size() && aAtomToNode[p.index] < aNumNodes)
+					pickups[c].push_back({ aAtomToNode[p.index], p.weight });
+			}
+		}
+	}
+
+	// Drive aUNPOne, a just-swept time level, with aInput and write each channel's pickup to aOutputs[channel][aIdx];
+	template <typename SampleType>
+	void apply(SampleType* aUNPOne, float aInput, float* const* aOutputs, int aIdx) const
+	{
+		for (const auto& d : driven)
+			aUNPOne[d.index] = (SampleType)(d.weight * aInput);
+
+		for (uint32_t c = 0; c != numChannels; ++c)
+		{
+			float sum = 0.0f;
+			for (const auto& p : pickups[c])
+				sum += p.weight * (float)aUNPOne[p.index];
+			aOutputs[c][aIdx] = sum;
+		}
+	}
+};
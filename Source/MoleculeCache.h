@@ -0,0 +1,122 @@
+/*
+  ==============================================================================
+
+    MoleculeCache.h
+
+    Molecules shared by every engine in the process, so plugin instances
+    playing the same molecule read and compile it once. Parsed files are
+    kept by key, typically their path, and compiled topologies by that key
+    and the atoms clamped. Both are immutable once built and handed out as
+    shared pointers; the cache itself only holds weak references, so each
+    is freed with the last engine using it. A compile also carries the
+    kernel layout KernelTuner picked for it, so only the first engine to
+    play it tunes. Engines keep their displacement and scratch buffers to
+    themselves.
+
+    Reads and compiles happen under the cache's lock on the caller's
+    thread, so instances created together wait for the first to finish
+    rather than each building their own copy.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "MoleculeEditor.h"
+#include "MoleculeLoader.h"
+
+class MoleculeCache
+{
+public:
+	// Fills a LoadedMolecule, returning false if it couldn't;
+	using Reader = std::function<bool(LoadedMolecule&)>;
+
+	static MoleculeCache& getInstance()
+	{
+		static MoleculeCache cache;
+		return cache;
+	}
+
+	// The molecule known as aKey, read with aRead unless some engine still holds it. nullptr if aRead fails;
+	std::shared_ptr<const LoadedMolecule> acquireSource(const std::string& aKey, const Reader& aRead)
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		removeExpired();
+		if (auto cached = sources[aKey].lock())
+		{
+			++numHits;
+			return cached;
+		}
+
+		auto loaded = std::make_shared<LoadedMolecule>();
+		if (!aRead(*loaded))
+		{
+			sources.erase(aKey);
+			return nullptr;
+		}
+
+		++numReads;
+		sources[aKey] = loaded;
+		return loaded;
+	}
+
+	// aBonds, the molecule known as aKey, compiled with aClamped held at rest unless some engine still holds that
+	// compile. Use CompiledMolecule::instantiate() for state buffers of one's own;
+	std::shared_ptr<const CompiledMolecule> acquireCompiled(const std::string& aKey, const EditableTopology& aBonds, const std::vector<uint32_t>& aClamped,
+															const TopologyCompiler::Settings& aSettings)
+	{
+		std::string compiledKey = aKey + "|clamped";
+		for (uint32_t c : aClamped)
+			compiledKey += " " + std::to_string(c);
+		compiledKey += "|" + std::to_string(aSettings.maxLevels) + " " + std::to_string(aSettings.minCoarseNodes) + " " + std::to_string(aSettings.tilingCacheBytes);
+
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		removeExpired();
+		if (auto cached = compiled[compiledKey].lock())
+		{
+			++numHits;
+			return cached;
+		}
+
+		// The zeroed state compile() allocates belongs to no engine, so the shared copy drops it;
+		std::shared_ptr<CompiledMolecule> molecule = TopologyCompiler::compile(aBonds, aClamped, aSettings);
+		for (auto& d : molecule->displacement)
+			std::vector<double>().swap(d);
+		std::vector<double>().swap(molecule->transferScratch);
+
+		++numCompiles;
+		compiled[compiledKey] = molecule;
+		return molecule;
+	}
+
+	// Counts since the process started, for checking that instances share;
+	size_t getNumReads() const { std::lock_guard<std::mutex> lock(cacheMutex); return numReads; }
+	size_t getNumCompiles() const { std::lock_guard<std::mutex> lock(cacheMutex); return numCompiles; }
+	size_t getNumHits() const { std::lock_guard<std::mutex> lock(cacheMutex); return numHits; }
+
+private:
+	MoleculeCache() = default;
+
+	// Entries whose last engine has gone. Call with cacheMutex held;
+	void removeExpired()
+	{
+		for (auto s = sources.begin(); s != sources.end();)
+			s = s->second.expired() ? sources.erase(s) : std::next(s);
+		for (auto c = compiled.begin(); c != compiled.end();)
+			c = c->second.expired() ? compiled.erase(c) : std::next(c);
+	}
+
+	mutable std::mutex cacheMutex;
+	std::map<std::string, std::weak_ptr<const LoadedMolecule>> sources;
+	std::map<std::string, std::weak_ptr<const CompiledMolecule>> compiled;
+	size_t numReads = 0;
+	size_t numCompiles = 0;
+	size_t numHits = 0;
+};
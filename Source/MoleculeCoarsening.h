@@ -0,0 +1,163 @@
+/*
+  ==============================================================================
+
+    MoleculeCoarsening.h
+
+    Heavy-edge matching for level-of-detail molecules. Each pass pairs every
+    node with its most strongly bonded unmatched neighbour. Paired nodes merge
+    into one node whose mass is the sum of both. Bonds between merged nodes
+    are summed and then softened as springs in series, so low modes keep
+    roughly the same frequency.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "MoleculeTopology.h"
+
+// One level of the hierarchy. Level 0 is the loaded molecule;
+struct MoleculeLevel
+{
+	MoleculeTopology topology;
+	std::vector<uint32_t> parent;		// Node -> node on the next coarser level, empty on the coarsest;
+	std::vector<uint32_t> atomToNode;	// Loaded atom -> node on this level;
+};
+
+// Coarsen aFine by one heavy-edge matching pass. aParent receives the coarse node of every fine node.
+// Clamped nodes are never merged, and coarse nodes are numbered in order of their first fine member, so the clamped
+// nodes stay clamped and first on the coarse level;
+inline MoleculeTopology coarsenTopology(const MoleculeTopology& aFine, std::vector<uint32_t>& aParent)
+{
+	const uint32_t numFine = aFine.numNodes;
+	const uint32_t unmatched = UINT32_MAX;
+
+	// Visit low-degree nodes first so they are not left stranded as singletons;
+	std::vector<uint32_t> order(numFine);
+	std::iota(order.begin(), order.end(), 0u);
+	std::stable_sort(order.begin(), order.end(), [&aFine](uint32_t a, uint32_t b)
+	{
+		return (aFine.rowStart[a + 1] - aFine.rowStart[a]) < (aFine.rowStart[b + 1] - aFine.rowStart[b]);
+	});
+
+	std::vector<uint32_t> match(numFine, unmatched);
+	const uint32_t numClamped = std::min(aFine.numClamped, numFine);
+	for (uint32_t i = 0; i != numClamped; ++i)
+		match[i] = i;
+
+	for (uint32_t idxOrder = 0; idxOrder != numFine; ++idxOrder)
+	{
+		const uint32_t i = order[idxOrder];
+		if (match[i] != unmatched)
+			continue;
+
+		uint32_t best = i;
+		float bestStiffness = 0.0f;
+		for (uint32_t e = aFine.rowStart[i]; e != aFine.rowStart[i + 1]; ++e)
+		{
+			const uint32_t j = aFine.neighbours[e];
+			if (j != i && j >= numClamped && match[j] == unmatched && aFine.stiffness[e] > bestStiffness)
+			{
+				best = j;
+				bestStiffness = aFine.stiffness[e];
+			}
+		}
+
+		match[i] = best;
+		match[best] = i;
+	}
+
+	// Number aggregates by first member;
+	aParent.assign(numFine, unmatched);
+	std::vector<uint32_t> numMembers;
+	uint32_t numCoarse = 0;
+	for (uint32_t i = 0; i != numFine; ++i)
+	{
+		if (aParent[i] != unmatched)
+			continue;
+		aParent[i] = numCoarse;
+		aParent[match[i]] = numCoarse;
+		numMembers.push_back(match[i] == i ? 1 : 2);
+		++numCoarse;
+	}
+
+	MoleculeTopology coarse;
+	coarse.numNodes = numCoarse;
+	coarse.numClamped = numClamped;
+	coarse.mass.assign(numCoarse, 0.0f);
+	for (uint32_t i = 0; i != numFine; ++i)
+		coarse.mass[aParent[i]] += aFine.mass[i];
+
+	// Gather each aggregate's fine rows, then merge duplicate coarse bonds;
+	std::vector<std::vector<uint32_t>> members(numCoarse);
+	for (uint32_t i = 0; i != numFine; ++i)
+		members[aParent[i]].push_back(i);
+
+	coarse.rowStart.assign(1, 0);
+	std::vector<std::pair<uint32_t, float>> row;
+	for (uint32_t c = 0; c != numCoarse; ++c)
+	{
+		row.clear();
+		for (uint32_t i : members[c])
+		{
+			for (uint32_t e = aFine.rowStart[i]; e != aFine.rowStart[i + 1]; ++e)
+			{
+				const uint32_t d = aParent[aFine.neighbours[e]];
+				if (d != c)
+					row.emplace_back(d, aFine.stiffness[e]);
+			}
+		}
+
+		std::sort(row.begin(), row.end(), [](const std::pair<uint32_t, float>& a, const std::pair<uint32_t, float>& b) { return a.first < b.first; });
+
+		for (size_t k = 0; k != row.size(); ++k)
+		{
+			if (k > 0 && row[k].first == row[k - 1].first)
+			{
+				coarse.stiffness.back() += row[k].second;
+				continue;
+			}
+			coarse.neighbours.push_back(row[k].first);
+			coarse.stiffness.push_back(row[k].second);
+		}
+
+		// Springs in series: a bond between aggregates of nA and nB nodes now spans (nA + nB) / 2 fine bonds;
+		for (uint32_t e = coarse.rowStart[c]; e != (uint32_t)coarse.neighbours.size(); ++e)
+			coarse.stiffness[e] *= 2.0f / (float)(numMembers[c] + numMembers[coarse.neighbours[e]]);
+
+		coarse.rowStart.push_back((uint32_t)coarse.neighbours.size());
+	}
+
+	coarse.finalise();
+	return coarse;
+}
+
+// Build levels 1.. from aLevels[0] until a pass stops reducing the molecule meaningfully;
+inline void buildMoleculeHierarchy(std::vector<MoleculeLevel>& aLevels, size_t aMaxLevels, uint32_t aMinNodes)
+{
+	aLevels.resize(1);
+	while (aLevels.size() < aMaxLevels && aLevels.back().topology.numNodes > aMinNodes)
+	{
+		MoleculeLevel& fine = aLevels.back();
+
+		std::vector<uint32_t> parent;
+		MoleculeTopology coarse = coarsenTopology(fine.topology, parent);
+		if (coarse.numNodes * 10 > fine.topology.numNodes * 9)
+			break;
+
+		MoleculeLevel level;
+		level.topology = std::move(coarse);
+		level.atomToNode.resize(fine.atomToNode.size());
+		for (size_t a = 0; a != fine.atomToNode.size(); ++a)
+			level.atomToNode[a] = parent[fine.atomToNode[a]];
+
+		fine.parent = std::move(parent);
+		aLevels.push_back(std::move(level));
+	}
+	aLevels.back().parent.clear();
+}
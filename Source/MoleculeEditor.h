@@ -0,0 +1,334 @@
+/*
+  ==============================================================================
+
+    MoleculeEditor.h
+
+    Interactive edits to the molecule's structure, kept off the audio path.
+    EditableTopology holds the bonds in CSR with spare capacity in every
+    row, so adding an atom or a bond is amortised O(1): a row that fills
+    up moves to the end of the array with twice the room, and the gaps it
+    leaves are squeezed out once they outnumber the room rows still use.
+
+    TopologyCompiler turns a copy of it into everything the simulation
+    derives from the structure: the compact CSR with degrees and inverse
+    masses, the clamped-first bandwidth-reducing order, the coarsened
+    levels, the tiler and zeroed state buffers. A worker thread does this,
+    and only the newest edit is compiled when several queue up. The engine
+    sends the result to the audio thread through a RealtimeHandoff, which
+    swaps it in at the start of a block without waiting on a lock, carries
+    displacement over by atom and gives the replaced molecule back to be
+    freed on the control thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MoleculeCoarsening.h"
+#include "MoleculeOrdering.h"
+#include "MoleculeTopology.h"
+#include "StencilKernels.h"
+#include "TemporalTiler.h"
+#include "TraceRecorder.h"
+
+class EditableTopology
+{
+public:
+	static constexpr uint32_t initialCapacity = 4;		// Per row; a carbon has at most four bonds;
+
+	void clear()
+	{
+		rowStart.clear();
+		rowLength.clear();
+		rowCapacity.clear();
+		neighbours.clear();
+		numEntries = 0;
+		numAllocated = 0;
+	}
+
+	uint32_t getNumAtoms() const { return (uint32_t)rowStart.size(); }
+
+	// Directed entries, as MoleculeTopology::getNumBonds() counts them;
+	size_t getNumBonds() const { return numEntries; }
+
+	// Returns the new atom's index;
+	uint32_t addAtom()
+	{
+		rowStart.push_back((uint32_t)neighbours.size());
+		rowLength.push_back(0);
+		rowCapacity.push_back(initialCapacity);
+		neighbours.resize(neighbours.size() + initialCapacity);
+		numAllocated += initialCapacity;
+		return getNumAtoms() - 1;
+	}
+
+	// One directed entry, exactly as given, for loading files whose bond lists needn't be symmetric;
+	void appendNeighbour(uint32_t aAtom, uint32_t aNeighbour)
+	{
+		if (aAtom >= getNumAtoms() || aNeighbour >= getNumAtoms())
+			return;
+
+		if (rowLength[aAtom] == rowCapacity[aAtom])
+			growRow(aAtom);
+		neighbours[rowStart[aAtom] + rowLength[aAtom]++] = aNeighbour;
+		++numEntries;
+	}
+
+	// Bond aFirst and aSecond both ways. Returns false, changing nothing, if they are the same atom, out of range or
+	// already bonded;
+	bool addBond(uint32_t aFirst, uint32_t aSecond)
+	{
+		if (aFirst == aSecond || aFirst >= getNumAtoms() || aSecond >= getNumAtoms() || hasBond(aFirst, aSecond))
+			return false;
+
+		appendNeighbour(aFirst, aSecond);
+		appendNeighbour(aSecond, aFirst);
+		return true;
+	}
+
+	uint32_t getNumNeighbours(uint32_t aAtom) const { return rowLength[aAtom]; }
+
+	// Valid until the next edit;
+	const uint32_t* getNeighbours(uint32_t aAtom) const { return neighbours.data() + rowStart[aAtom]; }
+
+	bool hasBond(uint32_t aFirst, uint32_t aSecond) const
+	{
+		const auto first = neighbours.begin() + rowStart[aFirst];
+		return std::find(first, first + rowLength[aFirst], aSecond) != first + rowLength[aFirst];
+	}
+
+	// Compact CSR with unit masses and stiffnesses, finalised, with no atom clamped yet;
+	void toTopology(MoleculeTopology& aTopology) const
+	{
+		const uint32_t numAtoms = getNumAtoms();
+		aTopology.clear();
+		aTopology.numNodes = numAtoms;
+		aTopology.numClamped = 0;
+		aTopology.rowStart.resize(numAtoms + 1);
+		aTopology.neighbours.resize(numEntries);
+		aTopology.stiffness.assign(numEntries, 1.0f);
+		aTopology.mass.assign(numAtoms, 1.0f);		// The kernel has always treated atoms as unit masses;
+
+		uint32_t e = 0;
+		for (uint32_t i = 0; i != numAtoms; ++i)
+		{
+			aTopology.rowStart[i] = e;
+			std::copy(neighbours.begin() + rowStart[i], neighbours.begin() + rowStart[i] + rowLength[i], aTopology.neighbours.begin() + e);
+			e += rowLength[i];
+		}
+		aTopology.rowStart[numAtoms] = e;
+		aTopology.finalise();
+	}
+
+private:
+	// Move aAtom's row to the end with double the room. Once gaps outnumber entries every row is repacked in
+	// place with its capacity kept, which costs no more than the moves that made the gaps;
+	void growRow(uint32_t aAtom)
+	{
+		const uint32_t newCapacity = std::max(initialCapacity, 2 * rowCapacity[aAtom]);
+		const uint32_t newStart = (uint32_t)neighbours.size();
+		neighbours.resize(neighbours.size() + newCapacity);
+		std::copy(neighbours.begin() + rowStart[aAtom], neighbours.begin() + rowStart[aAtom] + rowLength[aAtom], neighbours.begin() + newStart);
+		numAllocated += newCapacity - rowCapacity[aAtom];
+		rowStart[aAtom] = newStart;
+		rowCapacity[aAtom] = newCapacity;
+
+		if (neighbours.size() - numAllocated > numAllocated)
+			repack();
+	}
+
+	void repack()
+	{
+		std::vector<uint32_t> packed;
+		packed.reserve(numAllocated);
+		for (uint32_t i = 0; i != getNumAtoms(); ++i)
+		{
+			const uint32_t start = (uint32_t)packed.size();
+			packed.insert(packed.end(), neighbours.begin() + rowStart[i], neighbours.begin() + rowStart[i] + rowLength[i]);
+			packed.resize(start + rowCapacity[i]);
+			rowStart[i] = start;
+		}
+		neighbours.swap(packed);
+	}
+
+	std::vector<uint32_t> rowStart;		// Offsets into neighbours, in no particular order once rows have grown;
+	std::vector<uint32_t> rowLength;
+	std::vector<uint32_t> rowCapacity;
+	std::vector<uint32_t> neighbours;
+	size_t numEntries = 0;
+	size_t numAllocated = 0;			// Sum of rowCapacity; the rest of neighbours is gaps;
+};
+
+// Everything the simulation derives from one edit of the molecule, ready to be swapped in. The levels and the
+// tiler's tables are immutable and may be shared with other engines, as is the kernel choice once tuned; the state
+// buffers are this one's own;
+struct CompiledMolecule
+{
+	std::shared_ptr<const std::vector<MoleculeLevel>> levels;	// (*levels)[0] is the loaded molecule, clamped atoms first;
+	std::vector<double> displacement[3];	// Zeroed, one value per node of level 0;
+	std::vector<double> transferScratch;
+	TemporalTiler temporalTiler;
+	bool isTilingWorthwhile = false;		// Big enough for KernelTuner to time temporalTiler;
+	std::shared_ptr<KernelChoice> kernelChoice;		// For level 0;
+	uint32_t editGeneration = 0;			// Of the edit it was compiled from;
+
+	// Another instance of the same molecule, sharing the immutable parts and with its own zeroed state;
+	std::unique_ptr<CompiledMolecule> instantiate() const
+	{
+		const uint32_t numNodes = (*levels)[0].topology.numNodes;
+		auto instance = std::make_unique<CompiledMolecule>();
+		instance->levels = levels;
+		for (auto& d : instance->displacement)
+			d.assign(numNodes, 0.0);
+		instance->transferScratch.assign(numNodes, 0.0);
+		instance->temporalTiler = temporalTiler;
+		instance->isTilingWorthwhile = isTilingWorthwhile;
+		instance->kernelChoice = kernelChoice;
+		instance->editGeneration = editGeneration;
+		return instance;
+	}
+};
+
+class TopologyCompiler
+{
+public:
+	struct Settings
+	{
+		size_t maxLevels = 1;
+		uint32_t minCoarseNodes = 8;
+		size_t tilingCacheBytes = 0;
+	};
+
+	// The worker starts with the first compileAsync(), so engines that are never edited don't keep a thread;
+	explicit TopologyCompiler(const Settings& aSettings) : settings(aSettings) {}
+
+	~TopologyCompiler()
+	{
+		if (!worker.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			shouldExit = true;
+		}
+		jobReady.notify_one();
+		worker.join();
+	}
+
+	// Builds aEdit with the atoms in aClamped held at rest on the calling thread. Clamped indices out of range or
+	// repeated are ignored;
+	static std::unique_ptr<CompiledMolecule> compile(const EditableTopology& aEdit, const std::vector<uint32_t>& aClamped, const Settings& aSettings)
+	{
+		TRACE_SCOPE("Compile topology");
+		auto compiled = std::make_unique<CompiledMolecule>();
+		MoleculeTopology topology;
+		aEdit.toTopology(topology);
+
+		// Clamped atoms are numbered first so every kernel starts its sweep after them. The rest follow in a
+		// bandwidth-reduced order that keeps bonded atoms close in memory, which temporal tiling relies on;
+		std::vector<uint32_t> clampedAtoms;
+		for (uint32_t a : aClamped)
+		{
+			if (a < topology.numNodes && std::find(clampedAtoms.begin(), clampedAtoms.end(), a) == clampedAtoms.end())
+				clampedAtoms.push_back(a);
+		}
+		topology.numClamped = (uint32_t)clampedAtoms.size();
+
+		auto levels = std::make_shared<std::vector<MoleculeLevel>>(1);
+		MoleculeLevel& level = (*levels)[0];
+		level.atomToNode = cuthillMcKeeOrder(topology, clampedAtoms);
+		level.topology = permuteTopology(topology, level.atomToNode);
+		buildMoleculeHierarchy(*levels, aSettings.maxLevels, aSettings.minCoarseNodes);
+
+		const MoleculeTopology& loadedTopology = (*levels)[0].topology;
+		for (auto& d : compiled->displacement)
+			d.assign(loadedTopology.numNodes, 0.0);
+		compiled->transferScratch.assign(loadedTopology.numNodes, 0.0);
+		compiled->isTilingWorthwhile = compiled->temporalTiler.prepare(loadedTopology, aSettings.tilingCacheBytes);
+		compiled->kernelChoice = std::make_shared<KernelChoice>();
+		compiled->levels = std::move(levels);
+		return compiled;
+	}
+
+	// Queue a copy of aEdit, replacing any pending job. The worker compiles one job at a time, so callers can skip
+	// submitting while isBusy() and send only their latest edit once it is done;
+	void compileAsync(const EditableTopology& aEdit, const std::vector<uint32_t>& aClamped, uint32_t aEditGeneration)
+	{
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			pendingEdit = aEdit;
+			pendingClamped = aClamped;
+			pendingGeneration = aEditGeneration;
+			hasPendingJob = true;
+			isCompiling = true;
+		}
+		jobReady.notify_one();
+		if (!worker.joinable())
+			worker = std::thread([this] { run(); });
+	}
+
+	// True from compileAsync() until its result can be taken;
+	bool isBusy() const
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		return isCompiling;
+	}
+
+	// The newest finished compile, or nullptr. Each result is handed out once;
+	std::unique_ptr<CompiledMolecule> takeCompiled()
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		return std::move(finished);
+	}
+
+private:
+	void run()
+	{
+		TRACE_THREAD("Topology compiler");
+		for (;;)
+		{
+			EditableTopology edit;
+			std::vector<uint32_t> clamped;
+			uint32_t editGeneration = 0;
+			{
+				std::unique_lock<std::mutex> lock(jobMutex);
+				jobReady.wait(lock, [this] { return shouldExit || hasPendingJob; });
+				if (shouldExit)
+					return;
+				edit = std::move(pendingEdit);
+				clamped = std::move(pendingClamped);
+				editGeneration = pendingGeneration;
+				hasPendingJob = false;
+			}
+
+			std::unique_ptr<CompiledMolecule> compiled = compile(edit, clamped, settings);
+			compiled->editGeneration = editGeneration;
+
+			// A result nobody took yet is superseded, and freed here rather than by whoever takes the next;
+			std::unique_ptr<CompiledMolecule> superseded;
+			std::lock_guard<std::mutex> lock(jobMutex);
+			superseded = std::move(finished);
+			finished = std::move(compiled);
+			isCompiling = hasPendingJob;
+		}
+	}
+
+	const Settings settings;
+	std::thread worker;
+	mutable std::mutex jobMutex;
+	std::condition_variable jobReady;
+	bool shouldExit = false;
+	bool hasPendingJob = false;
+	bool isCompiling = false;
+	EditableTopology pendingEdit;
+	std::vector<uint32_t> pendingClamped;
+	uint32_t pendingGeneration = 0;
+	std::unique_ptr<CompiledMolecule> finished;
+};
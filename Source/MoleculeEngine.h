@@ -0,0 +1,1331 @@
+/*
+  ==============================================================================
+
+    MoleculeEngine.h
+
+    The synthesiser without its GUI: the molecule, its excitation, the
+    simulation with its level-of-detail hierarchy, the pickups and the
+    MIDI voices, behind a small API. Nothing here depends on JUCE, so the
+    app, headless renders, benchmarks and plugins all run the same engine.
+    CMakeLists.txt builds it alone as the molsynth_engine target, with
+    HeadlessRender.cpp as its test.
+
+        MoleculeEngine engine;
+        engine.load("graphene_with_bonds.pdb");
+        engine.prepare(48000.0, 512);
+        engine.setParam(MoleculeEngine::Param_WaveSpeed, 0.015 * 0.015);
+        engine.setGate(true);
+        engine.process(channels, 2, 512);
+
+    Threads. load(), edits, update() and the set...Atoms() and pickup
+    calls belong to one control thread, the message thread in the app.
+    prepare(), queueNote() and process() belong to the audio thread.
+    setParam(), setExcitation(), setGate() and strike() can be called from
+    anywhere. Edits are compiled in the background and only take effect
+    when update() installs them, so the control thread should call it
+    regularly. Installing builds everything the new molecule needs on the
+    control thread and hands it over whole (RealtimeHandoff.h), so the
+    audio thread never waits, allocates or goes silent for a load or an
+    edit; it takes the molecule over at the start of its next block. The
+    background threads start on first use, and snapshot frames are only
+    allocated once a visualiser attaches, so idle instances stay small.
+
+    Molecules read from files come from MoleculeCache, so engines playing
+    the same one share the parsed file and the compiled levels, and own
+    only their state buffers. The first structural edit gives an engine a
+    private copy to compile.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BackgroundRecorder.h"
+#include "DeadlineMonitor.h"
+#include "KernelTuner.h"
+#include "LiveExcitation.h"
+#include "MoleculeBoundary.h"
+#include "MoleculeCache.h"
+#include "MoleculeCoarsening.h"
+#include "MoleculeEditor.h"
+#include "MoleculeLoader.h"
+#include "MoleculeSnapshot.h"
+#include "MoleculeVoices.h"
+#include "PolyphaseResampler.h"
+#include "RealtimeHandoff.h"
+#include "ReducedPrecisionSweep.h"
+#include "StencilJit.h"
+#include "TemporalTiler.h"
+#include "TraceRecorder.h"
+
+class MoleculeEngine
+{
+public:
+	static constexpr int maxOutputChannels = 8;
+	static constexpr uint32_t noPickup = UINT32_MAX;		// A channel without a pickup, which plays silence;
+	static constexpr int numVoiceLanes = 8;
+	static constexpr double minInternalRate = 8000.0;
+	static constexpr double maxInternalRate = 192000.0;
+	static constexpr uint32_t minSnapshotAtoms = 65536;		// Frames hold at least this many atoms' displacements;
+
+	// Continuous parameters, each safe to set from any thread;
+	enum Param
+	{
+		Param_WaveSpeed,		// Squared wave speed, as the sliders have always fed it;
+		Param_Damping,			// Squared generalised damping;
+		Param_InternalRate,		// Simulation rate in Hz, clamped to [minInternalRate, maxInternalRate]. Applied by prepare() and update();
+		Param_CpuBudget,		// Fraction of the block duration the simulation may take before it coarsens;
+		Param_InputGain,		// Live input;
+		Param_InputCutoff,		// Live input lowpass in Hz;
+		numParams
+	};
+
+	enum Excitation
+	{
+		Excitation_Impulse,
+		Excitation_Sin,
+		Excitation_Saw,
+		Excitation_LiveInput		// Channel 0 of the buffer passed to process();
+	};
+
+	// Storage and arithmetic of the dense sweep on the loaded molecule (MoleculeSolver.h). The float sweeps run the
+	// tuned layout built in float, but on the bundled molecules they cost about what double does, so the app and
+	// plugin offer them to compare by ear rather than to save CPU. Tiling and the JIT only run at Precision_Double;
+	enum Precision
+	{
+		Precision_Double,
+		Precision_Float,				// Float state and arithmetic;
+		Precision_FloatDoubleSum,		// Float state, double arithmetic;
+
+		// Float state, compensated Laplacian. Three to four times the CPU of Precision_Float for no better SNR, so the
+		// app and plugin don't offer it;
+		Precision_FloatCompensated,
+
+		// Float positions, fp16 N-1 level and bond weights. It only saves bandwidth past about 100k nodes and costs
+		// several times double below that, so the app and plugin don't offer it;
+		Precision_Half,
+		numPrecisions
+	};
+
+	MoleculeEngine()
+	{
+		const double defaults[numParams] = { 0.015, 0.0001, 44100.0, 0.5, 1.0, 24000.0 };
+		for (int p = 0; p != numParams; ++p)
+			params[p] = defaults[p];
+
+		for (int i = 0; i != numElementsIn(sawtooth); ++i)
+			sawtooth[i] = (i % signalPeriod) / (float)signalPeriod;
+
+		boundary.driven.assign(1, { 14, 1.0f });
+		boundary.clamped.assign(1, 0);		// Atom 0 has always been the fixed end;
+		std::fill(std::begin(pickupCentres), std::end(pickupCentres), noPickup);
+		pickupCentres[0] = pickupCentres[1] = 34;		// Both channels at one atom, as the mono tap was copied to both;
+		rebuildPickups();
+		sendBoundary();
+	}
+
+	// Another engine playing the same molecule can tune it once this one is gone;
+	~MoleculeEngine()
+	{
+		releaseTuning();
+	}
+
+	//==============================================================================
+	// Control thread;
+
+	// Replace the molecule with the one in a .pdb or the app's .json, compiled before this returns. Other engines that
+	// load the same path with the same atoms clamped share the file and the compile. Returns false if it can't be read
+	// or has no atoms;
+	bool load(const std::string& aPath)
+	{
+		return loadShared(aPath, [&aPath](LoadedMolecule& aMolecule) { return readMolecule(aPath, aMolecule); });
+	}
+
+	// As load(), for a .pdb held in memory, such as one embedded in a plugin. aName identifies it to the cache;
+	bool loadPdbData(const std::string& aName, const char* aData, size_t aSize)
+	{
+		return loadShared("data:" + aName, [aData, aSize](LoadedMolecule& aMolecule)
+		{
+			std::istringstream pdb(std::string(aData, aSize));
+			return loadPdbMolecule(pdb, aMolecule);
+		});
+	}
+
+	// Read a .pdb or .json by its extension without loading it, for callers that also want coordinates;
+	static bool readMolecule(const std::string& aPath, LoadedMolecule& aMolecule)
+	{
+		const bool isJson = aPath.size() >= 5 && aPath.compare(aPath.size() - 5, 5, ".json") == 0;
+		return isJson ? loadJsonMolecule(aPath, aMolecule) : loadPdbMolecule(aPath, aMolecule);
+	}
+
+	// Replace the molecule with aBonds, compiled before this returns and not shared;
+	void loadMolecule(const EditableTopology& aBonds)
+	{
+		TRACE_SCOPE("Load molecule");
+		source.reset();
+		sharedCompiled.reset();
+		editTopology = aBonds;
+		isEdited = true;
+		const uint32_t edit = ++editGeneration;
+		auto compiled = TopologyCompiler::compile(editTopology, boundary.clamped, compilerSettings);
+		compiled->editGeneration = edit;
+		compiledGeneration = edit;
+		installMolecule(std::move(compiled));
+	}
+
+	// Structural edits take effect once update() installs them. Returns the new atom's index;
+	uint32_t addAtom()
+	{
+		++editGeneration;
+		return getEditableTopology().addAtom();
+	}
+
+	// Returns false if the atoms are already bonded or don't exist;
+	bool addBond(uint32_t aFirst, uint32_t aSecond)
+	{
+		if (!getEditableTopology().addBond(aFirst, aSecond))
+			return false;
+		++editGeneration;
+		return true;
+	}
+
+	// Clamped atoms are numbered first on every level, so changing them recompiles the topology;
+	void toggleClampedAtom(uint32_t aAtom)
+	{
+		auto clamped = std::find(boundary.clamped.begin(), boundary.clamped.end(), aAtom);
+		if (clamped != boundary.clamped.end())
+			boundary.clamped.erase(clamped);
+		else
+			boundary.clamped.push_back(aAtom);
+
+		++editGeneration;
+	}
+
+	// Boundary roles by atom. The audio thread takes a copy at its next block and maps it to nodes once per block;
+	void setDrivenAtoms(std::vector<WeightedIndex> aAtoms)
+	{
+		boundary.driven = std::move(aAtoms);
+		sendBoundary();
+	}
+
+	// The pickup of output channel aChannel, a Gaussian-weighted region pickupSpread bonds wide around aCentre. A
+	// channel left at noPickup plays silence;
+	void setPickup(int aChannel, uint32_t aCentre)
+	{
+		if (aChannel < 0 || aChannel >= maxOutputChannels)
+			return;
+		pickupCentres[aChannel] = aCentre;
+		rebuildPickups();
+		sendBoundary();
+	}
+
+	// Left and right pickups, on channels 0 and 1;
+	void setPickupCentres(uint32_t aLeft, uint32_t aRight)
+	{
+		pickupCentres[0] = aLeft;
+		pickupCentres[1] = aRight;
+		rebuildPickups();
+		sendBoundary();
+	}
+
+	// Standard deviation of each pickup region in bonds;
+	void setPickupSpread(float aSpread)
+	{
+		pickupSpread = aSpread;
+		rebuildPickups();
+		sendBoundary();
+	}
+
+	// Compile a kernel specialised to the loaded molecule in the background. The generic kernel runs until it is ready;
+	void setJitEnabled(bool aIsEnabled)
+	{
+		isJitEnabled = aIsEnabled;
+		if (isJitEnabled && sentKernels.jit == nullptr && installedLevels != nullptr)
+			stencilJit.compileAsync((*installedLevels)[0].topology, numInstalls);
+		else if (!isJitEnabled)
+		{
+			stencilJit.cancel();
+			sentKernels.jit.reset();
+			sendKernels();
+		}
+	}
+
+	// Takes effect at the next block, keeping the molecule ringing;
+	void setPrecision(Precision aPrecision)
+	{
+		precision = aPrecision;
+		sentKernels.reduced = installedLevels != nullptr ? makeReducedSweep((*installedLevels)[0].topology) : nullptr;
+		sendKernels();
+	}
+
+	Precision getPrecision() const { return precision; }
+
+	// Where the fastest kernel layout per molecule and machine is remembered. Set before load();
+	void setKernelCache(const std::string& aPath, const std::string& aCpuModel) { kernelTuner.setCache(aPath, aCpuModel); }
+
+	// Compile the latest edit if the compiler is free, and install a finished compile. Call regularly;
+	void update()
+	{
+		boundaryHandoff.collect();
+		moleculeHandoff.collect();
+		kernelHandoff.collect();
+		rateHandoff.collect();
+
+		// The resampler tables for a new internal or device rate are built here, as the audio thread can't afford to;
+		const double deviceRate = preparedSampleRate.load();
+		const double internalRate = params[Param_InternalRate].load();
+		if (deviceRate != 0.0 && (deviceRate != sentDeviceRate || internalRate != sentInternalRate))
+		{
+			rateHandoff.send(makeRate(deviceRate, internalRate));
+			sentDeviceRate = deviceRate;
+			sentInternalRate = internalRate;
+		}
+
+		const uint32_t currentEdit = editGeneration.load();
+		if (compiledGeneration != currentEdit && !topologyCompiler.isBusy())
+		{
+			compiledGeneration = currentEdit;
+			topologyCompiler.compileAsync(getTopology(), boundary.clamped, currentEdit);
+		}
+
+		// A compile older than the one installed by a load is dropped. A newer one replaces the shared compile;
+		if (auto compiled = topologyCompiler.takeCompiled())
+		{
+			if (compiled->editGeneration >= installedGeneration)
+			{
+				installMolecule(std::move(compiled));
+				sharedCompiled.reset();
+			}
+		}
+
+		// Kernels built for an earlier molecule are dropped. The tuned layout goes to every engine playing the compile,
+		// and if the engine tuning it has moved on, this one takes over;
+		bool isKernelReady = false;
+		if (auto tuned = kernelTuner.takeResult())
+		{
+			if (tuned->tag == numInstalls && isTuningClaimed)
+			{
+				installedChoice->publish(std::move(tuned->kernel), tuned->isTiled);
+				isTuningClaimed = false;
+			}
+		}
+		if (installedChoice != nullptr && sentKernels.tuned == nullptr && !sentKernels.isTiled && !isTuningClaimed)
+		{
+			if (installedChoice->get(sentKernels.tuned, sentKernels.isTiled))
+			{
+				sentKernels.reduced = makeReducedSweep((*installedLevels)[0].topology);
+				isKernelReady = true;
+			}
+			else if (installedChoice->isUnclaimed())
+				claimTuning();
+		}
+		if (auto library = stencilJit.takeCompiled())
+		{
+			if (library->getTag() == numInstalls && isJitEnabled)
+			{
+				sentKernels.jit = std::move(library);
+				isKernelReady = true;
+			}
+		}
+		if (isKernelReady)
+			sendKernels();
+	}
+
+	// Bumped by every edit to atoms, bonds or clamping, so callers can tell when to redraw;
+	uint32_t getEditGeneration() const { return editGeneration.load(); }
+
+	// The molecule being edited, which is the shared one as loaded until the first structural edit;
+	const EditableTopology& getTopology() const { return isEdited || source == nullptr ? editTopology : source->bonds; }
+
+	// The file last loaded, with its coordinates and elements, or nullptr after loadMolecule();
+	std::shared_ptr<const LoadedMolecule> getSource() const { return source; }
+	const MoleculeBoundary& getBoundary() const { return boundary; }
+
+	// The molecule being simulated, which lags edits until update() installs them;
+	uint32_t getNumSimulatedAtoms() const { return installedLevels == nullptr ? 0u : (uint32_t)(*installedLevels)[0].atomToNode.size(); }
+	size_t getNumSimulatedBonds() const { return installedLevels == nullptr ? (size_t)0 : (*installedLevels)[0].topology.getNumBonds(); }
+	uint32_t getNumNodes(size_t aLevel) const
+	{
+		return installedLevels != nullptr && aLevel < installedLevels->size() ? (*installedLevels)[aLevel].topology.numNodes : 0u;
+	}
+
+	// Any thread;
+	size_t getDetailLevel() const { return idxLevel; }
+
+	//==============================================================================
+	// Any thread;
+
+	void setParam(Param aParam, double aValue)
+	{
+		if (aParam == Param_InternalRate)
+			aValue = std::max(minInternalRate, std::min(maxInternalRate, aValue));
+		params[aParam] = aValue;
+	}
+
+	double getParam(Param aParam) const { return params[aParam].load(); }
+
+	void setExcitation(Excitation aExcitation) { excitation = aExcitation; }
+	Excitation getExcitation() const { return excitation.load(); }
+
+	// While the gate is open the selected signal drives the molecule;
+	void setGate(bool aIsOpen) { isGateOpen = aIsOpen; }
+
+	// An impulse at the start of the next block;
+	void strike() { isStrikePending = true; }
+
+	// MIDI notes strike the driven atom at their pitch, or with this on, pick the atom struck from the note number;
+	void setMidiKeysSelectAtoms(bool aIsAtom) { isMidiKeyAtom = aIsAtom; }
+
+	// Mean square displacement per node-step of the last block;
+	float getEnergy() const { return energyMeter.load(); }
+
+	DeadlineMonitor& getDeadlineMonitor() { return deadlineMonitor; }
+
+	// Per-atom displacement for visualisers, published a few times per display frame once one has attached;
+	MoleculeSnapshotPublisher& getSnapshotPublisher() { return snapshotPublisher; }
+
+	// Allocate the frames getSnapshotPublisher() hands out and start publishing. They hold every atom of the molecule
+	// installed now, and molecules loaded later with more atoms than that are sampled at a stride. Engines nobody
+	// watches, such as plugins behind the generic editor, never pay for them. Control thread;
+	void attachVisualiser()
+	{
+		if (isVisualised.load(std::memory_order_relaxed))
+			return;
+		snapshotPublisher.prepare(std::max(minSnapshotAtoms, getNumSimulatedAtoms()));
+		isVisualised.store(true, std::memory_order_release);
+	}
+	static constexpr double visualiserSnapshotRate = 120.0;		// Twice a 60 Hz repaint;
+
+	// Snapshots of each simulated block go to aRecorder too while it records. Set before audio starts;
+	void setSnapshotRecorder(BackgroundRecorder* aRecorder) { snapshotRecorder = aRecorder; }
+
+	//==============================================================================
+	// Audio thread;
+
+	// Allocates the chunk buffers for blocks of up to aBlockSize at the highest internal rate. Larger blocks are
+	// simulated in several chunks;
+	void prepare(double aSampleRate, int aBlockSize)
+	{
+		sampleRate = aSampleRate;
+		blockSize = aBlockSize;
+		const int chunkSize = std::max(minChunk, (int)std::ceil(aBlockSize * maxInternalRate / aSampleRate) + chunkMargin);
+		input.assign(chunkSize, 0.0f);
+		for (auto& o : output)
+			o.assign(chunkSize, 0.0f);
+		voiceOutput.assign(chunkSize, 0.0f);
+		liveExcitation.allocate(std::max(minChunk, aBlockSize));
+
+		deadlineMonitor.prepare(sampleRate);
+		preparedSampleRate = sampleRate;
+		std::swap(playedRate, *makeRate(sampleRate, params[Param_InternalRate].load()));
+		applyRate();
+		snapshotPublisher.setRate(sampleRate, visualiserSnapshotRate);
+	}
+
+	double getSampleRate() const { return sampleRate; }
+	int getBlockSize() const { return blockSize; }
+	double getInternalSampleRate() const { return internalSampleRate; }
+
+	// A note to start or, with aVelocity 0, release aSampleOffset samples into the next process() call;
+	void queueNote(int aNote, float aVelocity, int aSampleOffset)
+	{
+		if (numQueuedNotes != maxQueuedNotes)
+			queuedNotes[numQueuedNotes++] = { aNote, aVelocity, aSampleOffset };
+	}
+
+	void queueAllNotesOff()
+	{
+		if (numQueuedNotes != maxQueuedNotes)
+			queuedNotes[numQueuedNotes++] = { allNotesOffKey, 0.0f, 0 };
+	}
+
+	// Render aNumSamples into aChannels. With Excitation_LiveInput, aChannels[0] holds the input on entry; every
+	// channel is overwritten;
+	void process(float* const* aChannels, int aNumChannels, int aNumSamples)
+	{
+		TRACE_SCOPE("Engine block");
+		const DeadlineMonitor::BlockScope blockScope(deadlineMonitor, aNumSamples);
+		receiveBoundary();
+		receiveMolecule();
+		receiveKernels();
+		receiveRate();
+
+		// Live input arrives in the buffer being filled. Each chunk of the first channel is read before the
+		// molecule's output overwrites it, so the buffer is only cleared up front for the synthesised excitations;
+		const Excitation currentExcitation = excitation.load();
+		const bool isLive = currentExcitation == Excitation_LiveInput;
+		const bool isExcite = isGateOpen.load();
+		if (!isLive)
+			clear(aChannels, aNumChannels, aNumSamples);
+
+		// Decayed molecule with nothing exciting it; output stays cleared until the next excitation;
+		if (isIdle && !isExcite && !isLive && !isStrikePending && numQueuedNotes == 0 && !voicePool.isSounding())
+			return;
+		isIdle = false;
+
+		// Nothing loaded or prepared yet;
+		if (levels == nullptr || input.empty())
+		{
+			clear(aChannels, aNumChannels, aNumSamples);
+			return;
+		}
+
+		uint64_t stageStart = DeadlineMonitor::now();
+		auto endStage = [this, &stageStart](DeadlineMonitor::Stage aStage)
+		{
+			const uint64_t stageEnd = DeadlineMonitor::now();
+			deadlineMonitor.addStage(aStage, stageEnd - stageStart);
+			stageStart = stageEnd;
+		};
+
+		const MoleculeLevel& level = (*levels)[idxLevel];
+		boundaryNodes.assign(playedBoundary, level.atomToNode, level.topology.numClamped, level.topology.numNodes);
+
+		waveSpeed = params[Param_WaveSpeed].load();
+		genDamp = params[Param_Damping].load();
+
+		handleNotes(aNumSamples);
+		endStage(DeadlineMonitor::Stage_Excitation);
+
+		// One pickup per device channel. Channels past the last pickup are silent;
+		const int numChannels = std::min((int)boundaryNodes.numChannels, std::min(aNumChannels, maxOutputChannels));
+		if (numChannels == 0)
+		{
+			clear(aChannels, aNumChannels, aNumSamples);
+			return;
+		}
+		const float inputGain = (float)params[Param_InputGain].load();
+		const float inputCutoff = (float)params[Param_InputCutoff].load();
+
+		// Simulate at the internal rate in chunks that fit input[]/output[], then resample to the device rate;
+		int idxOutput = 0;
+		int numInternalTotal = 0;
+		double blockEnergy = 0.0;
+		while (idxOutput < aNumSamples)
+		{
+			const int numOutput = std::min(aNumSamples - idxOutput, maxOutputChunk);
+			const int numInternal = resamplers[0].getNumInputSamplesRequired(numOutput);
+
+			// The excitation is the conditioned device input, read in place when no rate conversion is needed;
+			const float* currentInput = input.data();
+			if (isLive)
+			{
+				float* deviceInput = aChannels[0] + idxOutput;
+				liveExcitation.condition(deviceInput, numOutput, inputGain, inputCutoff);
+				if (liveExcitation.isDirect())
+					currentInput = deviceInput;
+				else
+				{
+					liveExcitation.push(deviceInput, numOutput);
+					liveExcitation.read(input.data(), numInternal);
+				}
+			}
+			else
+				prepareExcitation(numInternal, currentExcitation, isExcite);
+			endStage(DeadlineMonitor::Stage_Excitation);
+
+			blockEnergy += simulateBlock(numInternal, currentInput);
+
+			// Notes ring in their own lanes and are mixed into every channel before resampling;
+			if (voicePool.isSounding())
+			{
+				TRACE_SCOPE("Voices");
+				std::fill(voiceOutput.begin(), voiceOutput.begin() + numInternal, 0.0f);
+				voicePool.process(voiceOutput.data(), numInternal, silenceThreshold);
+				for (int c = 0; c != numChannels; ++c)
+				{
+					if (boundaryNodes.pickups[c].empty())
+						continue;
+					for (int n = 0; n != numInternal; ++n)
+						output[c][n] += voiceOutput[n];
+				}
+			}
+			endStage(DeadlineMonitor::Stage_Simulation);
+
+			for (int c = 0; c != numChannels; ++c)
+				resamplers[c].process(output[c].data(), numInternal, aChannels[c] + idxOutput, numOutput);
+
+			idxOutput += numOutput;
+			numInternalTotal += numInternal;
+			endStage(DeadlineMonitor::Stage_Output);
+		}
+
+		for (int c = numChannels; c < aNumChannels; ++c)
+			std::fill(aChannels[c], aChannels[c] + aNumSamples, 0.0f);
+		endStage(DeadlineMonitor::Stage_Output);
+
+		// Snapshots are only taken while the molecule is simulated; an idle molecule is at rest;
+		if (snapshotRecorder != nullptr)
+			snapshotRecorder->pushSnapshot(displacement[idxRotationN].data(), level.atomToNode, aNumSamples);
+		if (isVisualised.load(std::memory_order_acquire))
+			snapshotPublisher.push(aChannels[0], aNumSamples, displacement[idxRotationN].data(), level.atomToNode);
+
+		// Mean square displacement per node-step;
+		const double meanEnergy = blockEnergy / std::max(1.0, (double)numInternalTotal * level.topology.numNodes);
+		energyMeter = (float)meanEnergy;
+		if (!isExcite && !isLive && !voicePool.isSounding() && meanEnergy < silenceThreshold)
+			enterIdle();
+
+		updateLevelOfDetail(deadlineMonitor.getBlockLoad());
+	}
+
+private:
+	struct QueuedNote
+	{
+		int note;
+		float velocity;
+		int sampleOffset;
+	};
+
+	// The resampler tables for one pair of rates, built by update() and swapped in whole;
+	struct PlayedRate
+	{
+		double deviceRate = 0.0;
+		double internalRate = 44100.0;
+		std::unique_ptr<PolyphaseResampler::Table> toDevice;		// Every output channel's;
+		std::unique_ptr<PolyphaseResampler::Table> fromDevice;		// Live input's;
+	};
+
+	template <typename Type, size_t size>
+	static constexpr int numElementsIn(const Type (&)[size]) { return (int)size; }
+
+	static void clear(float* const* aChannels, int aNumChannels, int aNumSamples)
+	{
+		for (int c = 0; c != aNumChannels; ++c)
+			std::fill(aChannels[c], aChannels[c] + aNumSamples, 0.0f);
+	}
+
+	// Read the molecule through the cache and install an instance of its shared compile;
+	bool loadShared(const std::string& aKey, const MoleculeCache::Reader& aRead)
+	{
+		TRACE_SCOPE("Load molecule");
+		MoleculeCache& cache = MoleculeCache::getInstance();
+		std::shared_ptr<const LoadedMolecule> loaded = cache.acquireSource(aKey, aRead);
+		if (loaded == nullptr)
+			return false;
+
+		source = std::move(loaded);
+		editTopology.clear();
+		isEdited = false;
+		const uint32_t edit = ++editGeneration;
+		std::shared_ptr<const CompiledMolecule> shared = cache.acquireCompiled(aKey, source->bonds, boundary.clamped, compilerSettings);
+		auto compiled = shared->instantiate();
+		compiled->editGeneration = edit;
+		compiledGeneration = edit;
+		installMolecule(std::move(compiled));
+		sharedCompiled = std::move(shared);
+		return true;
+	}
+
+	// The first structural edit after a load copies the shared bonds;
+	EditableTopology& getEditableTopology()
+	{
+		if (!isEdited && source != nullptr)
+			editTopology = source->bonds;
+		isEdited = true;
+		return editTopology;
+	}
+
+	// Regions are found on the installed molecule and stored by atom, so every level maps them itself. Until a
+	// topology is built each pickup is its centre atom alone. There is one region per channel up to the last with a
+	// pickup, empty for the channels without one. Control thread;
+	void rebuildPickups()
+	{
+		size_t numChannels = numElementsIn(pickupCentres);
+		while (numChannels != 0 && pickupCentres[numChannels - 1] == noPickup)
+			--numChannels;
+
+		boundary.pickups.resize(numChannels);
+		for (size_t c = 0; c != boundary.pickups.size(); ++c)
+		{
+			auto& pickup = boundary.pickups[c];
+			pickup.clear();
+			if (pickupCentres[c] == noPickup)
+				continue;
+			pickup.assign(1, { pickupCentres[c], 1.0f });
+			if (installedLevels == nullptr || pickupCentres[c] >= (*installedLevels)[0].atomToNode.size())
+				continue;
+
+			const MoleculeLevel& level = (*installedLevels)[0];
+			std::vector<uint32_t> nodeToAtom(level.atomToNode.size());
+			for (uint32_t a = 0; a != nodeToAtom.size(); ++a)
+				nodeToAtom[level.atomToNode[a]] = a;
+
+			pickup = makeGaussianRegion(level.topology, level.atomToNode[pickupCentres[c]], pickupSpread);
+			for (auto& p : pickup)
+				p.index = nodeToAtom[p.index];
+		}
+	}
+
+	// Hand the driven atoms and pickups to the audio thread, with node lists reserved to map them into. Control thread;
+	void sendBoundary()
+	{
+		auto played = std::make_unique<PlayedBoundary>();
+		played->boundary.driven = boundary.driven;
+		played->boundary.pickups = boundary.pickups;
+		const auto tap = std::find_if(std::begin(pickupCentres), std::end(pickupCentres), [](uint32_t c) { return c != noPickup; });
+		played->tapAtom = tap != std::end(pickupCentres) ? *tap : 0;
+		played->nodes.reserve(played->boundary);
+		boundaryHandoff.send(std::move(played));
+	}
+
+	// Swap in the boundary sent last, giving the one it replaces back to be freed. Audio thread;
+	void receiveBoundary()
+	{
+		if (PlayedBoundary* played = boundaryHandoff.receive())
+		{
+			std::swap(playedBoundary, played->boundary);
+			std::swap(playedTapAtom, played->tapAtom);
+			std::swap(boundaryNodes, played->nodes);
+			boundaryHandoff.giveBack(played);
+		}
+	}
+
+	// Hand a compiled molecule to the audio thread with everything it needs to play it allocated here, then start
+	// building kernels for it. The molecule it replaces comes back to be freed on a later update();
+	void installMolecule(std::unique_ptr<CompiledMolecule> aCompiled)
+	{
+		TRACE_SCOPE("Install topology");
+
+		// The tuner times its own copy, as the audio thread will be writing this one's ring buffers;
+		releaseTuning();
+		tilingCandidate.reset();
+		if (aCompiled->isTilingWorthwhile)
+			tilingCandidate = std::make_unique<TemporalTiler>(aCompiled->temporalTiler);
+		installedChoice = aCompiled->kernelChoice;
+
+		const MoleculeLevel& level = (*aCompiled->levels)[0];
+		const uint32_t numNodes = level.topology.numNodes;
+		auto played = std::make_unique<PlayedMolecule>();
+		played->activeAtoms.resize(numNodes);
+		played->isAtomActive.assign(numNodes, 0);
+		played->isAtomExpanded.assign(numNodes, 0);
+		played->voiceBatch.prepare(level.topology, params[Param_InternalRate].load(), deltaX);
+		played->install = ++numInstalls;
+
+		installedLevels = aCompiled->levels;
+		installedGeneration = aCompiled->editGeneration;
+		played->compiled = std::move(aCompiled);
+		moleculeHandoff.send(std::move(played));
+
+		// Pickup regions follow the bonds;
+		rebuildPickups();
+		sendBoundary();
+
+		// The previous molecule's kernels are released along with it. A layout another engine already tuned for this
+		// compile is played straight away;
+		const MoleculeTopology& topology = (*installedLevels)[0].topology;
+		sentKernels = PlayedKernels {};
+		sentKernels.install = numInstalls;
+		const bool isChosen = installedChoice->get(sentKernels.tuned, sentKernels.isTiled);
+		sentKernels.reduced = makeReducedSweep(topology);
+		sendKernels();
+
+		if (isJitEnabled)
+			stencilJit.compileAsync(topology, numInstalls);
+		else
+			stencilJit.cancel();
+		if (isChosen)
+			tilingCandidate.reset();
+		else
+			claimTuning();
+	}
+
+	// Tune the installed molecule unless another engine is already tuning it. Control thread;
+	void claimTuning()
+	{
+		if (!installedChoice->claim())
+			return;
+		isTuningClaimed = true;
+		kernelTuner.tuneAsync(std::shared_ptr<const MoleculeTopology>(installedLevels, &(*installedLevels)[0].topology), numInstalls,
+							  std::move(tilingCandidate));
+	}
+
+	// Stop tuning the installed molecule, letting another engine playing it take over. Control thread;
+	void releaseTuning()
+	{
+		kernelTuner.cancel();
+		if (isTuningClaimed)
+			installedChoice->release();
+		isTuningClaimed = false;
+	}
+
+	// Swap in the molecule sent last. Existing displacement is kept for atoms that survive, so interactive edits don't
+	// silence a ringing molecule. Audio thread;
+	void receiveMolecule()
+	{
+		PlayedMolecule* played = moleculeHandoff.receive();
+		if (played == nullptr)
+			return;
+		TRACE_SCOPE("Install topology");
+		switchLevel(0);
+
+		// Carry displacement over by atom, as the node order changes with the bonds;
+		CompiledMolecule& compiled = *played->compiled;
+		const MoleculeLevel& newLevel = (*compiled.levels)[0];
+		if (levels != nullptr)
+		{
+			const std::vector<uint32_t>& oldAtomToNode = (*levels)[0].atomToNode;
+			const size_t numCarried = std::min(oldAtomToNode.size(), newLevel.atomToNode.size());
+			for (int t = 0; t != 3; ++t)
+			{
+				for (size_t a = 0; a != numCarried; ++a)
+					compiled.displacement[t][newLevel.atomToNode[a]] = displacement[t][oldAtomToNode[a]];
+				std::fill(compiled.displacement[t].begin(), compiled.displacement[t].begin() + newLevel.topology.numClamped, 0.0);
+			}
+		}
+
+		// The frontier flags go back cleared, so they are reset before being swapped;
+		resetActiveSet();
+		std::swap(activeAtoms, played->activeAtoms);
+		std::swap(isAtomActive, played->isAtomActive);
+		std::swap(isAtomExpanded, played->isAtomExpanded);
+
+		std::swap(levels, compiled.levels);
+		for (int t = 0; t != 3; ++t)
+			std::swap(displacement[t], compiled.displacement[t]);
+		std::swap(transferScratch, compiled.transferScratch);
+		std::swap(temporalTiler, compiled.temporalTiler);
+		playedInstall = played->install;
+		voicePool.install(played->voiceBatch, *levels, deltaX);
+
+		deadlineMonitor.reset();		// Timings describe one molecule;
+		smoothedLoad = 0.0;
+		numBlocksSinceSwitch = 0;
+		isDenseMode = true;
+		moleculeHandoff.giveBack(played);
+	}
+
+	// Hand the current kernels to the audio thread. Control thread;
+	void sendKernels()
+	{
+		kernelHandoff.send(std::make_unique<PlayedKernels>(sentKernels));
+	}
+
+	// The sweep for the current precision, or nullptr at Precision_Double. The float sweeps use the layout tuned for the
+	// exact one, or SELL until there is one and when tiling won, as the tuner picks it for most molecules large enough
+	// to be worth it. Control thread;
+	std::shared_ptr<ReducedPrecisionSweep> makeReducedSweep(const MoleculeTopology& aTopology) const
+	{
+		const std::string layout = sentKernels.tuned != nullptr ? sentKernels.tuned->getName() : "SELL-8-64";
+		switch (precision)
+		{
+		case Precision_Float:
+			return std::make_shared<SolverSweep<MoleculeSolver<float>>>(aTopology, makeStencilKernel<float>(layout, aTopology));
+		case Precision_FloatDoubleSum:
+			return std::make_shared<SolverSweep<MoleculeSolver<float, PlainSum<double>>>>(aTopology, makeStencilKernel<float, double>(layout, aTopology));
+		case Precision_FloatCompensated:	return std::make_shared<SolverSweep<MoleculeSolver<float, CompensatedSum<float>>>>(aTopology);
+		case Precision_Half:				return std::make_shared<SolverSweep<CompactMoleculeSolver<float, HalfCodec, HalfCodec>>>(aTopology);
+		default:							return nullptr;
+		}
+	}
+
+	// Swap in the kernels sent last. The ones replaced are unloaded on the control thread; audio thread;
+	void receiveKernels()
+	{
+		if (PlayedKernels* played = kernelHandoff.receive())
+		{
+			std::swap(playedKernels, *played);
+			kernelHandoff.giveBack(played);
+		}
+	}
+
+	// The resampler tables between aDeviceRate and aInternalRate. Any thread but the audio thread;
+	static std::unique_ptr<PlayedRate> makeRate(double aDeviceRate, double aInternalRate)
+	{
+		auto rate = std::make_unique<PlayedRate>();
+		rate->deviceRate = aDeviceRate;
+		rate->internalRate = std::max(minInternalRate, std::min(maxInternalRate, aInternalRate));
+		rate->toDevice = PolyphaseResampler::makeTable(rate->internalRate, aDeviceRate);
+		rate->fromDevice = PolyphaseResampler::makeTable(aDeviceRate, rate->internalRate);
+		return rate;
+	}
+
+	// Swap in the rate sent last unless it was built for another device rate, in which case update() sends again.
+	// Audio thread;
+	void receiveRate()
+	{
+		if (PlayedRate* played = rateHandoff.receive())
+		{
+			if (played->deviceRate == sampleRate)
+			{
+				std::swap(playedRate, *played);
+				applyRate();
+			}
+			rateHandoff.giveBack(played);
+		}
+	}
+
+	// Simulation runs at internalSampleRate regardless of the device rate. The resamplers switch tables without
+	// dropping their history, so a rate change doesn't click;
+	void applyRate()
+	{
+		internalSampleRate = playedRate.internalRate;
+		deltaT = 1.0 / internalSampleRate;
+
+		for (auto& r : resamplers)
+			r.setTable(*playedRate.toDevice);
+		liveExcitation.setTable(*playedRate.fromDevice);
+		maxOutputChunk = std::min(resamplers[0].getMaxOutputSamplesFor((int)input.size()), liveExcitation.getMaxChunk());
+		voicePool.setInternalRate(internalSampleRate);
+	}
+
+	// Strike or release the queued notes in the voice pool, at their offsets into the block. The key map follows
+	// the current driven atom and first pickup, wave speed and damping;
+	void handleNotes(int aNumSamples)
+	{
+		MoleculeVoicePool<numVoiceLanes>::KeyMap keyMap;
+		keyMap.mapping = isMidiKeyAtom ? MoleculeVoicePool<numVoiceLanes>::Key_Atom : MoleculeVoicePool<numVoiceLanes>::Key_Pitch;
+		keyMap.atom = playedBoundary.driven.empty() ? 0u : playedBoundary.driven[0].index;
+		keyMap.tapAtom = playedTapAtom;
+		keyMap.waveSpeed = waveSpeed;
+		keyMap.genDamp = genDamp;
+		voicePool.setKeyMap(keyMap);
+
+		for (int k = 0; k != numQueuedNotes; ++k)
+		{
+			const QueuedNote& note = queuedNotes[k];
+			const int delay = (int)(std::max(0, std::min(aNumSamples, note.sampleOffset)) * internalSampleRate / sampleRate);
+			if (note.note == allNotesOffKey)
+				voicePool.allNotesOff();
+			else if (note.velocity > 0.0f)
+				voicePool.noteOn(note.note, note.velocity, delay);
+			else
+				voicePool.noteOff(note.note);
+		}
+		numQueuedNotes = 0;
+	}
+
+	// Move to the finest level whose predicted load fits the CPU budget, with hysteresis against flapping;
+	void updateLevelOfDetail(double aLoad)
+	{
+		smoothedLoad += 0.1 * (aLoad - smoothedLoad);
+		if (++numBlocksSinceSwitch < levelHoldBlocks)
+			return;
+
+		const double budget = params[Param_CpuBudget].load();
+		const double currentCost = (double)(*levels)[idxLevel].topology.getSweepCost();
+		if (smoothedLoad > budget && idxLevel + 1 < levels->size())
+		{
+			smoothedLoad *= (double)(*levels)[idxLevel + 1].topology.getSweepCost() / currentCost;
+			switchLevel(idxLevel + 1);
+		}
+		else if (idxLevel > 0)
+		{
+			const double predictedLoad = smoothedLoad * (double)(*levels)[idxLevel - 1].topology.getSweepCost() / currentCost;
+			if (predictedLoad < 0.8 * budget)
+			{
+				smoothedLoad = predictedLoad;
+				switchLevel(idxLevel - 1);
+			}
+		}
+	}
+
+	// Carry the three time levels across the hierarchy: mass-weighted average going coarser, injection going finer.
+	// Clamped nodes stay at rest on every level;
+	void switchLevel(size_t aNewLevel)
+	{
+		size_t currentLevel = idxLevel;
+		if (aNewLevel == currentLevel || levels == nullptr)
+			return;
+		TRACE_SCOPE("Switch detail level");
+
+		while (currentLevel < aNewLevel)
+		{
+			const MoleculeLevel& fine = (*levels)[currentLevel];
+			const MoleculeTopology& coarse = (*levels)[currentLevel + 1].topology;
+			for (auto& d : displacement)
+			{
+				std::fill(transferScratch.begin(), transferScratch.begin() + coarse.numNodes, 0.0);
+				for (uint32_t i = 0; i != fine.topology.numNodes; ++i)
+					transferScratch[fine.parent[i]] += fine.topology.mass[i] * d[i];
+				for (uint32_t c = 0; c != coarse.numNodes; ++c)
+					d[c] = transferScratch[c] * coarse.invMass[c];
+			}
+			++currentLevel;
+		}
+
+		while (currentLevel > aNewLevel)
+		{
+			const MoleculeLevel& fine = (*levels)[currentLevel - 1];
+			for (auto& d : displacement)
+			{
+				for (uint32_t i = 0; i != fine.topology.numNodes; ++i)
+					transferScratch[i] = d[fine.parent[i]];
+				std::copy(transferScratch.begin(), transferScratch.begin() + fine.topology.numNodes, d.begin());
+			}
+			--currentLevel;
+		}
+		idxLevel = currentLevel;
+		voicePool.switchLevel(currentLevel);
+
+		const uint32_t numClamped = (*levels)[currentLevel].topology.numClamped;
+		for (auto& d : displacement)
+			std::fill(d.begin(), d.begin() + std::min((size_t)numClamped, d.size()), 0.0);
+
+		numBlocksSinceSwitch = 0;
+		resetActiveSet();
+		isDenseMode = true;
+	}
+
+	// Zero the molecule and resampler state so a later excitation starts from rest;
+	void enterIdle()
+	{
+		for (auto& d : displacement)
+			std::fill(d.begin(), d.end(), 0.0);
+		for (auto& r : resamplers)
+			r.reset();
+		liveExcitation.reset();
+		resetActiveSet();
+		idxSignal = 0;
+		isIdle = true;
+	}
+
+	// Leapfrog update of free node i. Returns the new displacement;
+	inline float updateNode(const MoleculeTopology& aTopology, uint32_t i)
+	{
+		const double* uN = displacement[idxRotationN].data();
+		const double* uNMOne = displacement[idxRotationNMOne].data();
+
+		float forceY = 0.0;
+		float tempForce = 0.0;
+		for (uint32_t e = aTopology.rowStart[i]; e != aTopology.rowStart[i + 1]; ++e)
+		{
+			tempForce += aTopology.stiffness[e] * uN[aTopology.neighbours[e]];
+		}
+		forceY = waveSpeed*waveSpeed * aTopology.invMass[i] * ((tempForce - aTopology.degree[i] * uN[i]) / (deltaX * deltaX));
+		forceY = forceY - (2 * genDamp * ((uN[i] - uNMOne[i]) / deltaT));
+
+		forceY = forceY * (deltaT*deltaT);
+		forceY = forceY + 2 * uN[i] - uNMOne[i];
+
+		displacement[idxRotationNPOne][i] = forceY;
+		return forceY;
+	}
+
+	// Active frontier: atoms outside the set are at rest with resting neighbours, so skipping them is exact.
+	// The set only grows until the molecule goes idle or coverage passes denseCoverage;
+	void resetActiveSet()
+	{
+		for (uint32_t k = 0; k != numActiveAtoms; ++k)
+		{
+			isAtomActive[activeAtoms[k]] = 0;
+			isAtomExpanded[activeAtoms[k]] = 0;
+		}
+		numActiveAtoms = 0;
+		isDenseMode = false;
+	}
+
+	inline void activateAtom(uint32_t aIdx)
+	{
+		if (!isAtomActive[aIdx])
+		{
+			isAtomActive[aIdx] = 1;
+			activeAtoms[numActiveAtoms++] = aIdx;
+		}
+	}
+
+	void expandAtom(const MoleculeTopology& aTopology, uint32_t aIdx)
+	{
+		isAtomExpanded[aIdx] = 1;
+		for (uint32_t e = aTopology.rowStart[aIdx]; e != aTopology.rowStart[aIdx + 1]; ++e)
+			activateAtom(aTopology.neighbours[e]);
+	}
+
+	// Fill input[] with the next aNumSamples samples of the excitation signal. A strike leaves its impulse at the
+	// start of input[], which the impulse excitation never overwrites while the gate is held;
+	void prepareExcitation(int aNumSamples, Excitation aExcitation, bool aIsExcite)
+	{
+		for (auto n = 0; n < aNumSamples; ++n)
+		{
+			if (aIsExcite)
+			{
+				if (idxSignal < (uint32_t)signalPeriod)
+				{
+					if (aExcitation == Excitation_Sin)
+						input[n] = std::sin(idxSignal / (float)signalPeriod);
+					else if (aExcitation == Excitation_Saw)
+						input[n] = sawtooth[idxSignal];
+					idxSignal++;
+				}
+				else
+					idxSignal = 0;
+			}
+			else
+			{
+				input[n] = 0.0;
+			}
+		}
+
+		if (isStrikePending.exchange(false))
+			input[0] = 1.0f;
+	}
+
+	// Advance the molecule aNumSamples steps at the internal rate, driven by aExcitation[] and writing each pickup to
+	// its channel of output[]. Returns the sum of squared displacements over the block, used for silence detection;
+	double simulateBlock(int aNumSamples, const float* aExcitation)
+	{
+		TRACE_SCOPE("Simulate");
+		const MoleculeTopology& topology = (*levels)[idxLevel].topology;
+		double energy = 0.0;
+
+		// The specialised and tuned kernels only exist for the loaded molecule, not its coarsened levels, and may still
+		// be those of the molecule before;
+		const bool isKernelCurrent = idxLevel == 0 && playedKernels.install == playedInstall;
+		const StencilJit::StepFunction jitStep = isKernelCurrent && playedKernels.jit != nullptr ? playedKernels.jit->getStepFunction() : nullptr;
+		const StencilKernel* tunedKernel = isKernelCurrent ? playedKernels.tuned.get() : nullptr;
+		const double lapCoeff = waveSpeed * waveSpeed * (deltaT * deltaT) / (deltaX * deltaX);
+		const double dampCoeff = 2.0 * genDamp * deltaT;
+
+		// Driven nodes must always be swept so excitation can enter the frontier;
+		if (!isDenseMode)
+		{
+			for (const auto& d : boundaryNodes.driven)
+				activateAtom(d.index);
+		}
+
+		float* outputs[maxOutputChannels];
+		for (int c = 0; c != maxOutputChannels; ++c)
+			outputs[c] = output[c].data();
+
+		// Reduced precision runs the whole block in its own solver;
+		if (isDenseMode && isKernelCurrent && playedKernels.reduced != nullptr)
+		{
+			double* levelData[3] = { displacement[0].data(), displacement[1].data(), displacement[2].data() };
+			return playedKernels.reduced->process(levelData, idxRotationNMOne, idxRotationN, idxRotationNPOne, aExcitation, outputs, aNumSamples,
+												  boundaryNodes, lapCoeff, dampCoeff);
+		}
+
+		// Cache-sized tiles advanced several steps at a time for molecules that do not fit in cache, where the tuner
+		// measured that this beats every single-step kernel;
+		if (isDenseMode && isKernelCurrent && playedKernels.isTiled)
+		{
+			double* levelData[3] = { displacement[0].data(), displacement[1].data(), displacement[2].data() };
+			for (int n = 0; n < aNumSamples; n += TemporalTiler::maxDepth)
+			{
+				const int numSteps = std::min(TemporalTiler::maxDepth, aNumSamples - n);
+				float* chunkOutputs[maxOutputChannels];
+				for (uint32_t c = 0; c != boundaryNodes.numChannels; ++c)
+				{
+					chunkOutputs[c] = output[c].data() + n;
+					std::fill(chunkOutputs[c], chunkOutputs[c] + numSteps, 0.0f);
+				}
+				energy += temporalTiler.process(levelData, idxRotationNMOne, idxRotationN, idxRotationNPOne, aExcitation + n, chunkOutputs, numSteps,
+												boundaryNodes, lapCoeff, dampCoeff);
+			}
+			return energy;
+		}
+
+		for (auto n = 0; n < aNumSamples; ++n)
+		{
+			double* uNPOne = displacement[idxRotationNPOne].data();
+			if (isDenseMode && (jitStep != nullptr || tunedKernel != nullptr))
+			{
+				const double* uN = displacement[idxRotationN].data();
+				const double* uNMOne = displacement[idxRotationNMOne].data();
+				if (jitStep != nullptr)
+					energy += jitStep(uN, uNMOne, uNPOne, lapCoeff, dampCoeff);
+				else
+					energy += tunedKernel->step(uN, uNMOne, uNPOne, lapCoeff, dampCoeff);
+			}
+			else if (isDenseMode)
+			{
+				for (uint32_t i = topology.numClamped; i < topology.numNodes; ++i)
+				{
+					const float forceY = updateNode(topology, i);
+					energy += forceY * forceY;
+				}
+			}
+			else
+			{
+				// Atoms appended while sweeping the frontier start updating on the next step;
+				const uint32_t numFrontier = numActiveAtoms;
+				for (uint32_t k = 0; k != numFrontier; ++k)
+				{
+					const uint32_t i = activeAtoms[k];
+					if (i < topology.numClamped)
+						continue;
+
+					const float forceY = updateNode(topology, i);
+					energy += forceY * forceY;
+					if (forceY != 0.0f && !isAtomExpanded[i])
+						expandAtom(topology, i);
+				}
+
+				// Driven nodes only take the excitation below, so they are expanded as soon as it is non-zero;
+				if (aExcitation[n] != 0.0f)
+				{
+					for (const auto& d : boundaryNodes.driven)
+					{
+						if (!isAtomExpanded[d.index])
+							expandAtom(topology, d.index);
+					}
+				}
+
+				if (numActiveAtoms > denseCoverage * topology.numNodes)
+					isDenseMode = true;
+			}
+
+			// Driven atoms and pickups are weighted lists applied after the sweep, so no kernel tests a node's role;
+			boundaryNodes.apply(uNPOne, aExcitation[n], outputs, n);
+
+			idxRotationNMOne = (idxRotationNMOne + 1) % 3;
+			idxRotationN = (idxRotationN + 1) % 3;
+			idxRotationNPOne = (idxRotationNPOne + 1) % 3;
+		}
+
+		return energy;
+	}
+
+	std::atomic<double> params[numParams];
+	std::atomic<Excitation> excitation { Excitation_Impulse };
+	std::atomic<bool> isGateOpen { false };
+	std::atomic<bool> isStrikePending { false };
+	std::atomic<bool> isMidiKeyAtom { false };
+	std::atomic<float> energyMeter { 0.0f };
+
+	double sampleRate = 44100.0;
+	int blockSize = 0;
+
+	// Silence detection; threshold sits well above the float denormal range;
+	static constexpr double silenceThreshold = 1e-20;
+	bool isIdle = false;
+
+	// Synthesised excitation;
+	static constexpr int signalPeriod = 20;
+	uint32_t idxSignal = 0;
+	float sawtooth[signalPeriod * 3];
+
+	// Internal simulation rate, and the chunk buffers it runs in, sized by prepare();
+	static constexpr int minChunk = 64;
+	static constexpr int chunkMargin = 4;		// Samples the resampler may need beyond the rate ratio;
+	double internalSampleRate = 44100.0;
+	PolyphaseResampler resamplers[maxOutputChannels];
+	RealtimeHandoff<PlayedRate> rateHandoff;
+	PlayedRate playedRate;		// Audio thread;
+	std::atomic<double> preparedSampleRate { 0.0 };		// Written by prepare(), 0 until then;
+	double sentDeviceRate = 0.0;		// Control thread;
+	double sentInternalRate = 0.0;
+	int maxOutputChunk = 1;
+	std::vector<float> input;
+	std::vector<float> output[maxOutputChannels];
+
+	// Lump-mass-spring parameters, read from params once per block;
+	double deltaT = 1.0 / 44100.0;
+	double deltaX = 0.00001;
+	double waveSpeed = 0.015;
+	double genDamp = 0.0001;
+
+	// Live input excitation;
+	LiveExcitation liveExcitation;
+
+	// MIDI voices, each distinct pitch in a lane of one batched simulation;
+	static constexpr int maxQueuedNotes = 512;
+	static constexpr int allNotesOffKey = -1;
+	MoleculeVoicePool<numVoiceLanes> voicePool;
+	QueuedNote queuedNotes[maxQueuedNotes];
+	int numQueuedNotes = 0;
+	std::vector<float> voiceOutput;
+
+	DeadlineMonitor deadlineMonitor;
+	MoleculeSnapshotPublisher snapshotPublisher;		// Unallocated until attachVisualiser();
+	std::atomic<bool> isVisualised { false };
+	BackgroundRecorder* snapshotRecorder = nullptr;
+
+	// Simulation state on the current level, indexed [time level][node];
+	int idxRotationNMOne = 0;
+	int idxRotationN = 1;
+	int idxRotationNPOne = 2;
+	std::vector<double> displacement[3];
+
+	// Level-of-detail hierarchy, level 0 being the loaded molecule;
+	static constexpr size_t maxLevels = 6;
+	static constexpr uint32_t minCoarseNodes = 8;
+	static constexpr int levelHoldBlocks = 16;
+	std::shared_ptr<const std::vector<MoleculeLevel>> levels;		// Shared with engines playing the same compile. Audio thread;
+	std::atomic<size_t> idxLevel { 0 };		// Written by the audio thread;
+	MoleculeBoundary boundary;		// Control thread;
+	uint32_t pickupCentres[maxOutputChannels];
+	float pickupSpread = 0.0f;
+
+	// The audio thread's copy of the driven atoms and pickups, swapped in whole;
+	struct PlayedBoundary
+	{
+		MoleculeBoundary boundary;		// Driven atoms and pickups; clamping is the compiler's;
+		uint32_t tapAtom = 0;			// First pickup centre, where the MIDI voices are heard;
+		BoundaryNodes nodes;			// Reserved for boundary;
+	};
+	RealtimeHandoff<PlayedBoundary> boundaryHandoff;
+	MoleculeBoundary playedBoundary;
+	uint32_t playedTapAtom = 0;
+	BoundaryNodes boundaryNodes;	// playedBoundary on the current level, rebuilt every block;
+	std::vector<double> transferScratch;
+	double smoothedLoad = 0.0;
+	int numBlocksSinceSwitch = 0;
+	static constexpr size_t tilingCacheBytes = 512 * 1024;		// Typical per-core L2;
+	TemporalTiler temporalTiler;
+
+	// A compiled molecule with the audio thread's buffers for it, swapped in whole. Goes back holding the old ones;
+	struct PlayedMolecule
+	{
+		std::unique_ptr<CompiledMolecule> compiled;
+		std::vector<uint32_t> activeAtoms;			// Sized and cleared for the molecule;
+		std::vector<uint8_t> isAtomActive;
+		std::vector<uint8_t> isAtomExpanded;
+		MoleculeVoicePool<numVoiceLanes>::Batch voiceBatch;
+		uint32_t install = 0;
+	};
+	RealtimeHandoff<PlayedMolecule> moleculeHandoff;
+	std::shared_ptr<const std::vector<MoleculeLevel>> installedLevels;		// The levels sent last, control thread;
+	uint32_t numInstalls = 0;			// Control thread;
+	uint32_t playedInstall = 0;			// Audio thread;
+
+	// Kernels for one installed molecule, shared with the control thread so only it ever frees them;
+	struct PlayedKernels
+	{
+		uint32_t install = 0;						// The molecule they were built for;
+		std::shared_ptr<const StencilKernel> tuned;		// KernelTuner's pick, or nullptr while tuning and when tiling won;
+		bool isTiled = false;
+		std::shared_ptr<const StencilJit::Library> jit;
+		std::shared_ptr<ReducedPrecisionSweep> reduced;		// Replaces the others when set. Only the audio thread runs it;
+	};
+	RealtimeHandoff<PlayedKernels> kernelHandoff;
+	PlayedKernels sentKernels;			// Control thread;
+	PlayedKernels playedKernels;		// Audio thread;
+	StencilJit stencilJit;
+	KernelTuner kernelTuner;
+	std::shared_ptr<KernelChoice> installedChoice;		// Shared with engines playing the same compile, control thread;
+	std::unique_ptr<TemporalTiler> tilingCandidate;		// For the tuner, until this engine claims the tuning;
+	bool isTuningClaimed = false;						// Control thread;
+	bool isJitEnabled = false;			// Control thread;
+	Precision precision = Precision_Double;		// Control thread;
+
+	// Structural edits, compiled in the background and installed by update();
+	const TopologyCompiler::Settings compilerSettings { maxLevels, minCoarseNodes, tilingCacheBytes };
+	std::shared_ptr<const LoadedMolecule> source;		// Shared with engines that loaded the same file;
+	std::shared_ptr<const CompiledMolecule> sharedCompiled;		// Keeps the cache's compile for others while installed;
+	EditableTopology editTopology;		// Control thread only, and empty until the first edit of a shared molecule;
+	bool isEdited = false;
+	std::atomic<uint32_t> editGeneration { 0 };
+	uint32_t compiledGeneration = UINT32_MAX;		// Of the last edit sent to the compiler, control thread only;
+	uint32_t installedGeneration = 0;				// Control thread only;
+	TopologyCompiler topologyCompiler { compilerSettings };
+
+	// Active frontier for sparse updates, indexed by node of the current level;
+	static constexpr float denseCoverage = 0.5f;
+	bool isDenseMode = false;
+	uint32_t numActiveAtoms = 0;
+	std::vector<uint32_t> activeAtoms;
+	std::vector<uint8_t> isAtomActive;
+	std::vector<uint8_t> isAtomExpanded;
+};
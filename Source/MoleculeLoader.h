@@ -0,0 +1,261 @@
+/*
+  ==============================================================================
+
+    MoleculeLoader.h
+
+    Reads a .pdb into what the engine and the editor need: bonds from the
+    CONECT records as an EditableTopology, and for display each atom's
+    coordinates and element from its ATOM or HETATM record. Atoms are
+    numbered by serial from 0, up to the highest serial any record names.
+    Files that leave bonds implicit, as the PDB does for standard residues
+    and as graphene.pdb does throughout, get bonds between atoms closer
+    than their covalent radii allow, added to whatever CONECT lists; files
+    whose CONECT records bond every atom are taken as they are. The app's
+    own .json format, a "molecule" array of atoms each with a
+    "connections" list, loads the same way without coordinates.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "MoleculeEditor.h"
+
+struct LoadedMolecule
+{
+	EditableTopology bonds;
+	std::vector<std::array<float, 3>> positions;	// Model coordinates in Ångström, zero where missing, empty if the file has none;
+	std::vector<std::array<char, 3>> elements;		// Symbol, "C" where the file has none;
+
+	uint32_t getNumAtoms() const { return bonds.getNumAtoms(); }
+};
+
+// Single-bond covalent radius in Ångström, carbon's for elements not listed;
+inline float getCovalentRadius(const std::array<char, 3>& aElement)
+{
+	static const struct { char symbol[3]; float radius; } radii[] = {
+		{ "H", 0.31f }, { "C", 0.76f }, { "N", 0.71f }, { "O", 0.66f }, { "F", 0.57f }, { "P", 1.07f }, { "S", 1.05f },
+		{ "CL", 1.02f }, { "Cl", 1.02f }, { "SE", 1.20f }, { "Se", 1.20f }, { "BR", 1.20f }, { "Br", 1.20f }, { "I", 1.39f }
+	};
+	for (const auto& r : radii)
+		if (r.symbol[0] == aElement[0] && r.symbol[1] == aElement[1])
+			return r.radius;
+	return 0.76f;
+}
+
+// Bond every pair of atoms in aAtoms closer than their covalent radii plus bondTolerance, skipping pairs already
+// bonded either way. Atoms closer than minBondLength are taken to be alternate positions of one atom. Uses a grid
+// of cells one maximum bond long, so it is linear in the number of atoms;
+inline void inferBonds(const std::vector<uint32_t>& aAtoms, const std::vector<std::array<float, 3>>& aPositions,
+					   const std::vector<std::array<char, 3>>& aElements, EditableTopology& aBonds)
+{
+	constexpr float bondTolerance = 0.4f;
+	constexpr float minBondLength = 0.4f;
+	float maxRadius = 0.0f;
+	for (uint32_t a : aAtoms)
+		maxRadius = std::max(maxRadius, getCovalentRadius(aElements[a]));
+	const float cellSize = 2.0f * maxRadius + bondTolerance;
+
+	auto getCell = [&aPositions, cellSize](uint32_t aAtom, int aAxis) { return (int64_t)std::floor(aPositions[aAtom][aAxis] / cellSize); };
+	auto getKey = [](int64_t x, int64_t y, int64_t z) { return ((x & 0x1fffff) << 42) | ((y & 0x1fffff) << 21) | (z & 0x1fffff); };
+	std::unordered_map<int64_t, std::vector<uint32_t>> cells;
+	for (uint32_t a : aAtoms)
+		cells[getKey(getCell(a, 0), getCell(a, 1), getCell(a, 2))].push_back(a);
+
+	for (uint32_t a : aAtoms)
+	{
+		const int64_t x = getCell(a, 0), y = getCell(a, 1), z = getCell(a, 2);
+		for (int64_t dx = -1; dx <= 1; ++dx)
+			for (int64_t dy = -1; dy <= 1; ++dy)
+				for (int64_t dz = -1; dz <= 1; ++dz)
+				{
+					const auto cell = cells.find(getKey(x + dx, y + dy, z + dz));
+					if (cell == cells.end())
+						continue;
+					for (uint32_t b : cell->second)
+					{
+						if (b <= a)
+							continue;
+						float distanceSquared = 0.0f;
+						for (int d = 0; d != 3; ++d)
+							distanceSquared += (aPositions[a][d] - aPositions[b][d]) * (aPositions[a][d] - aPositions[b][d]);
+						const float maxLength = getCovalentRadius(aElements[a]) + getCovalentRadius(aElements[b]) + bondTolerance;
+						if (distanceSquared < minBondLength * minBondLength || distanceSquared > maxLength * maxLength)
+							continue;
+						if (!aBonds.hasBond(b, a))
+							aBonds.addBond(a, b);
+					}
+				}
+	}
+}
+
+// Reads aPdb to the end. Returns false if it names no atoms;
+inline bool loadPdbMolecule(std::istream& aPdb, LoadedMolecule& aMolecule)
+{
+	std::vector<std::vector<uint32_t>> bonds;
+	std::vector<std::array<float, 3>> positions;
+	std::vector<std::array<char, 3>> elements;
+	std::vector<uint8_t> isPositioned;		// By atom, whether an ATOM or HETATM record gave its coordinates;
+	std::vector<uint8_t> isConnected;		// By atom, whether any CONECT record names it;
+	uint32_t numAtoms = 0;
+
+	auto markConnected = [&isConnected](uint32_t aAtom)
+	{
+		if (aAtom >= isConnected.size())
+			isConnected.resize(aAtom + 1, 0);
+		isConnected[aAtom] = 1;
+	};
+
+	std::string line;
+	while (std::getline(aPdb, line))
+	{
+		std::string record;
+		std::stringstream ss(line);
+		ss >> record;
+
+		// Fixed columns: serial 7-11, x, y and z 31-54, element 77-78, falling back on the atom name 13-16;
+		if ((record == "ATOM" || record == "HETATM") && line.size() >= 54)
+		{
+			const uint32_t serial = (uint32_t)std::atoi(line.substr(6, 5).c_str());
+			if (serial == 0)
+				continue;
+			if (serial > positions.size())
+			{
+				positions.resize(serial, { 0.0f, 0.0f, 0.0f });
+				elements.resize(serial, { 'C', 0, 0 });
+				isPositioned.resize(serial, 0);
+			}
+			numAtoms = std::max(numAtoms, serial);
+			isPositioned[serial - 1] = 1;
+
+			for (int d = 0; d != 3; ++d)
+				positions[serial - 1][d] = (float)std::atof(line.substr(30 + 8 * d, 8).c_str());
+
+			std::string element = line.size() >= 78 ? line.substr(76, 2) : std::string();
+			element.erase(std::remove(element.begin(), element.end(), ' '), element.end());
+			if (element.empty())
+			{
+				for (char c : line.substr(12, 4))
+				{
+					if (std::isalpha((unsigned char)c))
+					{
+						element = std::string(1, c);
+						break;
+					}
+				}
+			}
+			if (!element.empty())
+				elements[serial - 1] = { element[0], element.size() > 1 ? element[1] : (char)0, 0 };
+		}
+		else if (record.compare(0, 6, "CONECT") == 0)
+		{
+			// Serials fill five columns each from column 7 and may run together past 9999, so they are read by column;
+			auto getSerial = [&line](size_t aField) { return line.size() > 6 + 5 * aField ? (uint32_t)std::atoi(line.substr(6 + 5 * aField, 5).c_str()) : 0u; };
+			const uint32_t idxAtom = getSerial(0);
+			if (idxAtom == 0)
+				continue;
+			if (idxAtom > bonds.size())
+				bonds.resize(idxAtom);
+			numAtoms = std::max(numAtoms, idxAtom);
+			markConnected(idxAtom - 1);
+			for (size_t field = 1; 6 + 5 * field < line.size(); ++field)
+			{
+				const uint32_t idxBond = getSerial(field);
+				if (idxBond != 0)
+				{
+					bonds[idxAtom - 1].push_back(idxBond - 1);
+					numAtoms = std::max(numAtoms, idxBond);
+					markConnected(idxBond - 1);
+				}
+			}
+		}
+	}
+
+	aMolecule.bonds.clear();
+	for (uint32_t i = 0; i != numAtoms; ++i)
+		aMolecule.bonds.addAtom();
+	for (uint32_t i = 0; i < numAtoms && i < bonds.size(); ++i)
+	{
+		for (uint32_t j : bonds[i])
+			aMolecule.bonds.appendNeighbour(i, j);
+	}
+
+	isConnected.resize(numAtoms, 0);
+	if (!positions.empty())
+		positions.resize(numAtoms, { 0.0f, 0.0f, 0.0f });
+	elements.resize(numAtoms, { 'C', 0, 0 });
+
+	// Bonds are inferred among every positioned atom as soon as one of them is left out of the CONECT records;
+	std::vector<uint32_t> positioned;
+	bool isAnyUnconnected = false;
+	for (uint32_t i = 0; i < numAtoms && i < isPositioned.size(); ++i)
+	{
+		if (!isPositioned[i])
+			continue;
+		positioned.push_back(i);
+		isAnyUnconnected = isAnyUnconnected || !isConnected[i];
+	}
+	if (isAnyUnconnected)
+		inferBonds(positioned, positions, elements, aMolecule.bonds);
+
+	aMolecule.positions = std::move(positions);
+	aMolecule.elements = std::move(elements);
+	return numAtoms != 0;
+}
+
+// Returns false if aPath can't be read or names no atoms;
+inline bool loadPdbMolecule(const std::string& aPath, LoadedMolecule& aMolecule)
+{
+	std::ifstream flPdb(aPath);
+	return flPdb && loadPdbMolecule(flPdb, aMolecule);
+}
+
+// Returns false if aJson can't be parsed or has no atoms. Per-atom "mass" is ignored, as the kernel treats atoms as unit masses;
+inline bool loadJsonMolecule(std::istream& aJson, LoadedMolecule& aMolecule)
+{
+	const nlohmann::json jsonInput = nlohmann::json::parse(aJson, nullptr, false);
+	if (jsonInput.is_discarded() || !jsonInput.contains("molecule") || !jsonInput["molecule"].is_array())
+		return false;
+
+	const nlohmann::json& atoms = jsonInput["molecule"];
+	const uint32_t numAtoms = (uint32_t)atoms.size();
+	aMolecule.bonds.clear();
+	for (uint32_t i = 0; i != numAtoms; ++i)
+		aMolecule.bonds.addAtom();
+	for (uint32_t i = 0; i != numAtoms; ++i)
+	{
+		if (!atoms[i].contains("connections"))
+			continue;
+		for (const auto& connection : atoms[i]["connections"])
+		{
+			if (connection.is_number_unsigned())
+				aMolecule.bonds.appendNeighbour(i, connection.get<uint32_t>());
+		}
+	}
+
+	aMolecule.positions.clear();
+	aMolecule.elements.assign(numAtoms, { 'C', 0, 0 });
+	return numAtoms != 0;
+}
+
+// Returns false if aPath can't be read or parsed, or has no atoms;
+inline bool loadJsonMolecule(const std::string& aPath, LoadedMolecule& aMolecule)
+{
+	std::ifstream flJson(aPath);
+	return flJson && loadJsonMolecule(flJson, aMolecule);
+}
@@ -0,0 +1,139 @@
+/*
+  ==============================================================================
+
+    MoleculeOrdering.h
+
+    Bandwidth-reducing node order for the loaded molecule. Cuthill-McKee
+    numbers nodes breadth first from the clamped ones, so bonded atoms end
+    up close in memory. Every bond then stays within a narrow band of node
+    indices, which is what lets TemporalTiler treat the molecule like a 1D
+    stencil.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "MoleculeTopology.h"
+
+// New index of every node. aLeading nodes are numbered first, in order, and the search starts from them, which puts
+// clamped atoms in front of the free range;
+inline std::vector<uint32_t> cuthillMcKeeOrder(const MoleculeTopology& aTopology, const std::vector<uint32_t>& aLeading)
+{
+	const uint32_t numNodes = aTopology.numNodes;
+	const uint32_t unnumbered = UINT32_MAX;
+	auto getDegree = [&aTopology](uint32_t i) { return aTopology.rowStart[i + 1] - aTopology.rowStart[i]; };
+
+	std::vector<uint32_t> newIndex(numNodes, unnumbered);
+	std::vector<uint32_t> queue;
+	queue.reserve(numNodes);
+	for (uint32_t i : aLeading)
+	{
+		if (i < numNodes && newIndex[i] == unnumbered)
+		{
+			newIndex[i] = (uint32_t)queue.size();
+			queue.push_back(i);
+		}
+	}
+
+	// Components the leading nodes don't reach start from their lowest-degree node;
+	std::vector<uint32_t> roots(numNodes);
+	for (uint32_t i = 0; i != numNodes; ++i)
+		roots[i] = i;
+	std::stable_sort(roots.begin(), roots.end(), [&getDegree](uint32_t a, uint32_t b) { return getDegree(a) < getDegree(b); });
+
+	std::vector<uint32_t> children;
+	size_t idxRoot = 0;
+	for (size_t head = 0; ; ++head)
+	{
+		if (head == queue.size())
+		{
+			while (idxRoot != roots.size() && newIndex[roots[idxRoot]] != unnumbered)
+				++idxRoot;
+			if (idxRoot == roots.size())
+				break;
+			newIndex[roots[idxRoot]] = (uint32_t)queue.size();
+			queue.push_back(roots[idxRoot]);
+		}
+
+		const uint32_t i = queue[head];
+		children.clear();
+		for (uint32_t e = aTopology.rowStart[i]; e != aTopology.rowStart[i + 1]; ++e)
+		{
+			const uint32_t j = aTopology.neighbours[e];
+			if (newIndex[j] == unnumbered)
+			{
+				newIndex[j] = 0;		// Claimed, numbered below;
+				children.push_back(j);
+			}
+		}
+
+		std::stable_sort(children.begin(), children.end(), [&getDegree](uint32_t a, uint32_t b) { return getDegree(a) < getDegree(b); });
+		for (uint32_t j : children)
+		{
+			newIndex[j] = (uint32_t)queue.size();
+			queue.push_back(j);
+		}
+	}
+	return newIndex;
+}
+
+// As above with node 0, the default frozen boundary, kept as node 0;
+inline std::vector<uint32_t> cuthillMcKeeOrder(const MoleculeTopology& aTopology)
+{
+	return cuthillMcKeeOrder(aTopology, std::vector<uint32_t>(aTopology.numNodes > 0 ? 1 : 0, 0));
+}
+
+// aTopology with node i renumbered aNewIndex[i]. Rows keep their neighbours in ascending order. numClamped is kept, so
+// aNewIndex must leave the clamped nodes in front;
+inline MoleculeTopology permuteTopology(const MoleculeTopology& aTopology, const std::vector<uint32_t>& aNewIndex)
+{
+	const uint32_t numNodes = aTopology.numNodes;
+	std::vector<uint32_t> oldIndex(numNodes);
+	for (uint32_t i = 0; i != numNodes; ++i)
+		oldIndex[aNewIndex[i]] = i;
+
+	MoleculeTopology permuted;
+	permuted.clear();
+	permuted.numNodes = numNodes;
+	permuted.numClamped = aTopology.numClamped;
+	permuted.mass.resize(numNodes);
+	std::vector<std::pair<uint32_t, float>> row;
+	for (uint32_t r = 0; r != numNodes; ++r)
+	{
+		const uint32_t i = oldIndex[r];
+		row.clear();
+		for (uint32_t e = aTopology.rowStart[i]; e != aTopology.rowStart[i + 1]; ++e)
+			row.emplace_back(aNewIndex[aTopology.neighbours[e]], aTopology.stiffness[e]);
+		std::sort(row.begin(), row.end(), [](const std::pair<uint32_t, float>& a, const std::pair<uint32_t, float>& b) { return a.first < b.first; });
+
+		for (const auto& bond : row)
+		{
+			permuted.neighbours.push_back(bond.first);
+			permuted.stiffness.push_back(bond.second);
+		}
+		permuted.rowStart.push_back((uint32_t)permuted.neighbours.size());
+		permuted.mass[r] = aTopology.mass[i];
+	}
+	permuted.finalise();
+	return permuted;
+}
+
+// Largest index distance spanned by a bond;
+inline uint32_t getBandwidth(const MoleculeTopology& aTopology)
+{
+	uint32_t bandwidth = 0;
+	for (uint32_t i = 0; i != aTopology.numNodes; ++i)
+	{
+		for (uint32_t e = aTopology.rowStart[i]; e != aTopology.rowStart[i + 1]; ++e)
+		{
+			const uint32_t j = aTopology.neighbours[e];
+			bandwidth = std::max(bandwidth, j > i ? j - i : i - j);
+		}
+	}
+	return bandwidth;
+}
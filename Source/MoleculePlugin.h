@@ -0,0 +1,279 @@
+/*
+  ==============================================================================
+
+    MoleculePlugin.h
+
+    The synthesiser as an audio plugin: a MoleculeEngine behind host
+    parameters, played by MIDI or the gate, with live input on the input
+    bus. The host's generic editor shows the parameters. Instances that play
+    the same molecule share it through MoleculeCache, so each one only adds
+    its state buffers, and loading another instance of a molecule already
+    playing skips reading and compiling it.
+
+    MolecularSynthesisPlugin.jucer builds this as VST3 and LV2 with the
+    bundled molecules in BinaryData (MOLSYNTH_EMBEDDED_MOLECULES). Without
+    them, as in the app's --instances host (InstanceBenchmark.h), molecules
+    are read from Source/resources relative to the working directory.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <string>
+
+#include "MoleculeEngine.h"
+
+#ifndef MOLSYNTH_EMBEDDED_MOLECULES
+ #define MOLSYNTH_EMBEDDED_MOLECULES 0
+#endif
+
+class MoleculePlugin : public juce::AudioProcessor,
+					   private juce::Timer
+{
+public:
+	// The bundled molecules, in the order of the Molecule parameter;
+	static juce::StringArray getBundledMolecules()
+	{
+		return { "graphene_with_bonds.pdb", "buckyball.pdb", "nanotube.pdb", "helicene.pdb", "1gwd.pdb" };
+	}
+
+	MoleculePlugin()
+		: AudioProcessor(BusesProperties().withInput("Input", juce::AudioChannelSet::stereo(), true)
+										  .withOutput("Output", juce::AudioChannelSet::stereo(), true))
+	{
+		addParameter(molecule = new juce::AudioParameterChoice("molecule", "Molecule", getBundledMolecules(), 0));
+		addParameter(excitation = new juce::AudioParameterChoice("excitation", "Excitation", { "Impulse", "Sin", "Saw", "Live Input" }, 0));
+		addParameter(gate = new juce::AudioParameterBool("gate", "Excite", false));
+		addParameter(midiAtoms = new juce::AudioParameterBool("midiAtoms", "MIDI notes select atoms", false));
+		addParameter(precision = new juce::AudioParameterChoice("precision", "Precision", { "Double", "Float, to compare", "Float with double sum, to compare" }, 0));
+
+		// Slider values as the app shows them; speed and damping are squared on their way to the engine;
+		addParameter(waveSpeed = new juce::AudioParameterFloat("waveSpeed", "Wave Speed", { 0.000001f, 1.0f }, std::sqrt(0.015f)));
+		addParameter(damping = new juce::AudioParameterFloat("damping", "Gen Damping", { 0.0f, 2.0f }, 0.01f));
+		addParameter(internalRate = new juce::AudioParameterFloat("internalRate", "Internal Rate",
+																  { (float)MoleculeEngine::minInternalRate, (float)MoleculeEngine::maxInternalRate, 100.0f }, 44100.0f));
+		addParameter(cpuBudget = new juce::AudioParameterFloat("cpuBudget", "CPU Budget", { 0.05f, 1.0f, 0.01f }, 0.5f));
+		addParameter(inputGain = new juce::AudioParameterFloat("inputGain", "Input Gain", { 0.0f, 4.0f, 0.01f }, 1.0f));
+		addParameter(inputCutoff = new juce::AudioParameterFloat("inputCutoff", "Input Lowpass", { 20.0f, 24000.0f, 1.0f }, 24000.0f));
+
+		// Atoms out of range for the molecule playing are ignored by the engine;
+		addParameter(inputAtom = new juce::AudioParameterInt("inputAtom", "Input Pos", 0, maxAtomParameter, 14));
+		addParameter(pickupLeft = new juce::AudioParameterInt("pickupLeft", "Output Pos L", 0, maxAtomParameter, 34));
+		addParameter(pickupRight = new juce::AudioParameterInt("pickupRight", "Output Pos R", 0, maxAtomParameter, 34));
+		addParameter(pickupSpread = new juce::AudioParameterFloat("pickupSpread", "Pickup Spread", { 0.0f, 4.0f, 0.1f }, 0.0f));
+
+		// The app's record of the fastest kernel layout per molecule and machine. Instances playing the same molecule
+		// also share the layout in memory, so only the first one tunes;
+		auto flKernelCache = juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory).getChildFile("MolecularSynthesis").getChildFile("kernel_cache.json");
+		flKernelCache.getParentDirectory().createDirectory();
+		engine.setKernelCache(flKernelCache.getFullPathName().toStdString(), juce::SystemStats::getCpuModel().toStdString());
+
+		// The Molecule parameter is loaded on the first tick, after the host has restored its state or a caller has
+		// loaded a file of its own, so neither pays for loading the default first;
+		startTimerHz(30);
+	}
+
+	~MoleculePlugin() override
+	{
+		stopTimer();
+	}
+
+	// Load a molecule that isn't bundled, such as a .pdb named on the command line. It plays until the Molecule
+	// parameter next changes. Message thread;
+	bool loadMoleculeFile(const std::string& aPath)
+	{
+		loadedMolecule = molecule->getIndex();
+		return engine.load(aPath);
+	}
+
+	MoleculeEngine& getEngine() { return engine; }
+
+	//==============================================================================
+	void prepareToPlay(double aSampleRate, int aMaximumBlockSize) override
+	{
+		engine.prepare(aSampleRate, aMaximumBlockSize);
+	}
+
+	void releaseResources() override {}
+
+	bool isBusesLayoutSupported(const BusesLayout& aLayouts) const override
+	{
+		const auto& output = aLayouts.getMainOutputChannelSet();
+		if (output.isDisabled() || output.size() > MoleculeEngine::maxOutputChannels)
+			return false;
+		return aLayouts.getMainInputChannelSet().isDisabled() || aLayouts.getMainInputChannelSet().size() <= output.size();
+	}
+
+	void processBlock(juce::AudioBuffer<float>& aBuffer, juce::MidiBuffer& aMidi) override
+	{
+		TRACE_THREAD("Audio");
+		juce::ScopedNoDenormals noDenormals;
+
+		engine.setParam(MoleculeEngine::Param_WaveSpeed, (double)waveSpeed->get() * waveSpeed->get());
+		engine.setParam(MoleculeEngine::Param_Damping, (double)damping->get() * damping->get());
+		engine.setParam(MoleculeEngine::Param_InternalRate, internalRate->get());
+		engine.setParam(MoleculeEngine::Param_CpuBudget, cpuBudget->get());
+		engine.setParam(MoleculeEngine::Param_InputGain, inputGain->get());
+		engine.setParam(MoleculeEngine::Param_InputCutoff, inputCutoff->get());
+		engine.setExcitation((MoleculeEngine::Excitation)excitation->getIndex());
+		engine.setMidiKeysSelectAtoms(midiAtoms->get());
+
+		// Opening the gate strikes the molecule when the excitation is an impulse, as a click does in the app;
+		const bool isGateOpen = gate->get();
+		if (isGateOpen && !wasGateOpen && excitation->getIndex() == MoleculeEngine::Excitation_Impulse)
+			engine.strike();
+		engine.setGate(isGateOpen);
+		wasGateOpen = isGateOpen;
+
+		for (const auto metadata : aMidi)
+		{
+			const auto message = metadata.getMessage();
+			if (message.isNoteOn())
+				engine.queueNote(message.getNoteNumber(), message.getFloatVelocity(), metadata.samplePosition);
+			else if (message.isNoteOff())
+				engine.queueNote(message.getNoteNumber(), 0.0f, metadata.samplePosition);
+			else if (message.isAllNotesOff() || message.isAllSoundOff())
+				engine.queueAllNotesOff();
+		}
+
+		// Live input is read from the first channel, which the input bus shares with the first output;
+		const int numChannels = getTotalNumOutputChannels();
+		engine.process(aBuffer.getArrayOfWritePointers(), numChannels, aBuffer.getNumSamples());
+		for (int c = numChannels; c < aBuffer.getNumChannels(); ++c)
+			aBuffer.clear(c, 0, aBuffer.getNumSamples());
+	}
+
+	//==============================================================================
+	juce::AudioProcessorEditor* createEditor() override { return new juce::GenericAudioProcessorEditor(*this); }
+	bool hasEditor() const override { return true; }
+
+	const juce::String getName() const override { return "MolecularSynthesis"; }
+	bool acceptsMidi() const override { return true; }
+	bool producesMidi() const override { return false; }
+	double getTailLengthSeconds() const override { return 2.0; }
+
+	int getNumPrograms() override { return 1; }
+	int getCurrentProgram() override { return 0; }
+	void setCurrentProgram(int) override {}
+	const juce::String getProgramName(int) override { return {}; }
+	void changeProgramName(int, const juce::String&) override {}
+
+	// Parameters by ID, normalised;
+	void getStateInformation(juce::MemoryBlock& aDestData) override
+	{
+		juce::XmlElement state("MolecularSynthesis");
+		for (auto* parameter : getParameters())
+			if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(parameter))
+				state.setAttribute(ranged->paramID, ranged->getValue());
+		copyXmlToBinary(state, aDestData);
+	}
+
+	void setStateInformation(const void* aData, int aSizeInBytes) override
+	{
+		const std::unique_ptr<juce::XmlElement> state = getXmlFromBinary(aData, aSizeInBytes);
+		if (state == nullptr || !state->hasTagName("MolecularSynthesis"))
+			return;
+
+		for (auto* parameter : getParameters())
+			if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(parameter))
+				if (state->hasAttribute(ranged->paramID))
+					ranged->setValueNotifyingHost((float)state->getDoubleAttribute(ranged->paramID));
+	}
+
+private:
+	static constexpr int maxAtomParameter = 65535;
+
+	// Loads, atom choices and edits the engine takes on its control thread, which is the message thread here;
+	void timerCallback() override
+	{
+		updateControls();
+	}
+
+	void updateControls()
+	{
+		if (molecule->getIndex() != loadedMolecule)
+		{
+			loadedMolecule = molecule->getIndex();
+			loadBundledMolecule(getBundledMolecules()[loadedMolecule]);
+		}
+
+		const uint32_t driven = (uint32_t)inputAtom->get();
+		if (driven != drivenAtom)
+		{
+			drivenAtom = driven;
+			engine.setDrivenAtoms({ { drivenAtom, 1.0f } });
+		}
+
+		const uint32_t centres[2] = { (uint32_t)pickupLeft->get(), (uint32_t)pickupRight->get() };
+		if (centres[0] != pickupCentres[0] || centres[1] != pickupCentres[1])
+		{
+			pickupCentres[0] = centres[0];
+			pickupCentres[1] = centres[1];
+			engine.setPickupCentres(pickupCentres[0], pickupCentres[1]);
+		}
+
+		if (precision->getIndex() != enginePrecision)
+		{
+			enginePrecision = precision->getIndex();
+			engine.setPrecision((MoleculeEngine::Precision)enginePrecision);
+		}
+
+		if (pickupSpread->get() != spread)
+		{
+			spread = pickupSpread->get();
+			engine.setPickupSpread(spread);
+		}
+
+		engine.update();
+	}
+
+	void loadBundledMolecule(const juce::String& aFileName)
+	{
+#if MOLSYNTH_EMBEDDED_MOLECULES
+		for (int r = 0; r != BinaryData::namedResourceListSize; ++r)
+		{
+			if (aFileName == BinaryData::getNamedResourceOriginalFilename(BinaryData::namedResourceList[r]))
+			{
+				int size = 0;
+				const char* data = BinaryData::getNamedResource(BinaryData::namedResourceList[r], size);
+				engine.loadPdbData(aFileName.toStdString(), data, (size_t)size);
+				return;
+			}
+		}
+#else
+		engine.load(juce::File::getCurrentWorkingDirectory().getChildFile("../../Source/resources").getChildFile(aFileName).getFullPathName().toStdString());
+#endif
+	}
+
+	MoleculeEngine engine;
+
+	juce::AudioParameterChoice* molecule = nullptr;
+	juce::AudioParameterChoice* excitation = nullptr;
+	juce::AudioParameterBool* gate = nullptr;
+	juce::AudioParameterBool* midiAtoms = nullptr;
+	juce::AudioParameterChoice* precision = nullptr;
+	juce::AudioParameterFloat* waveSpeed = nullptr;
+	juce::AudioParameterFloat* damping = nullptr;
+	juce::AudioParameterFloat* internalRate = nullptr;
+	juce::AudioParameterFloat* cpuBudget = nullptr;
+	juce::AudioParameterFloat* inputGain = nullptr;
+	juce::AudioParameterFloat* inputCutoff = nullptr;
+	juce::AudioParameterInt* inputAtom = nullptr;
+	juce::AudioParameterInt* pickupLeft = nullptr;
+	juce::AudioParameterInt* pickupRight = nullptr;
+	juce::AudioParameterFloat* pickupSpread = nullptr;
+
+	// What the engine was last given, message thread only;
+	int loadedMolecule = -1;
+	uint32_t drivenAtom = UINT32_MAX;
+	uint32_t pickupCentres[2] = { UINT32_MAX, UINT32_MAX };
+	float spread = -1.0f;
+	int enginePrecision = MoleculeEngine::Precision_Double;
+
+	bool wasGateOpen = false;		// Audio thread only;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MoleculePlugin)
+};
@@ -0,0 +1,334 @@
+/*
+  ==============================================================================
+
+    MoleculeRenderer.h
+
+    Draws the molecule from its model coordinates and the latest
+    MoleculeSnapshot. The projection is worked out once per molecule and
+    view size: an orthographic view onto the two axes of largest extent,
+    fitted to the view, with the third giving depth order and shading.
+    Bonds don't move while drawn, so they are rendered once into an image.
+    Atoms are blitted from sprites cached per colour and size, far ones
+    first, each offset vertically by its displacement. update() returns
+    only the area covered by atoms that moved a pixel since the last
+    frame, and paint() skips atoms outside the clip, so a quiet molecule
+    costs almost nothing to animate. Message thread only.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "MoleculeSnapshot.h"
+
+class MoleculeRenderer
+{
+public:
+	enum Role
+	{
+		Role_Free,
+		Role_Driven,
+		Role_Pickup,
+		Role_Clamped
+	};
+
+	static constexpr int numDepthShades = 4;
+
+	// An atom in model space, in Ångström;
+	struct RenderAtom
+	{
+		float x, y, z;
+		juce::Colour colour;
+	};
+
+	typedef std::pair<uint32_t, uint32_t> Bond;
+
+	// CPK colours for the common elements;
+	static juce::Colour getElementColour(const char* aElement)
+	{
+		switch (std::toupper((unsigned char)aElement[0]))
+		{
+			case 'H': return juce::Colour(0xffe8e8e8);
+			case 'C': return juce::Colour(0xff909090);
+			case 'N': return juce::Colour(0xff3050f8);
+			case 'O': return juce::Colour(0xffff0d0d);
+			case 'S': return juce::Colour(0xffffff30);
+			case 'P': return juce::Colour(0xffff8000);
+			default:  return juce::Colour(0xffff1493);
+		}
+	}
+
+	void setMolecule(std::vector<RenderAtom> aAtoms, std::vector<Bond> aBonds)
+	{
+		atoms = std::move(aAtoms);
+		bonds = std::move(aBonds);
+		roles.assign(atoms.size(), Role_Free);
+		project();
+	}
+
+	void setBounds(juce::Rectangle<int> aBounds)
+	{
+		bounds = aBounds;
+		project();
+	}
+
+	juce::Rectangle<int> getBounds() const { return bounds; }
+
+	// Per atom; atoms past the end are free. Returns the area to repaint, empty if nothing changed;
+	juce::Rectangle<int> setRoles(const std::vector<Role>& aRoles)
+	{
+		juce::Rectangle<int> dirty;
+		for (size_t a = 0; a != atoms.size(); ++a)
+		{
+			const Role role = a < aRoles.size() ? aRoles[a] : Role_Free;
+			if (role != roles[a])
+			{
+				roles[a] = role;
+				spriteOfAtom[a] = getSprite(getAtomColour(a), diameter);
+				dirty = dirty.getUnion(getAtomArea(a, offsets[a]));
+			}
+		}
+		return dirty;
+	}
+
+	// Screen position of aAtom's centre at rest;
+	juce::Point<float> getScreenPosition(uint32_t aAtom) const
+	{
+		return aAtom < screen.size() ? screen[aAtom].toFloat() + juce::Point<float>(0.5f * diameter, 0.5f * diameter) : juce::Point<float>();
+	}
+
+	// The model-space point at mid depth that projects to aPosition;
+	RenderAtom getModelPosition(juce::Point<float> aPosition, juce::Colour aColour) const
+	{
+		float model[3];
+		model[axisU] = centreU + (aPosition.x - screenCentre.x) / scale;
+		model[axisV] = centreV - (aPosition.y - screenCentre.y) / scale;
+		model[axisDepth] = 0.5f * (minDepth + maxDepth);
+		return { model[0], model[1], model[2], aColour };
+	}
+
+	// Take each atom's displacement from aSnapshot. Returns the area covered by atoms that moved, before and after;
+	juce::Rectangle<int> update(const MoleculeSnapshot& aSnapshot)
+	{
+		// Offsets follow the peak up at once and back down slowly, so a decaying molecule is seen to decay;
+		peakHold = std::max(aSnapshot.peak, peakHold * peakDecayPerFrame);
+		const float gain = peakHold > 0.0f ? maxOffsetDiameters * diameter / peakHold : 0.0f;
+
+		juce::Rectangle<int> dirty;
+		for (size_t a = 0; a != atoms.size(); ++a)
+		{
+			const float displacement = a < aSnapshot.numAtoms ? aSnapshot.getDisplacement((uint32_t)a) : 0.0f;
+			const int offset = juce::roundToInt(-displacement * gain);
+			if (offset != offsets[a])
+			{
+				dirty = dirty.getUnion(getAtomArea(a, offsets[a]).getUnion(getAtomArea(a, offset)));
+				offsets[a] = offset;
+			}
+		}
+		return dirty;
+	}
+
+	void paint(juce::Graphics& g) const
+	{
+		const juce::Rectangle<int> clip = g.getClipBounds();
+		if (!clip.intersects(bounds))
+			return;
+
+		g.drawImageAt(bondImage, bounds.getX(), bounds.getY());
+		for (uint32_t a : drawOrder)
+		{
+			const juce::Point<int> position = screen[a].translated(0, offsets[a]);
+			if (clip.intersects(juce::Rectangle<int>(position.x, position.y, diameter, diameter)))
+				g.drawImageAt(sprites[spriteOfAtom[a]], position.x, position.y);
+		}
+	}
+
+private:
+	static constexpr float marginDiameters = 2.0f;
+	static constexpr float maxOffsetDiameters = 1.5f;		// Offset of the largest displacement;
+	static constexpr float peakDecayPerFrame = 0.97f;
+
+	// Fit the two axes of largest extent to bounds, and redraw the bonds and choose sprites to match;
+	void project()
+	{
+		const size_t numAtoms = atoms.size();
+		screen.assign(numAtoms, {});
+		offsets.assign(numAtoms, 0);
+		spriteOfAtom.assign(numAtoms, 0);
+		drawOrder.resize(numAtoms);
+		if (numAtoms == 0 || bounds.isEmpty())
+		{
+			bondImage = juce::Image();
+			return;
+		}
+
+		float minimum[3] = { atoms[0].x, atoms[0].y, atoms[0].z };
+		float maximum[3] = { atoms[0].x, atoms[0].y, atoms[0].z };
+		for (const auto& atom : atoms)
+		{
+			const float model[3] = { atom.x, atom.y, atom.z };
+			for (int d = 0; d != 3; ++d)
+			{
+				minimum[d] = std::min(minimum[d], model[d]);
+				maximum[d] = std::max(maximum[d], model[d]);
+			}
+		}
+
+		std::array<int, 3> axes = { 0, 1, 2 };
+		std::sort(axes.begin(), axes.end(), [&](int l, int r) { return maximum[l] - minimum[l] > maximum[r] - minimum[r]; });
+		axisU = axes[0];
+		axisV = axes[1];
+		axisDepth = axes[2];
+		centreU = 0.5f * (minimum[axisU] + maximum[axisU]);
+		centreV = 0.5f * (minimum[axisV] + maximum[axisV]);
+		minDepth = minimum[axisDepth];
+		maxDepth = maximum[axisDepth];
+		screenCentre = bounds.getCentre().toFloat();
+
+		// Atoms are sized from the median bond length, so the margin depends on the scale it is fitted with;
+		const float spanU = std::max(maximum[axisU] - minimum[axisU], 1.0e-3f);
+		const float spanV = std::max(maximum[axisV] - minimum[axisV], 1.0e-3f);
+		const float bondLength = getMedianBondLength();
+		scale = 1.0f;
+		for (int pass = 0; pass != 2; ++pass)
+		{
+			diameter = juce::jlimit(3, 24, juce::roundToInt(0.5f * bondLength * scale));
+			const float margin = marginDiameters * diameter;
+			scale = std::min((bounds.getWidth() - 2.0f * margin) / spanU, (bounds.getHeight() - 2.0f * margin) / spanV);
+			scale = std::max(scale, 1.0e-3f);
+		}
+
+		std::vector<float> depth(numAtoms);
+		for (size_t a = 0; a != numAtoms; ++a)
+		{
+			const float model[3] = { atoms[a].x, atoms[a].y, atoms[a].z };
+			const float x = screenCentre.x + (model[axisU] - centreU) * scale;
+			const float y = screenCentre.y - (model[axisV] - centreV) * scale;
+			screen[a] = juce::Point<int>(juce::roundToInt(x - 0.5f * diameter), juce::roundToInt(y - 0.5f * diameter));
+			depth[a] = model[axisDepth];
+			spriteOfAtom[a] = getSprite(getAtomColour(a), diameter);
+		}
+
+		// Farthest first, so nearer atoms are drawn over them;
+		std::iota(drawOrder.begin(), drawOrder.end(), 0u);
+		std::stable_sort(drawOrder.begin(), drawOrder.end(), [&depth](uint32_t l, uint32_t r) { return depth[l] < depth[r]; });
+
+		drawBonds();
+	}
+
+	float getMedianBondLength() const
+	{
+		std::vector<float> lengths;
+		lengths.reserve(bonds.size());
+		for (const auto& bond : bonds)
+		{
+			if (bond.first < atoms.size() && bond.second < atoms.size())
+			{
+				const RenderAtom& p = atoms[bond.first];
+				const RenderAtom& q = atoms[bond.second];
+				lengths.push_back(std::sqrt((p.x - q.x) * (p.x - q.x) + (p.y - q.y) * (p.y - q.y) + (p.z - q.z) * (p.z - q.z)));
+			}
+		}
+		if (lengths.empty())
+			return 1.5f;		// About a carbon-carbon bond;
+
+		std::nth_element(lengths.begin(), lengths.begin() + lengths.size() / 2, lengths.end());
+		return std::max(lengths[lengths.size() / 2], 0.1f);
+	}
+
+	void drawBonds()
+	{
+		bondImage = juce::Image(juce::Image::ARGB, bounds.getWidth(), bounds.getHeight(), true);
+		juce::Graphics g(bondImage);
+		g.setColour(juce::Colours::grey.withAlpha(0.6f));
+
+		const juce::Point<float> origin = bounds.getPosition().toFloat();
+		const float thickness = std::max(1.0f, 0.15f * diameter);
+		for (const auto& bond : bonds)
+		{
+			if (bond.first < atoms.size() && bond.second < atoms.size())
+			{
+				const juce::Point<float> p = getScreenPosition(bond.first) - origin;
+				const juce::Point<float> q = getScreenPosition(bond.second) - origin;
+				g.drawLine(p.x, p.y, q.x, q.y, thickness);
+			}
+		}
+	}
+
+	// Role colours as the editor has always used them, otherwise the element's, darkened with depth;
+	juce::Colour getAtomColour(size_t aAtom) const
+	{
+		switch (roles[aAtom])
+		{
+			case Role_Driven:  return juce::Colour(0, 255, 0);
+			case Role_Pickup:  return juce::Colour(255, 0, 0);
+			case Role_Clamped: return juce::Colour(0xff4060a0);
+			default: break;
+		}
+
+		const float depthRange = maxDepth - minDepth;
+		const float model[3] = { atoms[aAtom].x, atoms[aAtom].y, atoms[aAtom].z };
+		const int shade = depthRange > 0.0f ? juce::roundToInt((model[axisDepth] - minDepth) / depthRange * (numDepthShades - 1)) : numDepthShades - 1;
+		return atoms[aAtom].colour.darker(0.5f * (numDepthShades - 1 - shade) / (numDepthShades - 1));
+	}
+
+	// Index of the cached sprite for aColour at aDiameter, drawing it the first time;
+	uint32_t getSprite(juce::Colour aColour, int aDiameter)
+	{
+		const uint64_t key = ((uint64_t)aColour.getARGB() << 8) | (uint64_t)aDiameter;
+		const auto found = spriteOfKey.find(key);
+		if (found != spriteOfKey.end())
+			return found->second;
+
+		juce::Image sprite(juce::Image::ARGB, aDiameter, aDiameter, true);
+		juce::Graphics g(sprite);
+		const float radius = 0.5f * aDiameter;
+		g.setGradientFill(juce::ColourGradient(aColour.brighter(0.6f), 0.7f * radius, 0.7f * radius, aColour.darker(0.4f), radius, 2.0f * radius, true));
+		g.fillEllipse(0.0f, 0.0f, (float)aDiameter, (float)aDiameter);
+
+		sprites.push_back(sprite);
+		spriteOfKey[key] = (uint32_t)(sprites.size() - 1);
+		return (uint32_t)(sprites.size() - 1);
+	}
+
+	juce::Rectangle<int> getAtomArea(size_t aAtom, int aOffset) const
+	{
+		return juce::Rectangle<int>(screen[aAtom].x, screen[aAtom].y + aOffset, diameter, diameter);
+	}
+
+	std::vector<RenderAtom> atoms;
+	std::vector<Bond> bonds;
+	std::vector<Role> roles;
+	juce::Rectangle<int> bounds;
+
+	// Projection;
+	int axisU = 0, axisV = 1, axisDepth = 2;
+	float centreU = 0.0f, centreV = 0.0f;
+	float minDepth = 0.0f, maxDepth = 0.0f;
+	float scale = 1.0f;
+	juce::Point<float> screenCentre;
+	int diameter = 8;
+
+	// Per atom: sprite top-left at rest, vertical offset drawn, sprite, and atoms far to near;
+	std::vector<juce::Point<int>> screen;
+	std::vector<int> offsets;
+	std::vector<uint32_t> spriteOfAtom;
+	std::vector<uint32_t> drawOrder;
+
+	juce::Image bondImage;
+	std::vector<juce::Image> sprites;
+	std::map<uint64_t, uint32_t> spriteOfKey;
+	float peakHold = 0.0f;
+};
@@ -0,0 +1,145 @@
+/*
+  ==============================================================================
+
+    MoleculeSnapshot.h
+
+    Per-atom displacement and output level handed from the audio thread to
+    the GUI. The audio thread fills a compact frame a couple of times per
+    display frame and publishes it through a triple buffer. The GUI picks
+    up the newest frame whenever it paints. Neither side waits for or
+    copies from the other: publishing and picking up are one atomic
+    exchange each, and all three frames are allocated once, when a
+    visualiser attaches and before the audio thread publishes into them, so
+    nothing tears and paint never slows the audio path.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// One writer and one reader, each always holding a frame of its own. The third, the middle, carries the newest
+// published frame between them;
+template <typename Frame>
+class TripleBuffer
+{
+public:
+	// Call before either side starts;
+	template <typename Function>
+	void forEachFrame(Function aFunction)
+	{
+		for (auto& f : frames)
+			aFunction(f);
+	}
+
+	// Writer only;
+	Frame& getWriteFrame() { return frames[idxWrite]; }
+
+	// Writer only. Hands the write frame over and takes back the middle one;
+	void publish() { idxWrite = middle.exchange(idxWrite | freshBit, std::memory_order_acq_rel) & indexMask; }
+
+	// Reader only. Takes the newest frame if one was published since the last call. Returns true if it did;
+	bool update()
+	{
+		if ((middle.load(std::memory_order_relaxed) & freshBit) == 0)
+			return false;
+		idxRead = middle.exchange(idxRead, std::memory_order_acq_rel) & indexMask;
+		return true;
+	}
+
+	// Reader only;
+	const Frame& getReadFrame() const { return frames[idxRead]; }
+
+private:
+	static constexpr int indexMask = 3;
+	static constexpr int freshBit = 4;
+
+	Frame frames[3];
+	int idxWrite = 0;
+	int idxRead = 1;
+	std::atomic<int> middle { 2 };
+};
+
+struct MoleculeSnapshot
+{
+	std::vector<float> displacement;	// Every atomStride-th loaded atom; the first getNumValues() are valid;
+	uint32_t numAtoms = 0;
+	uint32_t atomStride = 1;			// Above 1 when the molecule has more atoms than the frame holds;
+	float peak = 0.0f;					// Largest absolute displacement;
+	float rms = 0.0f;					// Of the first output channel since the previous snapshot;
+	uint64_t sampleTime = 0;			// Device samples rendered when taken;
+
+	uint32_t getNumValues() const { return (numAtoms + atomStride - 1) / atomStride; }
+
+	// Of atom aAtom, below numAtoms, or of the atom sampled in its place;
+	float getDisplacement(uint32_t aAtom) const { return displacement[aAtom / atomStride]; }
+};
+
+// The audio side's decimation and level metering in front of a TripleBuffer of snapshots;
+class MoleculeSnapshotPublisher
+{
+public:
+	// Allocates every frame for up to aMaxAtoms atoms. Call before push() is first called;
+	void prepare(uint32_t aMaxAtoms)
+	{
+		buffer.forEachFrame([aMaxAtoms](MoleculeSnapshot& aFrame) { aFrame.displacement.assign(aMaxAtoms, 0.0f); });
+	}
+
+	// Snapshots are taken every 1 / aFramesPerSecond seconds of audio. Doesn't allocate;
+	void setRate(double aSampleRate, double aFramesPerSecond)
+	{
+		snapshotInterval = std::max(1, (int)(aSampleRate / aFramesPerSecond));
+	}
+
+	// Meter aNumSamples of aOutput and, when a snapshot is due, gather each atom's displacement from
+	// aNodeDisplacement through aAtomToNode and publish it. A molecule with more atoms than the frames hold is
+	// sampled at an even stride rather than cut short. Audio thread;
+	void push(const float* aOutput, int aNumSamples, const double* aNodeDisplacement, const std::vector<uint32_t>& aAtomToNode)
+	{
+		for (int n = 0; n != aNumSamples; ++n)
+			sumSquares += (double)aOutput[n] * aOutput[n];
+		numMetered += aNumSamples;
+		sampleTime += (uint64_t)aNumSamples;
+		if (numMetered < snapshotInterval)
+			return;
+
+		MoleculeSnapshot& frame = buffer.getWriteFrame();
+		const uint32_t capacity = (uint32_t)frame.displacement.size();
+		frame.numAtoms = capacity != 0 ? (uint32_t)aAtomToNode.size() : 0;
+		frame.atomStride = capacity != 0 ? std::max(1u, (frame.numAtoms + capacity - 1) / capacity) : 1;
+		float peak = 0.0f;
+		for (uint32_t a = 0, v = 0; a < frame.numAtoms; a += frame.atomStride, ++v)
+		{
+			const float value = (float)aNodeDisplacement[aAtomToNode[a]];
+			frame.displacement[v] = value;
+			peak = std::max(peak, std::abs(value));
+		}
+		frame.peak = peak;
+		frame.rms = (float)std::sqrt(sumSquares / numMetered);
+		frame.sampleTime = sampleTime;
+		buffer.publish();
+
+		sumSquares = 0.0;
+		numMetered = 0;
+	}
+
+	// GUI thread. True if a newer snapshot was picked up;
+	bool update() { return buffer.update(); }
+
+	// GUI thread. The snapshot picked up by the last update(), valid until the next;
+	const MoleculeSnapshot& getSnapshot() const { return buffer.getReadFrame(); }
+
+private:
+	TripleBuffer<MoleculeSnapshot> buffer;
+
+	// Audio thread only;
+	int snapshotInterval = 1;
+	double sumSquares = 0.0;
+	int numMetered = 0;
+	uint64_t sampleTime = 0;
+};
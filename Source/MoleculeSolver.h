@@ -0,0 +1,248 @@
+/*
+  ==============================================================================
+
+    MoleculeSolver.h
+
+    Single-instance solver templated on precision. StateType is what the
+    three time levels are stored in; float halves the memory traffic, which
+    only pays once a molecule outgrows the cache. The Accumulator policy sets how each
+    node's Laplacian and update are computed:
+
+        PlainSum<float>         all float
+        PlainSum<double>        float state, double arithmetic
+        CompensatedSum<float>   float state, Neumaier-compensated Laplacian
+
+    Two rearrangements keep float usable. The Laplacian is summed as
+    stiffness * (u_j - u_i) rather than sum(stiffness * u_j) - degree * u_i,
+    which cancels when neighbours move together. The update adds a small
+    increment to u rather than forming 2u - u_{n-1}. The 1 / deltaX^2
+    scaling is folded into one coefficient with deltaT^2, so no
+    intermediate gets near float's range limits.
+
+    The rows are swept in CSR order unless a StencilKernels.h layout built
+    in the same types is set, which only PlainSum can use. The engine runs
+    it through ReducedPrecisionSweep.h with the layout it tuned for the
+    molecule, loading its double state at the start of each block and
+    storing it back at the end.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "MoleculeBoundary.h"
+#include "MoleculeTopology.h"
+#include "StencilKernels.h"
+
+template <typename ValueType>
+struct PlainSum
+{
+	typedef ValueType Value;
+
+	void add(Value aTerm) { sum += aTerm; }
+	Value get() const { return sum; }
+
+	Value sum = 0;
+};
+
+// Neumaier's variant of Kahan summation, which also holds when a term is larger than the running sum;
+template <typename ValueType>
+struct CompensatedSum
+{
+	typedef ValueType Value;
+
+	void add(Value aTerm)
+	{
+		// Both branches are computed and one selected, which the compiler turns into a blend rather than a jump;
+		const Value t = sum + aTerm;
+		const Value lostFromTerm = (sum - t) + aTerm;
+		const Value lostFromSum = (aTerm - t) + sum;
+		compensation += std::abs(sum) >= std::abs(aTerm) ? lostFromTerm : lostFromSum;
+		sum = t;
+	}
+
+	Value get() const { return sum + compensation; }
+
+	Value sum = 0;
+	Value compensation = 0;
+};
+
+template <typename StateType, typename Accumulator = PlainSum<StateType>>
+class MoleculeSolver
+{
+public:
+	typedef typename Accumulator::Value ComputeType;
+	typedef BasicStencilKernel<StateType, ComputeType> Kernel;
+
+	void prepare(const MoleculeTopology& aTopology, double aInternalRate, double aDeltaX)
+	{
+		topology = &aTopology;
+		deltaT = 1.0 / aInternalRate;
+		deltaX = aDeltaX;
+
+		weight.resize(aTopology.neighbours.size());
+		for (uint32_t i = 0; i != aTopology.numNodes; ++i)
+			for (uint32_t e = aTopology.rowStart[i]; e != aTopology.rowStart[i + 1]; ++e)
+				weight[e] = (ComputeType)(aTopology.stiffness[e] * aTopology.invMass[i]);
+
+		for (auto& d : displacement)
+			d.assign(aTopology.numNodes, (StateType)0);
+		setParameters(waveSpeed, genDamp);
+	}
+
+	void reset()
+	{
+		for (auto& d : displacement)
+			std::fill(d.begin(), d.end(), (StateType)0);
+	}
+
+	void setParameters(double aWaveSpeed, double aGenDamp)
+	{
+		waveSpeed = aWaveSpeed;
+		genDamp = aGenDamp;
+		setCoefficients(waveSpeed * waveSpeed * (deltaT * deltaT) / (deltaX * deltaX), 2.0 * genDamp * deltaT);
+	}
+
+	// The coefficients as StencilKernel takes them: waveSpeed^2 deltaT^2 / deltaX^2, and 2 genDamp deltaT;
+	void setCoefficients(double aLapCoeff, double aDampCoeff)
+	{
+		kernelLapCoeff = aLapCoeff;
+		kernelDampCoeff = aDampCoeff;
+		lapCoeff = (ComputeType)aLapCoeff;
+		keepCoeff = (ComputeType)(1.0 - aDampCoeff);
+	}
+
+	// Sweep with aKernel, built for the prepared topology, instead of in CSR order. nullptr goes back to CSR order;
+	void setKernel(std::shared_ptr<const Kernel> aKernel)
+	{
+		static_assert(std::is_same<Accumulator, PlainSum<ComputeType>>::value, "layouts only add bonds plainly");
+		kernel = std::move(aKernel);
+	}
+
+	// Replace the two latest time levels, rounding them to StateType;
+	void load(const double* aUNMOne, const double* aUN)
+	{
+		std::copy(aUNMOne, aUNMOne + topology->numNodes, displacement[idxRotationNMOne].begin());
+		std::copy(aUN, aUN + topology->numNodes, displacement[idxRotationN].begin());
+	}
+
+	void store(double* aUNMOne, double* aUN) const
+	{
+		std::copy(displacement[idxRotationNMOne].begin(), displacement[idxRotationNMOne].end(), aUNMOne);
+		std::copy(displacement[idxRotationN].begin(), displacement[idxRotationN].end(), aUN);
+	}
+
+	// Driven and tapped nodes outside the topology or clamped are ignored;
+	void setNodes(uint32_t aInputNode, uint32_t aOutputNode)
+	{
+		inputNode = aInputNode;
+		outputNode = aOutputNode;
+	}
+
+	// aInput[n] drives the input node, aOutput[n] receives the output tap. Returns the sum of squared new
+	// displacements over the block;
+	double process(const float* aInput, float* aOutput, int aNumSamples)
+	{
+		const uint32_t numNodes = topology->numNodes;
+		const uint32_t numClamped = topology->numClamped;
+
+		double energy = 0.0;
+		for (int n = 0; n != aNumSamples; ++n)
+		{
+			StateType* uNPOne = displacement[idxRotationNPOne].data();
+			energy += sweep();
+
+			if (inputNode >= numClamped && inputNode < numNodes)
+			{
+				energy += (double)aInput[n] * aInput[n] - (double)uNPOne[inputNode] * uNPOne[inputNode];
+				uNPOne[inputNode] = (StateType)aInput[n];
+			}
+			aOutput[n] = outputNode >= numClamped && outputNode < numNodes ? (float)uNPOne[outputNode] : 0.0f;
+			rotate();
+		}
+		return energy;
+	}
+
+	// As the engine steps: aBoundary drives and taps each new level, writing aOutputs[channel][n]. Returns the sum of
+	// squared swept displacements;
+	double process(const float* aInput, float* const* aOutputs, int aNumSamples, const BoundaryNodes& aBoundary)
+	{
+		double energy = 0.0;
+		for (int n = 0; n != aNumSamples; ++n)
+		{
+			StateType* uNPOne = displacement[idxRotationNPOne].data();
+			energy += sweep();
+			aBoundary.apply(uNPOne, aInput[n], aOutputs, n);
+			rotate();
+		}
+		return energy;
+	}
+
+	StateType getDisplacement(uint32_t aNode) const { return displacement[idxRotationN][aNode]; }
+
+private:
+	// One step of every free node into the N+1 level. Returns the sum of squared new displacements;
+	double sweep()
+	{
+		if (kernel != nullptr)
+			return kernel->step(displacement[idxRotationN].data(), displacement[idxRotationNMOne].data(), displacement[idxRotationNPOne].data(),
+								kernelLapCoeff, kernelDampCoeff);
+
+		const uint32_t numNodes = topology->numNodes;
+		const uint32_t* rowStart = topology->rowStart.data();
+		const uint32_t* neighbours = topology->neighbours.data();
+		const ComputeType* weights = weight.data();
+		const StateType* uN = displacement[idxRotationN].data();
+		const StateType* uNMOne = displacement[idxRotationNMOne].data();
+		StateType* uNPOne = displacement[idxRotationNPOne].data();
+
+		ComputeType energy = 0;
+		for (uint32_t i = topology->numClamped; i < numNodes; ++i)
+		{
+			const ComputeType u = (ComputeType)uN[i];
+			Accumulator laplacian;
+			for (uint32_t e = rowStart[i]; e != rowStart[i + 1]; ++e)
+				laplacian.add(weights[e] * ((ComputeType)uN[neighbours[e]] - u));
+
+			// u + (1 - damping) * (u - u_{n-1}) + lapCoeff * L, equal to the generic kernel's update;
+			const ComputeType increment = keepCoeff * (u - (ComputeType)uNMOne[i]) + lapCoeff * laplacian.get();
+			const StateType f = (StateType)(u + increment);
+			uNPOne[i] = f;
+			energy += (ComputeType)f * f;
+		}
+		return energy;
+	}
+
+	void rotate()
+	{
+		idxRotationNMOne = (idxRotationNMOne + 1) % 3;
+		idxRotationN = (idxRotationN + 1) % 3;
+		idxRotationNPOne = (idxRotationNPOne + 1) % 3;
+	}
+
+	const MoleculeTopology* topology = nullptr;
+	double deltaT = 1.0 / 44100.0;
+	double deltaX = 0.00001;
+	double waveSpeed = 0.015;
+	double genDamp = 0.0001;
+	ComputeType lapCoeff = 0;
+	ComputeType keepCoeff = 1;
+	double kernelLapCoeff = 0.0;
+	double kernelDampCoeff = 0.0;
+	std::shared_ptr<const Kernel> kernel;
+	uint32_t inputNode = 0;
+	uint32_t outputNode = 0;
+
+	std::vector<ComputeType> weight;		// Stiffness / mass of the row's node, per bond;
+	std::vector<StateType> displacement[3];
+	int idxRotationNMOne = 0;
+	int idxRotationN = 1;
+	int idxRotationNPOne = 2;
+};
@@ -0,0 +1,63 @@
+/*
+  ==============================================================================
+
+    MoleculeTopology.h
+
+    Compressed sparse row adjacency for the simulation kernel. Each node has a
+    mass and each bond a stiffness, so the same layout serves the loaded
+    molecule (unit masses and stiffnesses) and its coarsened levels.
+
+    Nodes below numClamped are held at rest and never swept, so kernels
+    update the range [numClamped, numNodes) without testing any node.
+    By default that is node 0 only, the original frozen boundary.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct MoleculeTopology
+{
+	uint32_t numNodes = 0;
+	uint32_t numClamped = 1;
+	std::vector<uint32_t> rowStart;		// numNodes + 1 offsets into neighbours;
+	std::vector<uint32_t> neighbours;
+	std::vector<float> stiffness;		// Per bond;
+	std::vector<float> degree;			// Sum of stiffness over each row;
+	std::vector<float> mass;
+	std::vector<float> invMass;
+
+	void clear()
+	{
+		numNodes = 0;
+		numClamped = 1;
+		rowStart.assign(1, 0);
+		neighbours.clear();
+		stiffness.clear();
+		degree.clear();
+		mass.clear();
+		invMass.clear();
+	}
+
+	size_t getNumBonds() const { return neighbours.size(); }
+
+	// Relative cost of one dense sweep;
+	size_t getSweepCost() const { return neighbours.size() + numNodes; }
+
+	// Call after rowStart, neighbours, stiffness and mass are filled in;
+	void finalise()
+	{
+		degree.assign(numNodes, 0.0f);
+		invMass.assign(numNodes, 1.0f);
+		for (uint32_t i = 0; i != numNodes; ++i)
+		{
+			for (uint32_t e = rowStart[i]; e != rowStart[i + 1]; ++e)
+				degree[i] += stiffness[e];
+			invMass[i] = 1.0f / mass[i];
+		}
+	}
+};
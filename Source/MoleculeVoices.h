@@ -0,0 +1,388 @@
+/*
+  ==============================================================================
+
+    MoleculeVoices.h
+
+    Polyphonic notes on a MoleculeBatch. Each note strikes one atom with a
+    short raised-cosine displacement scaled by its velocity, injected as its
+    step-to-step increments so it leaves no net momentum behind even in a
+    molecule with nothing clamped. Notes that resolve to
+    the same wave speed and damping share a lane and are injected into it
+    together. The update is linear, so a shared lane sounds exactly like
+    separate simulations summed, and a chord costs one sweep per distinct
+    pitch rather than one per note. Lanes and voices are fixed arrays, and
+    the batch for a new molecule is prepared by the caller and swapped in
+    by install(), so nothing here allocates. When every lane is busy the
+    quietest one, by the batch's energy meter, is stolen.
+
+    Voices remember their atoms, not nodes, so they follow the engine
+    across edits and levels of detail. Sounding lanes are carried over to
+    an edited molecule atom by atom, and run on whichever level the
+    engine has coarsened to, moved between levels as its own state is.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "MoleculeBatch.h"
+#include "MoleculeCoarsening.h"
+
+template <int numLanes>
+class MoleculeVoicePool
+{
+public:
+	static constexpr int maxVoices = 64;
+	static constexpr int strikeLength = 16;		// Hammer duration in internal samples;
+
+	enum Key_Mapping
+	{
+		Key_Pitch,		// Notes transpose the wave speed and strike the same atom;
+		Key_Atom		// Notes strike atoms spread across the molecule at one wave speed, so all share a lane;
+	};
+
+	struct KeyMap
+	{
+		Key_Mapping mapping = Key_Pitch;
+		int rootNote = 60;				// Sounds at waveSpeed;
+		double centsPerKey = 100.0;
+		uint32_t atom = 0;				// Struck by every note in Key_Pitch;
+		uint32_t tapAtom = 0;
+		double waveSpeed = 0.015;
+		double genDamp = 0.0001;
+	};
+
+	using Batch = MoleculeBatch<float, numLanes>;
+
+	MoleculeVoicePool()
+	{
+		auto pulse = [](int k) { return 0.5 - 0.5 * std::cos(2.0 * 3.14159265358979323846 * k / strikeLength); };
+		for (int k = 0; k != strikeLength; ++k)
+			hammer[k] = (float)(pulse(k + 1) - pulse(k));
+		for (int l = 0; l != numLanes; ++l)
+		{
+			inputs[l] = zeros;
+			outputs[l] = laneOutput[l];
+		}
+	}
+
+	// Play aLevels with aBatch, which the caller prepared for aLevels[0] with aDeltaX. Sounding notes carry over by
+	// atom. aBatch comes back holding the previous molecule's batch, for the caller to free off the audio thread.
+	// aLevels must stay valid until the next install();
+	void install(Batch& aBatch, const std::vector<MoleculeLevel>& aLevels, double aDeltaX)
+	{
+		switchLevel(0);
+		if (levels != nullptr)
+			aBatch.carryOver(batch, (*levels)[0].atomToNode, aLevels[0].atomToNode);
+		std::swap(batch, aBatch);
+		levels = &aLevels;
+		deltaX = aDeltaX;
+		batch.setInternalRate(internalRate);
+
+		// Gershgorin bound on the stiffest node's eigenvalue, for the leapfrog stability limit;
+		const MoleculeTopology& finest = aLevels[0].topology;
+		maxEigenvalue = 0.0;
+		for (uint32_t i = finest.numClamped; i < finest.numNodes; ++i)
+			maxEigenvalue = std::max(maxEigenvalue, 2.0 * finest.degree[i] * finest.invMass[i]);
+
+		setLevel(0);
+	}
+
+	// Follow the engine to another level of detail, carrying every lane across as it carries its own state. Doesn't
+	// allocate;
+	void switchLevel(size_t aNewLevel)
+	{
+		if (levels == nullptr || aNewLevel == idxLevel)
+			return;
+
+		size_t currentLevel = idxLevel;
+		for (; currentLevel < aNewLevel; ++currentLevel)
+			batch.restrictTo((*levels)[currentLevel + 1].topology, (*levels)[currentLevel].parent);
+		for (; currentLevel > aNewLevel; --currentLevel)
+			batch.prolongTo((*levels)[currentLevel - 1].topology, (*levels)[currentLevel - 1].parent);
+		setLevel(currentLevel);
+	}
+
+	// Silences every note. Doesn't allocate, so it is safe to call from the audio thread;
+	void setInternalRate(double aInternalRate)
+	{
+		internalRate = aInternalRate;
+		batch.setInternalRate(internalRate);
+		batch.reset();
+		for (auto& v : voices)
+			v.isActive = false;
+		for (auto& l : lanes)
+			l = Lane {};
+		numActiveLanes = 0;
+	}
+
+	double getInternalRate() const { return internalRate; }
+
+	// Takes effect for new notes; the tap moves on every sounding lane;
+	void setKeyMap(const KeyMap& aKeyMap)
+	{
+		const bool isTapMoved = aKeyMap.tapAtom != keyMap.tapAtom;
+		keyMap = aKeyMap;
+		if (!isTapMoved || topology == nullptr)
+			return;
+
+		for (int l = 0; l != numLanes; ++l)
+		{
+			auto parameters = batch.getLaneParameters(l);
+			parameters.outputNode = getNode(keyMap.tapAtom);
+			batch.setLaneParameters(l, parameters);
+		}
+	}
+
+	// Strike aNote after aDelay internal samples. aVelocity is 0 to 1;
+	void noteOn(int aNote, float aVelocity, int aDelay)
+	{
+		if (topology == nullptr)
+			return;
+
+		uint32_t atom = keyMap.atom;
+		double waveSpeed = keyMap.waveSpeed;
+		if (keyMap.mapping == Key_Atom)
+			atom = (uint32_t)((uint64_t)std::max(0, std::min(127, aNote)) * (atomToNode->size() - 1) / 127);
+		else
+		{
+			// Notes above the stability limit play at it, but the root always plays as set;
+			const double maxWaveSpeed = maxEigenvalue > 0.0 ? 2.0 * deltaX * internalRate / std::sqrt(maxEigenvalue) : waveSpeed;
+			waveSpeed *= std::pow(2.0, (aNote - keyMap.rootNote) * keyMap.centsPerKey / 1200.0);
+			waveSpeed = std::min(waveSpeed, std::max(maxWaveSpeed, keyMap.waveSpeed));
+		}
+
+		const uint32_t node = getNode(atom);
+		if (node < topology->numClamped || node >= topology->numNodes)
+			return;
+
+		Voice& voice = allocateVoice();
+		voice.note = aNote;
+		voice.lane = allocateLane(waveSpeed, keyMap.genDamp);
+		voice.atom = atom;
+		voice.node = node;
+		voice.velocity = aVelocity;
+		voice.position = -aDelay;
+		voice.age = ++numNotesStarted;
+		voice.isHeld = true;
+		voice.isActive = true;
+		++lanes[voice.lane].numVoices;
+	}
+
+	// The note rings on in its lane until it decays;
+	void noteOff(int aNote)
+	{
+		for (auto& v : voices)
+			if (v.isActive && v.note == aNote)
+				v.isHeld = false;
+	}
+
+	void allNotesOff()
+	{
+		for (auto& v : voices)
+			v.isHeld = false;
+	}
+
+	bool isSounding() const { return numActiveLanes != 0; }
+
+	// Add aNumSamples of every sounding lane to aOutput, at the internal rate. Lanes with no voices left are freed
+	// once they fall below aSilenceThreshold mean square displacement;
+	void process(float* aOutput, int aNumSamples, double aSilenceThreshold)
+	{
+		if (numActiveLanes == 0)
+			return;
+
+		for (int n = 0; n < aNumSamples; n += subBlockSize)
+		{
+			const int numSamples = std::min(subBlockSize, aNumSamples - n);
+
+			// Only voices still striking inject anything;
+			int numInjections = 0;
+			for (auto& v : voices)
+			{
+				if (!v.isActive || v.position >= strikeLength)
+					continue;
+
+				float* signal = strikeSignal[numInjections];
+				for (int k = 0; k != numSamples; ++k)
+				{
+					const int position = v.position + k;
+					signal[k] = position >= 0 && position < strikeLength ? v.velocity * hammer[position] : 0.0f;
+				}
+				injections[numInjections++] = { v.node, v.lane, signal };
+				v.position += numSamples;
+			}
+
+			batch.process(inputs, outputs, numSamples, injections, numInjections);
+			for (int l = 0; l != numLanes; ++l)
+			{
+				if (lanes[l].isActive)
+					for (int k = 0; k != numSamples; ++k)
+						aOutput[n + k] += laneOutput[l][k];
+			}
+		}
+
+		for (auto& v : voices)
+		{
+			if (v.isActive && !v.isHeld && v.position >= strikeLength)
+				releaseVoice(v);
+		}
+		for (int l = 0; l != numLanes; ++l)
+		{
+			if (lanes[l].isActive && lanes[l].numVoices == 0 && batch.getLaneEnergy(l) < aSilenceThreshold)
+				releaseLane(l);
+		}
+	}
+
+private:
+	static constexpr int subBlockSize = 128;
+
+	struct Voice
+	{
+		int note = 0;
+		int lane = 0;
+		uint32_t atom = 0;
+		uint32_t node = 0;			// atom on the current level;
+		float velocity = 0.0f;
+		int position = 0;			// Samples into the strike, negative while delayed;
+		uint64_t age = 0;
+		bool isHeld = false;
+		bool isActive = false;
+	};
+
+	struct Lane
+	{
+		double waveSpeed = 0.0;
+		double genDamp = 0.0;
+		int numVoices = 0;
+		bool isActive = false;
+	};
+
+	uint32_t getNode(uint32_t aAtom) const
+	{
+		return aAtom < atomToNode->size() ? (*atomToNode)[aAtom] : topology->numNodes;
+	}
+
+	// Map voices and taps onto aLevel. An atom that an edit removed leaves its voice striking nothing, as the batch
+	// ignores injections outside the topology;
+	void setLevel(size_t aLevel)
+	{
+		idxLevel = aLevel;
+		topology = &(*levels)[aLevel].topology;
+		atomToNode = &(*levels)[aLevel].atomToNode;
+
+		for (auto& v : voices)
+			v.node = getNode(v.atom);
+		for (int l = 0; l != numLanes; ++l)
+		{
+			auto parameters = batch.getLaneParameters(l);
+			parameters.outputNode = getNode(keyMap.tapAtom);
+			batch.setLaneParameters(l, parameters);
+		}
+	}
+
+	// A free slot, or the oldest note's;
+	Voice& allocateVoice()
+	{
+		Voice* oldest = &voices[0];
+		for (auto& v : voices)
+		{
+			if (!v.isActive)
+				return v;
+			if (v.age < oldest->age)
+				oldest = &v;
+		}
+		releaseVoice(*oldest);
+		return *oldest;
+	}
+
+	// The lane already sounding these parameters, a free one, or the quietest. Lanes whose notes haven't finished
+	// striking have not been metered yet, so they are only stolen if every lane is still striking;
+	int allocateLane(double aWaveSpeed, double aGenDamp)
+	{
+		int idxFree = -1;
+		for (int l = 0; l != numLanes; ++l)
+		{
+			if (lanes[l].isActive && lanes[l].waveSpeed == aWaveSpeed && lanes[l].genDamp == aGenDamp)
+				return l;
+			if (!lanes[l].isActive && idxFree < 0)
+				idxFree = l;
+		}
+
+		int lane = idxFree;
+		if (lane < 0)
+		{
+			bool isStriking[numLanes] = {};
+			for (const auto& v : voices)
+				if (v.isActive && v.position < strikeLength)
+					isStriking[v.lane] = true;
+
+			lane = 0;
+			for (int l = 1; l != numLanes; ++l)
+			{
+				if (isStriking[l] != isStriking[lane] ? isStriking[lane] : batch.getLaneEnergy(l) < batch.getLaneEnergy(lane))
+					lane = l;
+			}
+
+			for (auto& v : voices)
+				if (v.isActive && v.lane == lane)
+					releaseVoice(v);
+			releaseLane(lane);
+		}
+
+		typename Batch::LaneParameters parameters;
+		parameters.waveSpeed = aWaveSpeed;
+		parameters.genDamp = aGenDamp;
+		parameters.inputNode = UINT32_MAX;		// On no level, so driven only by injections;
+		parameters.outputNode = getNode(keyMap.tapAtom);
+		batch.setLaneParameters(lane, parameters);
+
+		lanes[lane].waveSpeed = aWaveSpeed;
+		lanes[lane].genDamp = aGenDamp;
+		lanes[lane].isActive = true;
+		++numActiveLanes;
+		return lane;
+	}
+
+	void releaseVoice(Voice& aVoice)
+	{
+		aVoice.isActive = false;
+		--lanes[aVoice.lane].numVoices;
+	}
+
+	void releaseLane(int aLane)
+	{
+		batch.resetLane(aLane);
+		lanes[aLane] = Lane {};
+		--numActiveLanes;
+	}
+
+	const std::vector<MoleculeLevel>* levels = nullptr;
+	size_t idxLevel = 0;
+	const MoleculeTopology* topology = nullptr;				// Of the level playing;
+	const std::vector<uint32_t>* atomToNode = nullptr;
+	double internalRate = 44100.0;
+	double deltaX = 0.00001;
+	double maxEigenvalue = 0.0;
+	KeyMap keyMap;
+
+	Batch batch;
+	Lane lanes[numLanes];
+	int numActiveLanes = 0;
+	Voice voices[maxVoices];
+	uint64_t numNotesStarted = 0;
+
+	float hammer[strikeLength] = {};
+	float zeros[subBlockSize] = {};
+	float laneOutput[numLanes][subBlockSize] = {};
+	const float* inputs[numLanes] = {};
+	float* outputs[numLanes] = {};
+	float strikeSignal[maxVoices][subBlockSize] = {};
+	typename Batch::Injection injections[maxVoices] = {};
+};
@@ -0,0 +1,123 @@
+/*
+  ==============================================================================
+
+    PerfBenchmark.h
+
+    Where the dense sweep's time goes, per storage layout. Every
+    StencilKernel runs the same ringing state on each molecule between
+    PerfCounters start and stop, and the counts are printed per free atom
+    per step. All layouts do the same arithmetic, so differences in cache
+    misses and instructions between them come from how the neighbour
+    gather is laid out. CSR is also run in load order, before bandwidth
+    reduction: the same work and layout with worse locality. A lattice
+    larger than the last-level cache stands in for very large molecules.
+    Run with `MolecularSynthesis --perf [file.pdb ...]`.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "PerfCounters.h"
+#include "PrecisionBenchmark.h"
+#include "StencilKernels.h"
+
+// Bond and node updates per measured run, so small molecules run long enough to count;
+constexpr double perfWorkPerKernel = 5.0e7;
+
+// Prints one row for aKernel stepping aTopology;
+inline void measureKernelCounters(const char* aVariant, StencilKernel& aKernel, const MoleculeTopology& aTopology, FILE* aOutput)
+{
+	const uint32_t numNodes = aTopology.numNodes;
+	const uint32_t numFree = numNodes - aTopology.numClamped;
+	if (numFree == 0)
+		return;
+
+	// Far from rest, as KernelTuner starts, so no layout skips work on zeros;
+	std::vector<double> state[3];
+	for (int t = 0; t != 3; ++t)
+	{
+		state[t].resize(numNodes);
+		for (uint32_t i = 0; i != numNodes; ++i)
+			state[t][i] = i < aTopology.numClamped ? 0.0 : 0.001 * std::sin(0.37 * i + t);
+	}
+	const double lapCoeff = 0.2;
+	const double dampCoeff = 1.0e-4;
+	const int numSteps = (int)std::max(100.0, std::min(200000.0, perfWorkPerKernel / (double)aTopology.getSweepCost()));
+
+	int idxNMOne = 0, idxN = 1, idxNPOne = 2;
+	double energy = 0.0;
+	auto sweep = [&](int aNumSteps)
+	{
+		for (int n = 0; n != aNumSteps; ++n)
+		{
+			energy += aKernel.step(state[idxN].data(), state[idxNMOne].data(), state[idxNPOne].data(), lapCoeff, dampCoeff);
+			idxNMOne = (idxNMOne + 1) % 3;
+			idxN = (idxN + 1) % 3;
+			idxNPOne = (idxNPOne + 1) % 3;
+		}
+	};
+
+	// Warm the caches and branch predictors first;
+	sweep(std::max(1, numSteps / 10));
+
+	PerfCounters counters;
+	const auto start = std::chrono::steady_clock::now();
+	counters.start();
+	sweep(numSteps);
+	counters.stop();
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+	// Keeps the sweeps from being optimised out;
+	if (std::isnan(energy))
+		std::fprintf(aOutput, "  %s diverged\n", aVariant);
+
+	const double atomSteps = (double)numFree * numSteps;
+	auto perAtomStep = [&](PerfCounters::Counter aCounter) { return counters.get(aCounter) / atomSteps; };
+	const double cycles = perAtomStep(PerfCounters::Counter_Cycles);
+	const double instructions = perAtomStep(PerfCounters::Counter_Instructions);
+
+	std::fprintf(aOutput, "  %-18s %8.2f %8.2f %8.2f %6.2f %8.3f %8.3f %8.3f\n", aVariant, elapsed.count() / atomSteps, cycles, instructions,
+				 instructions / cycles, perAtomStep(PerfCounters::Counter_L1DMisses), perAtomStep(PerfCounters::Counter_LLCMisses),
+				 perAtomStep(PerfCounters::Counter_BranchMisses));
+}
+
+// Prints one table for aTopology, given in load order;
+inline void benchmarkKernelCounters(const std::string& aName, const MoleculeTopology& aTopology, FILE* aOutput)
+{
+	const MoleculeTopology ordered = permuteTopology(aTopology, cuthillMcKeeOrder(aTopology));
+
+	std::fprintf(aOutput, "%s: %u atoms, %zu bonds, %.2f neighbours per atom\n", aName.c_str(), aTopology.numNodes, aTopology.getNumBonds(),
+				 (double)aTopology.getNumBonds() / std::max(1u, aTopology.numNodes));
+	std::fprintf(aOutput, "  %-18s %8s %8s %8s %6s %8s %8s %8s\n", "layout", "ns", "cycles", "instr", "IPC", "L1D miss", "LLC miss", "br miss");
+
+	CsrKernel loadOrder(aTopology);
+	measureKernelCounters("CSR, load order", loadOrder, aTopology, aOutput);
+	for (auto& kernel : makeStencilKernels(ordered))
+		measureKernelCounters(kernel->getName().c_str(), *kernel, ordered, aOutput);
+}
+
+// Per atom-step counts for every bundled molecule and a 131072-node lattice;
+inline void runPerfBenchmark(const std::vector<std::string>& aPdbPaths, FILE* aOutput)
+{
+	if (!PerfCounters().isAnyAvailable())
+		std::fprintf(aOutput, "Hardware counters unavailable (not Linux, no PMU in this machine, or perf_event_paranoid above 2); timing only.\n");
+	std::fprintf(aOutput, "Counts per free atom per step.\n");
+
+	for (const auto& path : aPdbPaths)
+	{
+		const MoleculeTopology topology = loadPdbTopology(path);
+		if (topology.numNodes < 3)
+			continue;
+		benchmarkKernelCounters(path, topology, aOutput);
+	}
+	benchmarkKernelCounters("lattice", makeLatticeTopology(256, 512), aOutput);
+}
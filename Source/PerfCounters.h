@@ -0,0 +1,136 @@
+/*
+  ==============================================================================
+
+    PerfCounters.h
+
+    Hardware event counts around a stretch of code, from Linux
+    perf_event_open: cycles, instructions, L1 data and last-level cache
+    read misses and branch mispredicts. Each event is opened on its own
+    rather than as a group, so one the CPU or a virtual machine doesn't
+    offer is simply reported missing. When the kernel multiplexes events
+    the counts are scaled up by the fraction of time each was counting.
+    Counting user space only works with perf_event_paranoid up to 2.
+    Elsewhere nothing is available and every count reads as NaN.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class PerfCounters
+{
+public:
+	enum Counter
+	{
+		Counter_Cycles,
+		Counter_Instructions,
+		Counter_L1DMisses,
+		Counter_LLCMisses,
+		Counter_BranchMisses,
+		numCounters
+	};
+
+	static const char* getName(Counter aCounter)
+	{
+		static const char* const names[numCounters] = { "cycles", "instructions", "L1D misses", "LLC misses", "branch misses" };
+		return names[aCounter];
+	}
+
+	// Counts the calling thread, on whichever CPU it runs;
+	PerfCounters()
+	{
+#if defined(__linux__)
+		const uint64_t cacheReadMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		const uint32_t types[numCounters] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+		const uint64_t configs[numCounters] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_L1D | cacheReadMiss,
+												PERF_COUNT_HW_CACHE_LL | cacheReadMiss, PERF_COUNT_HW_BRANCH_MISSES };
+		for (int c = 0; c != numCounters; ++c)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = types[c];
+			attr.config = configs[c];
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			descriptors[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		}
+#endif
+	}
+
+	~PerfCounters()
+	{
+#if defined(__linux__)
+		for (int fd : descriptors)
+			if (fd >= 0)
+				close(fd);
+#endif
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	bool isAvailable(Counter aCounter) const { return descriptors[aCounter] >= 0; }
+
+	bool isAnyAvailable() const
+	{
+		for (int fd : descriptors)
+			if (fd >= 0)
+				return true;
+		return false;
+	}
+
+	// Zero and start every available counter;
+	void start()
+	{
+#if defined(__linux__)
+		for (int fd : descriptors)
+		{
+			if (fd >= 0)
+			{
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+#endif
+	}
+
+	// Stop counting and latch the counts for get();
+	void stop()
+	{
+		for (int c = 0; c != numCounters; ++c)
+		{
+			counts[c] = NAN;
+#if defined(__linux__)
+			if (descriptors[c] < 0)
+				continue;
+			ioctl(descriptors[c], PERF_EVENT_IOC_DISABLE, 0);
+
+			// Value, time enabled, time running;
+			uint64_t values[3] = {};
+			if (read(descriptors[c], values, sizeof(values)) == (ssize_t)sizeof(values) && values[2] > 0)
+				counts[c] = (double)values[0] * ((double)values[1] / (double)values[2]);
+#endif
+		}
+	}
+
+	// Count between the last start() and stop(), or NaN if the counter isn't available;
+	double get(Counter aCounter) const { return counts[aCounter]; }
+
+private:
+	int descriptors[numCounters] = { -1, -1, -1, -1, -1 };
+	double counts[numCounters] = { NAN, NAN, NAN, NAN, NAN };
+};
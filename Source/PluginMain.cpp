@@ -0,0 +1,15 @@
+/*
+  ==============================================================================
+
+    Entry point for the plugin build, MolecularSynthesisPlugin.jucer.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "MoleculePlugin.h"
+
+juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
+{
+    return new MoleculePlugin();
+}
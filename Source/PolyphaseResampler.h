@@ -0,0 +1,214 @@
+/*
+  ==============================================================================
+
+    PolyphaseResampler.h
+
+    Converts the simulation's internal sample rate to the device sample rate.
+    Arbitrary ratios are handled with a fixed bank of windowed-sinc phases and
+    linear interpolation between neighbouring phases. The coefficients for
+    a ratio are a Table built off the audio thread, and changing the ratio
+    only points the resampler at another one, keeping its history and phase.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+
+class PolyphaseResampler
+{
+public:
+	static constexpr int numPhases = 128;
+	static constexpr int numTaps = 32;		// Multiple of simdWidth;
+	static constexpr int simdWidth = 8;
+
+	// The windowed-sinc bank for converting one rate to another. About 33 kB, so it is built on the control thread;
+	struct Table
+	{
+		double inputRate = 44100.0;
+		double outputRate = 44100.0;
+		bool isBypassed = true;
+		uint64_t phaseIncrement = phaseOne;
+
+		alignas(32) float coefficients[(numPhases + 1) * numTaps] = {};
+		alignas(32) float deltas[numPhases * numTaps] = {};
+	};
+
+	static std::unique_ptr<Table> makeTable(double aInputRate, double aOutputRate)
+	{
+		auto table = std::make_unique<Table>();
+		table->inputRate = aInputRate;
+		table->outputRate = aOutputRate;
+		table->isBypassed = (aInputRate == aOutputRate);
+		table->phaseIncrement = (uint64_t)std::llround((aInputRate / aOutputRate) * (double)phaseOne);
+
+		// Lowpass at the lower of the two Nyquist limits, leaving room for the transition band;
+		const double cutoff = std::min(1.0, aOutputRate / aInputRate) * 0.9;
+		const double halfLength = numTaps / 2;
+
+		for (int p = 0; p <= numPhases; ++p)
+		{
+			double row[numTaps];
+			double sum = 0.0;
+			for (int k = 0; k != numTaps; ++k)
+			{
+				const double t = (halfLength - 1.0) + (double)p / numPhases - k;
+				row[k] = cutoff * sinc(cutoff * t) * kaiser(t / halfLength);
+				sum += row[k];
+			}
+
+			// Normalise for unity gain at DC;
+			for (int k = 0; k != numTaps; ++k)
+				table->coefficients[p * numTaps + k] = (float)(row[k] / sum);
+		}
+
+		for (int p = 0; p != numPhases; ++p)
+			for (int k = 0; k != numTaps; ++k)
+				table->deltas[p * numTaps + k] = table->coefficients[(p + 1) * numTaps + k] - table->coefficients[p * numTaps + k];
+
+		return table;
+	}
+
+	// Convert with aTable, which must outlive its use here. History and phase are kept, so the output carries on
+	// from the same input without a gap. Safe on the audio thread;
+	void setTable(const Table& aTable) { table = &aTable; }
+
+	void reset()
+	{
+		std::memset(history, 0, sizeof(history));
+		idxHistory = 0;
+		phase = 0;
+	}
+
+	// Number of input samples process() will consume to produce aNumOutputSamples;
+	int getNumInputSamplesRequired(int aNumOutputSamples) const
+	{
+		if (table->isBypassed)
+			return aNumOutputSamples;
+		if (aNumOutputSamples <= 0)
+			return 0;
+
+		return (int)((phase + (uint64_t)(aNumOutputSamples - 1) * table->phaseIncrement) >> phaseBits);
+	}
+
+	// Largest output block whose input fits in aInputCapacity samples;
+	int getMaxOutputSamplesFor(int aInputCapacity) const
+	{
+		if (table->isBypassed)
+			return aInputCapacity;
+
+		return std::max(1, (int)((double)(aInputCapacity - 2) * table->outputRate / table->inputRate));
+	}
+
+	// aNumInputSamples must equal getNumInputSamplesRequired(aNumOutputSamples). Needs a table set;
+	void process(const float* aInput, int aNumInputSamples, float* aOutput, int aNumOutputSamples)
+	{
+		// The history still follows the input, ready for a ratio that is not bypassed;
+		if (table->isBypassed)
+		{
+			std::copy(aInput, aInput + aNumInputSamples, aOutput);
+			for (int n = std::max(0, aNumInputSamples - numTaps); n != aNumInputSamples; ++n)
+				push(aInput[n]);
+			return;
+		}
+
+		const uint64_t phaseIncrement = table->phaseIncrement;
+		const float* coefficients = table->coefficients;
+		const float* deltas = table->deltas;
+
+		int idxInput = 0;
+		for (int n = 0; n != aNumOutputSamples; ++n)
+		{
+			while (phase >= phaseOne)
+			{
+				push(aInput[idxInput++]);
+				phase -= phaseOne;
+			}
+
+			const uint32_t fraction = (uint32_t)phase;
+			const int idxPhase = (int)(fraction >> (phaseBits - phaseIndexBits));
+			const float interp = (float)(fraction & phaseInterpMask) * (1.0f / (float)(phaseInterpMask + 1));
+
+			aOutput[n] = dotProduct(history + idxHistory, coefficients + idxPhase * numTaps, deltas + idxPhase * numTaps, interp);
+
+			phase += phaseIncrement;
+		}
+
+		(void)aNumInputSamples;
+	}
+
+	int getLatencyInInputSamples() const { return numTaps / 2; }
+
+private:
+	static constexpr int phaseBits = 32;
+	static constexpr uint64_t phaseOne = (uint64_t)1 << phaseBits;
+	static constexpr int phaseIndexBits = 7;		// log2(numPhases);
+	static constexpr uint32_t phaseInterpMask = ((uint32_t)1 << (phaseBits - phaseIndexBits)) - 1;
+
+	static_assert((1 << phaseIndexBits) == numPhases, "phaseIndexBits must match numPhases");
+	static_assert(numTaps % simdWidth == 0, "numTaps must be a multiple of simdWidth");
+
+	void push(float aSample)
+	{
+		history[idxHistory] = aSample;
+		history[idxHistory + numTaps] = aSample;
+		idxHistory = (idxHistory + 1) % numTaps;
+	}
+
+	// Lane-wise accumulators so the compiler can keep the sum in vector registers without fast-math;
+	static float dotProduct(const float* aSamples, const float* aCoeffs, const float* aDeltas, float aInterp)
+	{
+		float lanes[simdWidth] = {};
+		for (int k = 0; k != numTaps; k += simdWidth)
+		{
+			for (int l = 0; l != simdWidth; ++l)
+				lanes[l] += aSamples[k + l] * (aCoeffs[k + l] + aInterp * aDeltas[k + l]);
+		}
+
+		float sum = 0.0f;
+		for (int l = 0; l != simdWidth; ++l)
+			sum += lanes[l];
+		return sum;
+	}
+
+	static double sinc(double x)
+	{
+		if (std::abs(x) < 1e-12)
+			return 1.0;
+		const double pix = 3.14159265358979323846 * x;
+		return std::sin(pix) / pix;
+	}
+
+	// Kaiser window over [-1, 1];
+	static double kaiser(double x)
+	{
+		if (std::abs(x) > 1.0)
+			return 0.0;
+		return besselI0(kaiserBeta * std::sqrt(1.0 - x * x)) / besselI0(kaiserBeta);
+	}
+
+	static double besselI0(double x)
+	{
+		double sum = 1.0;
+		double term = 1.0;
+		const double halfX = x * 0.5;
+		for (int k = 1; k != 32; ++k)
+		{
+			term *= (halfX / k) * (halfX / k);
+			sum += term;
+		}
+		return sum;
+	}
+
+	static constexpr double kaiserBeta = 8.0;
+
+	const Table* table = nullptr;
+	uint64_t phase = 0;
+	alignas(32) float history[2 * numTaps] = {};
+	int idxHistory = 0;
+};
@@ -0,0 +1,189 @@
+/*
+  ==============================================================================
+
+    PrecisionBenchmark.h
+
+    Accuracy against speed for each MoleculeSolver precision. Every molecule
+    is excited and left to ring for a second at 44.1 kHz. Each variant's
+    output, tapped in the same bonded component as the driven atom, is then
+    compared with the all-double solver. A 131072-node
+    lattice stands in for very large molecules, where CompactMoleculeSolver's
+    16-bit storage matters. Run with
+    `MolecularSynthesis --benchmark [file.pdb ...]`.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "CompactMoleculeSolver.h"
+#include "MoleculeLoader.h"
+#include "MoleculeSolver.h"
+
+// Bonds of a .pdb as a unit-mass, unit-stiffness topology with node 0 clamped, numbered like the engine;
+inline MoleculeTopology loadPdbTopology(const std::string& aPath)
+{
+	LoadedMolecule molecule;
+	loadPdbMolecule(aPath, molecule);
+
+	MoleculeTopology topology;
+	molecule.bonds.toTopology(topology);
+	topology.numClamped = 1;
+	return topology;
+}
+
+// A aWidth x aHeight grid of unit masses, bonded to the nodes left, right, above and below. Rows are
+// consecutive, so its bandwidth is aWidth;
+inline MoleculeTopology makeLatticeTopology(uint32_t aWidth, uint32_t aHeight)
+{
+	MoleculeTopology topology;
+	topology.clear();
+	topology.numNodes = aWidth * aHeight;
+	topology.mass.assign(topology.numNodes, 1.0f);
+	for (uint32_t y = 0; y != aHeight; ++y)
+	{
+		for (uint32_t x = 0; x != aWidth; ++x)
+		{
+			const uint32_t i = y * aWidth + x;
+			if (y > 0)
+				topology.neighbours.push_back(i - aWidth);
+			if (x > 0)
+				topology.neighbours.push_back(i - 1);
+			if (x + 1 < aWidth)
+				topology.neighbours.push_back(i + 1);
+			if (y + 1 < aHeight)
+				topology.neighbours.push_back(i + aWidth);
+			topology.rowStart.push_back((uint32_t)topology.neighbours.size());
+		}
+	}
+	topology.stiffness.assign(topology.neighbours.size(), 1.0f);
+	topology.finalise();
+	return topology;
+}
+
+// The node halfway along a breadth-first walk from aDriven, so the tap is in the driven atom's component and hears it.
+// Clamped nodes are never picked; aDriven itself if nothing else is reachable;
+inline uint32_t findTapNode(const MoleculeTopology& aTopology, uint32_t aDriven)
+{
+	std::vector<uint32_t> order(1, aDriven);
+	std::vector<uint8_t> isVisited(aTopology.numNodes, 0);
+	isVisited[aDriven] = 1;
+	for (size_t o = 0; o != order.size(); ++o)
+	{
+		const uint32_t i = order[o];
+		for (uint32_t k = aTopology.rowStart[i]; k != aTopology.rowStart[i + 1]; ++k)
+		{
+			const uint32_t j = aTopology.neighbours[k];
+			if (!isVisited[j] && j >= aTopology.numClamped)
+			{
+				isVisited[j] = 1;
+				order.push_back(j);
+			}
+		}
+	}
+	return order[order.size() / 2];
+}
+
+struct PrecisionResult
+{
+	double nanosecondsPerStep = 0.0;
+	double maxError = 0.0;
+	double snr = 0.0;		// Reference power over error power, in dB. NaN if the reference is silent;
+	std::vector<float> output;
+};
+
+template <typename Solver>
+PrecisionResult measurePrecision(const MoleculeTopology& aTopology, uint32_t aInputNode, uint32_t aOutputNode, const std::vector<float>& aInput,
+								 const std::vector<float>* aReference)
+{
+	const int blockSize = 512;
+	const int numSamples = (int)aInput.size();
+
+	Solver solver;
+	solver.prepare(aTopology, 44100.0, 0.00001);
+	solver.setParameters(0.015, 0.0001);
+	solver.setNodes(aInputNode, aOutputNode);
+
+	PrecisionResult result;
+	result.output.assign(numSamples, 0.0f);
+
+	const auto start = std::chrono::steady_clock::now();
+	for (int n = 0; n < numSamples; n += blockSize)
+		solver.process(aInput.data() + n, result.output.data() + n, std::min(blockSize, numSamples - n));
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	result.nanosecondsPerStep = elapsed.count() / numSamples;
+
+	if (aReference != nullptr)
+	{
+		double signalPower = 0.0, errorPower = 0.0;
+		for (int n = 0; n != numSamples; ++n)
+		{
+			const double error = (double)result.output[n] - (*aReference)[n];
+			result.maxError = std::max(result.maxError, std::abs(error));
+			signalPower += (double)(*aReference)[n] * (*aReference)[n];
+			errorPower += error * error;
+		}
+		if (signalPower == 0.0)
+			result.snr = NAN;
+		else
+			result.snr = errorPower > 0.0 ? 10.0 * std::log10(signalPower / errorPower) : INFINITY;
+	}
+	return result;
+}
+
+// Prints one table for aTopology to aOutput, with the Sin excitation for the first tenth of aNumSamples;
+inline void benchmarkTopology(const std::string& aName, const MoleculeTopology& aTopology, uint32_t aInputNode, uint32_t aOutputNode, int aNumSamples,
+							  FILE* aOutput)
+{
+	std::vector<float> input(aNumSamples, 0.0f);
+	for (int n = 0; n != aNumSamples / 10; ++n)
+		input[n] = std::sin((n % 20) / 20.0f);
+
+	std::fprintf(aOutput, "%s: %u atoms, %zu bonds\n", aName.c_str(), aTopology.numNodes, aTopology.getNumBonds());
+	std::fprintf(aOutput, "  %-28s %10s %8s %12s %10s\n", "precision", "ns/step", "speedup", "max error", "SNR dB");
+
+	const PrecisionResult reference = measurePrecision<MoleculeSolver<double>>(aTopology, aInputNode, aOutputNode, input, nullptr);
+	auto report = [&](const char* aVariant, const PrecisionResult& aResult)
+	{
+		char snr[16] = "n/a";
+		if (!std::isnan(aResult.snr))
+			std::snprintf(snr, sizeof(snr), "%.1f", aResult.snr);
+		std::fprintf(aOutput, "  %-28s %10.1f %8.2f %12.3g %10s\n", aVariant, aResult.nanosecondsPerStep,
+					 reference.nanosecondsPerStep / aResult.nanosecondsPerStep, aResult.maxError, snr);
+	};
+
+	report("double", measurePrecision<MoleculeSolver<double>>(aTopology, aInputNode, aOutputNode, input, &reference.output));
+	report("float", measurePrecision<MoleculeSolver<float>>(aTopology, aInputNode, aOutputNode, input, &reference.output));
+	report("float, double arithmetic", measurePrecision<MoleculeSolver<float, PlainSum<double>>>(aTopology, aInputNode, aOutputNode, input, &reference.output));
+	report("float, compensated", measurePrecision<MoleculeSolver<float, CompensatedSum<float>>>(aTopology, aInputNode, aOutputNode, input, &reference.output));
+	report("compact double", measurePrecision<CompactMoleculeSolver<double, ExactCodec<double>>>(aTopology, aInputNode, aOutputNode, input, &reference.output));
+	report("compact double, fp16 N-1", measurePrecision<CompactMoleculeSolver<double, HalfCodec>>(aTopology, aInputNode, aOutputNode, input, &reference.output));
+	report("compact double, all fp16", measurePrecision<CompactMoleculeSolver<double, HalfCodec, HalfCodec>>(aTopology, aInputNode, aOutputNode, input, &reference.output));
+	report("compact float, all fp16", measurePrecision<CompactMoleculeSolver<float, HalfCodec, HalfCodec>>(aTopology, aInputNode, aOutputNode, input, &reference.output));
+}
+
+// Each molecule rings for a second; the lattice for fewer steps, as every step touches 131072 nodes. All are put in
+// bandwidth-reduced order first, as the app does on load;
+inline void runPrecisionBenchmark(const std::vector<std::string>& aPdbPaths, FILE* aOutput)
+{
+	for (const auto& path : aPdbPaths)
+	{
+		const MoleculeTopology topology = loadPdbTopology(path);
+		if (topology.numNodes < 3)
+			continue;
+		const MoleculeTopology ordered = permuteTopology(topology, cuthillMcKeeOrder(topology));
+		const uint32_t driven = std::max(ordered.numClamped, ordered.numNodes / 3);
+		benchmarkTopology(path, ordered, driven, findTapNode(ordered, driven), 44100, aOutput);
+	}
+
+	// Tapped three nodes from the driven one, so the excitation arrives within the run;
+	const uint32_t latticeDriven = 256 * 256 + 128;
+	benchmarkTopology("lattice", makeLatticeTopology(256, 512), latticeDriven, latticeDriven + 3, 2000, aOutput);
+}
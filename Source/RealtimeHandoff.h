@@ -0,0 +1,87 @@
+/*
+  ==============================================================================
+
+    RealtimeHandoff.h
+
+    Objects built on the control thread for the audio thread, and handed
+    back once it is done with them. The control thread allocates and fills
+    an object, then sends it. At the start of a block the audio thread
+    receives it, swaps its contents with what it was playing and gives it
+    back, now holding the old contents. The control thread frees that on
+    its next send() or collect().
+
+    The audio thread never waits, allocates or frees here. Receiving is one
+    atomic exchange, and giving back writes to a fixed ring that receive()
+    makes sure has room. Sending again before the audio thread receives
+    replaces the pending object, which goes back to the sender unused.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+template <typename Object>
+class RealtimeHandoff
+{
+public:
+	RealtimeHandoff() = default;
+	RealtimeHandoff(const RealtimeHandoff&) = delete;
+	RealtimeHandoff& operator=(const RealtimeHandoff&) = delete;
+
+	// Neither thread may still be using the handoff;
+	~RealtimeHandoff()
+	{
+		delete pending.load(std::memory_order_acquire);
+		collect();
+	}
+
+	// Control thread. Frees what the audio thread gave back, then makes aObject the pending one. Returns the object it
+	// replaces if the audio thread never received it;
+	std::unique_ptr<Object> send(std::unique_ptr<Object> aObject)
+	{
+		collect();
+		return std::unique_ptr<Object>(pending.exchange(aObject.release(), std::memory_order_acq_rel));
+	}
+
+	// Control thread. The pending object, if the audio thread hasn't received it yet, e.g. to add to it and resend;
+	std::unique_ptr<Object> takeBack() { return std::unique_ptr<Object>(pending.exchange(nullptr, std::memory_order_acq_rel)); }
+
+	// Control thread. Frees the objects the audio thread has given back;
+	void collect()
+	{
+		const uint32_t numGivenBack = numReturned.load(std::memory_order_acquire);
+		uint32_t n = numFreed.load(std::memory_order_relaxed);
+		for (; n != numGivenBack; ++n)
+			delete returned[n % capacity];
+		numFreed.store(n, std::memory_order_release);
+	}
+
+	// Audio thread. The object sent last, or nullptr if there is none or the ring has no room to give it back. The
+	// caller owns it until it passes it to giveBack();
+	Object* receive()
+	{
+		if (numReturned.load(std::memory_order_relaxed) - numFreed.load(std::memory_order_acquire) == capacity)
+			return nullptr;
+		return pending.exchange(nullptr, std::memory_order_acq_rel);
+	}
+
+	// Audio thread. Once for each object received;
+	void giveBack(Object* aObject)
+	{
+		const uint32_t n = numReturned.load(std::memory_order_relaxed);
+		returned[n % capacity] = aObject;
+		numReturned.store(n + 1, std::memory_order_release);
+	}
+
+private:
+	static constexpr uint32_t capacity = 8;
+
+	std::atomic<Object*> pending { nullptr };
+	Object* returned[capacity] = {};
+	std::atomic<uint32_t> numReturned { 0 };		// Written by the audio thread;
+	std::atomic<uint32_t> numFreed { 0 };			// Written by the control thread;
+};
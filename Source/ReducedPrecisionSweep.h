@@ -0,0 +1,76 @@
+/*
+  ==============================================================================
+
+    ReducedPrecisionSweep.h
+
+    The engine's dense sweep in a precision other than double. The engine
+    keeps its three time levels in double, as its frontier, level-of-detail
+    transfers, snapshots and installs expect, so a sweep loads the two
+    latest levels into its solver at the start of a block, steps the whole
+    block in the solver's precision and stores them back. That costs one
+    pass over the state per block rather than per step.
+
+    Each sweep owns its solver's state, so it belongs to one engine and is
+    only touched by its audio thread once prepared.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <memory>
+
+#include "CompactMoleculeSolver.h"
+#include "MoleculeBoundary.h"
+#include "MoleculeSolver.h"
+#include "MoleculeTopology.h"
+
+class ReducedPrecisionSweep
+{
+public:
+	virtual ~ReducedPrecisionSweep() = default;
+
+	// Advance aNumSteps steps, with the same arguments as TemporalTiler::process(). Returns the sum of squared new
+	// displacements;
+	virtual double process(double* const* aLevels, int& aIdxNMOne, int& aIdxN, int& aIdxNPOne, const float* aInput, float* const* aOutputs,
+						   int aNumSteps, const BoundaryNodes& aBoundary, double aLapCoeff, double aDampCoeff) = 0;
+};
+
+// Any solver with prepare(), setCoefficients(), load(), store() and the BoundaryNodes process(): MoleculeSolver or
+// CompactMoleculeSolver;
+template <typename Solver>
+class SolverSweep : public ReducedPrecisionSweep
+{
+public:
+	// aTopology must outlive the sweep;
+	explicit SolverSweep(const MoleculeTopology& aTopology)
+	{
+		solver.prepare(aTopology, 44100.0, 1.0);		// Rate and spacing are replaced by the coefficients of each block;
+	}
+
+	// Sweeping with aKernel, a layout built for aTopology in the solver's types, for solvers with setKernel();
+	template <typename KernelPointer>
+	SolverSweep(const MoleculeTopology& aTopology, KernelPointer aKernel)
+		: SolverSweep(aTopology)
+	{
+		solver.setKernel(std::move(aKernel));
+	}
+
+	double process(double* const* aLevels, int& aIdxNMOne, int& aIdxN, int& aIdxNPOne, const float* aInput, float* const* aOutputs,
+				   int aNumSteps, const BoundaryNodes& aBoundary, double aLapCoeff, double aDampCoeff) override
+	{
+		solver.setCoefficients(aLapCoeff, aDampCoeff);
+		solver.load(aLevels[aIdxNMOne], aLevels[aIdxN]);
+		const double energy = solver.process(aInput, aOutputs, aNumSteps, aBoundary);
+
+		const int numRotations = aNumSteps % 3;
+		aIdxNMOne = (aIdxNMOne + numRotations) % 3;
+		aIdxN = (aIdxN + numRotations) % 3;
+		aIdxNPOne = (aIdxNPOne + numRotations) % 3;
+		solver.store(aLevels[aIdxNMOne], aLevels[aIdxN]);
+		return energy;
+	}
+
+private:
+	Solver solver;
+};
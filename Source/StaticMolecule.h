@@ -0,0 +1,254 @@
+/*
+  ==============================================================================
+
+    StaticMolecule.h
+
+    Built-in molecules whose topology is known when the app is compiled. A
+    molecule is described by a struct of constexpr tables. StaticMoleculeBatch
+    then expands the sweep at compile time, one update per node and one term
+    per bond, with each node's degree and mass as constants. The state of a
+    whole block stays in locals, so small presets run with no index loads.
+
+    The interface matches MoleculeBatch, so either one can run the lanes.
+    HeadlessRender.cpp checks the two agree on InputJsonMolecule.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <utility>
+
+#include "MoleculeBatch.h"
+
+// Unit bonds between atoms of the given masses. Nodes below numClamped are held at rest, as in MoleculeTopology;
+//
+// struct MyMolecule
+// {
+//     static constexpr uint32_t numNodes = ...;
+//     static constexpr uint32_t numClamped = ...;
+//     static constexpr uint32_t rowStart[numNodes + 1] = { ... };
+//     static constexpr uint32_t neighbours[] = { ... };
+//     static constexpr float mass[numNodes] = { ... };
+//     static constexpr float posX[numNodes] = { ... };		// Editor layout;
+//     static constexpr float posY[numNodes] = { ... };
+// };
+
+// Source/input.json, laid out as in the editor;
+struct InputJsonMolecule
+{
+	static constexpr uint32_t numNodes = 6;
+	static constexpr uint32_t numClamped = 1;
+	static constexpr uint32_t rowStart[numNodes + 1] = { 0, 1, 2, 5, 8, 9, 10 };
+	static constexpr uint32_t neighbours[] = { 2, 2, 0, 1, 3, 2, 4, 5, 3, 3 };
+	static constexpr float mass[numNodes] = { 0.02f, 2.2f, 0.5f, 1.2f, 1.0f, 0.7f };
+	static constexpr float posX[numNodes] = { 330.0f, 270.0f, 300.0f, 300.0f, 270.0f, 330.0f };
+	static constexpr float posY[numNodes] = { 300.0f, 300.0f, 270.0f, 240.0f, 210.0f, 210.0f };
+};
+
+// Compile-time checks shared by every static molecule;
+template <typename Molecule>
+constexpr bool isValidStaticMolecule()
+{
+	if (Molecule::rowStart[0] != 0 || Molecule::rowStart[Molecule::numNodes] != sizeof(Molecule::neighbours) / sizeof(uint32_t))
+		return false;
+	if (Molecule::numClamped > Molecule::numNodes)
+		return false;
+	for (uint32_t i = 0; i != Molecule::numNodes; ++i)
+	{
+		if (Molecule::rowStart[i] > Molecule::rowStart[i + 1] || Molecule::mass[i] <= 0.0f)
+			return false;
+	}
+	for (uint32_t neighbour : Molecule::neighbours)
+	{
+		if (neighbour >= Molecule::numNodes)
+			return false;
+	}
+	return true;
+}
+
+// Runtime copy, e.g. to coarsen or render a built-in molecule like a loaded one;
+template <typename Molecule>
+MoleculeTopology makeTopology()
+{
+	MoleculeTopology topology;
+	topology.numNodes = Molecule::numNodes;
+	topology.numClamped = Molecule::numClamped;
+	topology.rowStart.assign(Molecule::rowStart, Molecule::rowStart + Molecule::numNodes + 1);
+	topology.neighbours.assign(std::begin(Molecule::neighbours), std::end(Molecule::neighbours));
+	topology.stiffness.assign(topology.neighbours.size(), 1.0f);
+	topology.mass.assign(Molecule::mass, Molecule::mass + Molecule::numNodes);
+	topology.finalise();
+	return topology;
+}
+
+template <typename Molecule, typename SampleType, int numLanes>
+class StaticMoleculeBatch
+{
+public:
+	static_assert(isValidStaticMolecule<Molecule>(), "Malformed static molecule");
+
+	static constexpr uint32_t numNodes = Molecule::numNodes;
+	static constexpr uint32_t numClamped = Molecule::numClamped;
+	using LaneParameters = typename MoleculeBatch<SampleType, numLanes>::LaneParameters;
+
+	void prepare(double aInternalRate, double aDeltaX)
+	{
+		deltaT = 1.0 / aInternalRate;
+		deltaX = aDeltaX;
+		for (int l = 0; l != numLanes; ++l)
+			setLaneParameters(l, lanes[l]);
+		reset();
+	}
+
+	void reset()
+	{
+		for (auto& level : displacement)
+			for (auto& block : level)
+				block = LaneBlock {};
+		for (auto& energy : laneEnergy)
+			energy = (SampleType)0;
+	}
+
+	// Driven and tapped nodes outside the molecule are ignored;
+	void setLaneParameters(int aLane, const LaneParameters& aParameters)
+	{
+		lanes[aLane] = aParameters;
+		lapCoeff[aLane] = (SampleType)(aParameters.waveSpeed * aParameters.waveSpeed * (deltaT * deltaT) / (deltaX * deltaX));
+		dampCoeff[aLane] = (SampleType)(2.0 * aParameters.genDamp * deltaT);
+
+		for (uint32_t i = 0; i != numNodes; ++i)
+		{
+			isDriven[i].lane[aLane] = (SampleType)(i >= numClamped && i == aParameters.inputNode ? 1 : 0);
+			isTapped[i].lane[aLane] = (SampleType)(i == aParameters.outputNode ? 1 : 0);
+		}
+	}
+
+	const LaneParameters& getLaneParameters(int aLane) const { return lanes[aLane]; }
+
+	SampleType getLaneEnergy(int aLane) const { return laneEnergy[aLane]; }
+
+	void process(const float* const* aInputs, float* const* aOutputs, int aNumSamples)
+	{
+		LaneBlock lap, damp, energy;
+		for (int l = 0; l != numLanes; ++l)
+		{
+			lap.lane[l] = lapCoeff[l];
+			damp.lane[l] = dampCoeff[l];
+		}
+
+		// Three time levels in locals, rotated by unrolling rather than by index, so small molecules stay in registers;
+		LaneBlock u0[numNodes], u1[numNodes], u2[numNodes];
+		for (uint32_t i = 0; i != numNodes; ++i)
+		{
+			u0[i] = displacement[0][i];
+			u1[i] = displacement[1][i];
+		}
+
+		int n = 0;
+		for (; n + 3 <= aNumSamples; n += 3)
+		{
+			step(u1, u0, u2, lap, damp, aInputs, aOutputs, n);
+			step(u2, u1, u0, lap, damp, aInputs, aOutputs, n + 1);
+			step(u0, u2, u1, lap, damp, aInputs, aOutputs, n + 2);
+		}
+
+		LaneBlock* uNMOne = u0;
+		LaneBlock* uN = u1;
+		LaneBlock* uNPOne = u2;
+		for (; n != aNumSamples; ++n)
+		{
+			step(uN, uNMOne, uNPOne, lap, damp, aInputs, aOutputs, n);
+			LaneBlock* oldest = uNMOne;
+			uNMOne = uN;
+			uN = uNPOne;
+			uNPOne = oldest;
+		}
+
+		for (uint32_t i = 0; i != numNodes; ++i)
+		{
+			displacement[0][i] = uNMOne[i];
+			displacement[1][i] = uN[i];
+			for (int l = 0; l != numLanes; ++l)
+				energy.lane[l] += uN[i].lane[l] * uN[i].lane[l];
+		}
+		for (int l = 0; l != numLanes; ++l)
+			laneEnergy[l] = energy.lane[l] / (SampleType)numNodes;
+	}
+
+	SampleType getDisplacement(uint32_t aNode, int aLane) const
+	{
+		return displacement[1][aNode].lane[aLane];
+	}
+
+	static constexpr int getNumLanes() { return numLanes; }
+
+private:
+	struct alignas(sizeof(SampleType) * numLanes) LaneBlock
+	{
+		SampleType lane[numLanes] = {};
+	};
+
+	// One time step: sweep, then drive and tap through per-node lane masks. Indexing the state by a runtime node
+	// would force it out of registers;
+	void step(const LaneBlock* aUN, const LaneBlock* aUNMOne, LaneBlock* aUNPOne, const LaneBlock& aLap, const LaneBlock& aDamp,
+			  const float* const* aInputs, float* const* aOutputs, int n) const
+	{
+		sweep(aUN, aUNMOne, aUNPOne, aLap, aDamp, std::make_integer_sequence<uint32_t, numNodes - numClamped> {});
+
+		LaneBlock in, out;
+		for (int l = 0; l != numLanes; ++l)
+			in.lane[l] = (SampleType)aInputs[l][n];
+		for (uint32_t i = 0; i != numNodes; ++i)
+		{
+			for (int l = 0; l != numLanes; ++l)
+			{
+				aUNPOne[i].lane[l] = isDriven[i].lane[l] != 0 ? in.lane[l] : aUNPOne[i].lane[l];
+				out.lane[l] += isTapped[i].lane[l] * aUNPOne[i].lane[l];
+			}
+		}
+		for (int l = 0; l != numLanes; ++l)
+			aOutputs[l][n] = (float)out.lane[l];
+	}
+
+	// Nodes numClamped..numNodes-1, each expanded separately;
+	template <uint32_t... idxNodes>
+	static void sweep(const LaneBlock* aUN, const LaneBlock* aUNMOne, LaneBlock* aUNPOne, const LaneBlock& aLap, const LaneBlock& aDamp,
+					  std::integer_sequence<uint32_t, idxNodes...>)
+	{
+		(updateNode<numClamped + idxNodes>(aUN, aUNMOne, aUNPOne, aLap, aDamp,
+										   std::make_integer_sequence<uint32_t, Molecule::rowStart[numClamped + idxNodes + 1] - Molecule::rowStart[numClamped + idxNodes]> {}), ...);
+	}
+
+	// One term per bond of node i, the bond count being its degree;
+	template <uint32_t i, uint32_t... idxBonds>
+	static void updateNode(const LaneBlock* aUN, const LaneBlock* aUNMOne, LaneBlock* aUNPOne, const LaneBlock& aLap, const LaneBlock& aDamp,
+						   std::integer_sequence<uint32_t, idxBonds...>)
+	{
+		constexpr SampleType degree = (SampleType)sizeof...(idxBonds);
+		constexpr SampleType invMass = (SampleType)(1.0f / Molecule::mass[i]);		// Rounded as MoleculeTopology stores it;
+
+		for (int l = 0; l != numLanes; ++l)
+		{
+			const SampleType tempForce = ((SampleType)0 + ... + aUN[Molecule::neighbours[Molecule::rowStart[i] + idxBonds]].lane[l]);
+			const SampleType u = aUN[i].lane[l];
+			aUNPOne[i].lane[l] = aLap.lane[l] * invMass * (tempForce - degree * u)
+				- aDamp.lane[l] * (u - aUNMOne[i].lane[l])
+				+ 2 * u - aUNMOne[i].lane[l];
+		}
+	}
+
+	double deltaT = 1.0 / 44100.0;
+	double deltaX = 0.00001;
+
+	LaneParameters lanes[numLanes];
+	SampleType lapCoeff[numLanes] = {};
+	SampleType dampCoeff[numLanes] = {};
+	SampleType laneEnergy[numLanes] = {};
+
+	LaneBlock isDriven[numNodes];		// 1 in the lanes driving each node;
+	LaneBlock isTapped[numNodes];		// 1 in the lanes tapping each node;
+	LaneBlock displacement[2][numNodes];		// [N-1, N][node];
+};
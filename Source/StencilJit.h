@@ -0,0 +1,294 @@
+/*
+  ==============================================================================
+
+    StencilJit.h
+
+    Optional runtime-specialised kernel. Once a molecule is loaded, a single
+    dense sweep is written out as straight-line C++ with the neighbour
+    indices, stiffnesses and masses baked in as constants. A background
+    thread compiles it with the system compiler and loads it with dlopen.
+    The caller collects it with takeCompiled() as a Library, which unloads
+    the code when destroyed, and keeps using the generic kernel in the
+    meantime. Wave speed, damping and time step remain runtime arguments.
+
+    The source and library are written to a directory only this instance
+    can reach, made by mkdtemp, so nothing else can plant or swap them and
+    two engines in one process never load each other's kernel. Results
+    superseded by a newer request are unloaded before anyone sees them.
+
+    Only available where dlopen is; elsewhere the generic kernel is always used.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+ #include <dlfcn.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+ #define MOLSYNTH_STENCIL_JIT 1
+#else
+ #define MOLSYNTH_STENCIL_JIT 0
+#endif
+
+#include "MoleculeTopology.h"
+#include "TraceRecorder.h"
+
+class StencilJit
+{
+public:
+	// One dense sweep over nodes numClamped..numNodes-1, the clamped nodes staying at rest. Returns the sum of squared new displacements;
+	typedef double (*StepFunction)(const double* aUN, const double* aUNMOne, double* aUNPOne, double aLapCoeff, double aDampCoeff);
+
+	static constexpr uint32_t maxNodes = 4096;		// Larger molecules take too long to compile to be worth it;
+
+	// One compiled kernel, unloaded when destroyed. Whoever destroys it must be sure no thread is still running its
+	// function;
+	class Library
+	{
+	public:
+		Library(void* aHandle, StepFunction aStepFunction, uint32_t aTag)
+			: handle(aHandle), stepFunction(aStepFunction), tag(aTag) {}
+
+		~Library()
+		{
+#if MOLSYNTH_STENCIL_JIT
+			dlclose(handle);
+#endif
+		}
+
+		Library(const Library&) = delete;
+		Library& operator=(const Library&) = delete;
+
+		StepFunction getStepFunction() const { return stepFunction; }
+
+		// As passed to compileAsync();
+		uint32_t getTag() const { return tag; }
+
+	private:
+		void* handle;
+		StepFunction stepFunction;
+		uint32_t tag;
+	};
+
+	// The worker starts with the first compileAsync();
+	StencilJit() = default;
+
+	~StencilJit()
+	{
+#if MOLSYNTH_STENCIL_JIT
+		if (worker.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(jobMutex);
+				shouldExit = true;
+			}
+			jobReady.notify_one();
+			worker.join();
+		}
+
+		completed.reset();
+		if (!directory.empty())
+			rmdir(directory.c_str());
+#endif
+	}
+
+	// Queue aTopology for compilation, replacing any pending request or result not yet taken. aTag is returned with the
+	// Library, e.g. to tell which molecule it belongs to;
+	void compileAsync(const MoleculeTopology& aTopology, uint32_t aTag)
+	{
+		cancel();
+		if (aTopology.numNodes < 2 || aTopology.numNodes > maxNodes)
+			return;
+
+		std::string source = generateSource(aTopology);
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			pendingSource = std::move(source);
+			pendingTag = aTag;
+			pendingGeneration = generation;
+			hasPendingJob = true;
+		}
+		jobReady.notify_one();
+#if MOLSYNTH_STENCIL_JIT
+		if (!worker.joinable())
+			worker = std::thread([this] { run(); });
+#endif
+	}
+
+	// Drop any pending request and result not yet taken;
+	void cancel()
+	{
+		std::unique_ptr<Library> superseded;
+		std::lock_guard<std::mutex> lock(jobMutex);
+		++generation;
+		hasPendingJob = false;
+		superseded = std::move(completed);
+	}
+
+	// The library for the last request, once it is ready, or nullptr;
+	std::unique_ptr<Library> takeCompiled()
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		return std::move(completed);
+	}
+
+	static std::string generateSource(const MoleculeTopology& aTopology)
+	{
+		std::ostringstream ss;
+		char coeff[32];
+
+		ss << "// Generated by MolecularSynthesis for a " << aTopology.numNodes << " node molecule;\n";
+		ss << "extern \"C\" double molsynth_step(const double* __restrict uN, const double* __restrict uNMOne, double* __restrict uNPOne, double lapCoeff, double dampCoeff)\n{\n";
+		ss << "\tdouble energy = 0.0;\n";
+		for (uint32_t i = aTopology.numClamped; i < aTopology.numNodes; ++i)
+		{
+			const uint32_t begin = aTopology.rowStart[i];
+			const uint32_t end = aTopology.rowStart[i + 1];
+
+			bool isUniform = true;
+			for (uint32_t e = begin; e != end; ++e)
+				isUniform = isUniform && aTopology.stiffness[e] == aTopology.stiffness[begin];
+
+			ss << "\t{ const double u = uN[" << i << "]; const double s = ";
+			if (begin == end)
+				ss << "0.0";
+			else if (isUniform)
+			{
+				std::snprintf(coeff, sizeof(coeff), "%.9g", (double)aTopology.stiffness[begin] * aTopology.invMass[i]);
+				ss << coeff << " * (";
+				for (uint32_t e = begin; e != end; ++e)
+					ss << (e != begin ? " + " : "") << "uN[" << aTopology.neighbours[e] << "]";
+				ss << ")";
+			}
+			else
+			{
+				for (uint32_t e = begin; e != end; ++e)
+				{
+					std::snprintf(coeff, sizeof(coeff), "%.9g", (double)aTopology.stiffness[e] * aTopology.invMass[i]);
+					ss << (e != begin ? " + " : "") << coeff << " * uN[" << aTopology.neighbours[e] << "]";
+				}
+			}
+
+			std::snprintf(coeff, sizeof(coeff), "%.9g", (double)aTopology.degree[i] * aTopology.invMass[i]);
+			ss << "; const double f = lapCoeff * (s - " << coeff << " * u) - dampCoeff * (u - uNMOne[" << i << "]) + 2.0 * u - uNMOne[" << i << "];"
+			   << " uNPOne[" << i << "] = f; energy += f * f; }\n";
+		}
+		ss << "\treturn energy;\n}\n";
+		return ss.str();
+	}
+
+private:
+#if MOLSYNTH_STENCIL_JIT
+	void run()
+	{
+		TRACE_THREAD("Kernel compiler");
+		for (;;)
+		{
+			std::string source;
+			uint32_t jobGeneration = 0, jobTag = 0;
+			{
+				std::unique_lock<std::mutex> lock(jobMutex);
+				jobReady.wait(lock, [this] { return shouldExit || hasPendingJob; });
+				if (shouldExit)
+					return;
+				source = std::move(pendingSource);
+				jobGeneration = pendingGeneration;
+				jobTag = pendingTag;
+				hasPendingJob = false;
+			}
+
+			TRACE_SCOPE("Compile kernel");
+			void* handle = compileAndLoad(source, jobGeneration);
+			if (handle == nullptr)
+				continue;
+
+			StepFunction function = (StepFunction)dlsym(handle, "molsynth_step");
+			auto library = std::make_unique<Library>(handle, function, jobTag);
+			if (function == nullptr)
+				continue;
+
+			// Superseded while compiling, the library is unloaded here without anyone having seen it;
+			std::lock_guard<std::mutex> lock(jobMutex);
+			if (jobGeneration == generation)
+			{
+				completed = std::move(library);
+				TRACE_INSTANT("Compiled kernel ready");
+			}
+		}
+	}
+
+	// Creates the private directory on first use. Worker thread;
+	void* compileAndLoad(const std::string& aSource, uint32_t aGeneration)
+	{
+		if (directory.empty())
+		{
+			const char* tmp = std::getenv("TMPDIR");
+			std::string pattern = std::string(tmp != nullptr && *tmp != 0 ? tmp : "/tmp") + "/molsynth_stencil_XXXXXX";
+			if (mkdtemp(&pattern[0]) == nullptr)
+				return nullptr;
+			directory = pattern;
+		}
+
+		const std::string stem = directory + "/step_" + std::to_string(aGeneration);
+		const std::string sourcePath = stem + ".cpp";
+		const std::string libraryPath = stem + ".so";
+
+		// O_EXCL fails rather than follow anything already at the path;
+		const int flSource = open(sourcePath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+		if (flSource < 0)
+			return nullptr;
+		size_t numWritten = 0;
+		while (numWritten != aSource.size())
+		{
+			const ssize_t n = write(flSource, aSource.data() + numWritten, aSource.size() - numWritten);
+			if (n <= 0)
+				break;
+			numWritten += (size_t)n;
+		}
+		close(flSource);
+		if (numWritten != aSource.size())
+		{
+			std::remove(sourcePath.c_str());
+			return nullptr;
+		}
+
+		const char* compiler = std::getenv("MOLSYNTH_CXX");
+		const std::string command = std::string(compiler != nullptr ? compiler : "c++")
+			+ " -O2 -march=native -shared -fPIC -o '" + libraryPath + "' '" + sourcePath + "' > /dev/null 2>&1";
+
+		void* handle = nullptr;
+		if (std::system(command.c_str()) == 0)
+			handle = dlopen(libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+		std::remove(sourcePath.c_str());
+		std::remove(libraryPath.c_str());		// Stays mapped while the handle is open;
+		return handle;
+	}
+
+	std::thread worker;
+	std::string directory;					// Private to this instance, worker thread only until destruction;
+#endif
+
+	// Without dlopen requests are queued and never completed, so the generic kernel always runs;
+	std::mutex jobMutex;
+	std::condition_variable jobReady;
+	bool shouldExit = false;
+	bool hasPendingJob = false;
+	std::string pendingSource;
+	uint32_t pendingTag = 0;
+	uint32_t pendingGeneration = 0;
+	uint32_t generation = 0;				// Bumped by every request, so older results are dropped. Guarded by jobMutex;
+	std::unique_ptr<Library> completed;		// Guarded by jobMutex;
+};
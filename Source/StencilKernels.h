@@ -0,0 +1,556 @@
+/*
+  ==============================================================================
+
+    StencilKernels.h
+
+    Alternative storage layouts for the dense sweep. Each kernel is a copy
+    of the topology in its own layout and updates the free nodes
+    numClamped..numNodes-1 of one time step, using the same arguments as
+    the JIT kernel. Which layout is fastest depends on the molecule's size
+    and how uneven its degrees are, so KernelTuner times them on the loaded
+    molecule. Kernels are immutable once built and keep any scratch on the
+    stack, so every engine playing a molecule can step the same one.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "MoleculeTopology.h"
+
+// StateType is what the time levels are stored in and ComputeType what each row is computed in. Double layouts compute
+// exactly as the generic kernel and the JIT do. Reduced ones sum stiffness * (u_j - u_i) and add an increment to u, as
+// MoleculeSolver does to keep float usable;
+template <typename StateType, typename ComputeType = StateType>
+class BasicStencilKernel
+{
+public:
+	virtual ~BasicStencilKernel() {}
+
+	virtual std::string getName() const = 0;
+
+	// One dense sweep over the free nodes. Returns the sum of squared new displacements;
+	virtual double step(const StateType* aUN, const StateType* aUNMOne, StateType* aUNPOne, double aLapCoeff, double aDampCoeff) const = 0;
+
+protected:
+	static constexpr bool isExact = std::is_same<StateType, double>::value && std::is_same<ComputeType, double>::value;
+
+	// Per-bond weight stiffness / mass of the row's node;
+	static ComputeType getWeight(const MoleculeTopology& aTopology, uint32_t i, uint32_t e)
+	{
+		return (ComputeType)((double)aTopology.stiffness[e] * aTopology.invMass[i]);
+	}
+
+	// Diagonal term degree / mass, only used by exact layouts;
+	static ComputeType getDiagonal(const MoleculeTopology& aTopology, uint32_t i)
+	{
+		return (ComputeType)((double)aTopology.degree[i] * aTopology.invMass[i]);
+	}
+
+	// One bond's share of the row's sum;
+	static ComputeType bond(ComputeType aWeight, ComputeType uJ, ComputeType u)
+	{
+		if constexpr (isExact)
+			return aWeight * uJ;
+		else
+			return aWeight * (uJ - u);
+	}
+
+	// aKeepCoeff is 1 - aDampCoeff, which the reduced update uses;
+	static StateType update(ComputeType aSum, ComputeType aDiagonal, ComputeType u, ComputeType uMOne, ComputeType aLapCoeff, ComputeType aDampCoeff,
+							ComputeType aKeepCoeff)
+	{
+		if constexpr (isExact)
+			return aLapCoeff * (aSum - aDiagonal * u) - aDampCoeff * (u - uMOne) + 2.0 * u - uMOne;
+		else
+			return (StateType)(u + (aKeepCoeff * (u - uMOne) + aLapCoeff * aSum));
+	}
+};
+
+typedef BasicStencilKernel<double> StencilKernel;
+
+//==============================================================================
+// Compressed sparse rows, as the generic kernel;
+template <typename StateType, typename ComputeType = StateType>
+class BasicCsrKernel : public BasicStencilKernel<StateType, ComputeType>
+{
+public:
+	typedef BasicStencilKernel<StateType, ComputeType> Base;
+
+	explicit BasicCsrKernel(const MoleculeTopology& aTopology)
+		: numNodes(aTopology.numNodes), numClamped(aTopology.numClamped), rowStart(aTopology.rowStart), neighbours(aTopology.neighbours),
+		  weight(aTopology.neighbours.size()), diagonal(aTopology.numNodes)
+	{
+		for (uint32_t i = 0; i != numNodes; ++i)
+		{
+			for (uint32_t e = rowStart[i]; e != rowStart[i + 1]; ++e)
+				weight[e] = Base::getWeight(aTopology, i, e);
+			diagonal[i] = Base::getDiagonal(aTopology, i);
+		}
+	}
+
+	std::string getName() const override { return "CSR"; }
+
+	double step(const StateType* aUN, const StateType* aUNMOne, StateType* aUNPOne, double aLapCoeff, double aDampCoeff) const override
+	{
+		const ComputeType lapCoeff = (ComputeType)aLapCoeff, dampCoeff = (ComputeType)aDampCoeff, keepCoeff = (ComputeType)(1.0 - aDampCoeff);
+		ComputeType energy = 0;
+		for (uint32_t i = numClamped; i < numNodes; ++i)
+		{
+			const ComputeType u = aUN[i];
+			ComputeType sum = 0;
+			for (uint32_t e = rowStart[i]; e != rowStart[i + 1]; ++e)
+				sum += Base::bond(weight[e], aUN[neighbours[e]], u);
+
+			const StateType f = Base::update(sum, diagonal[i], u, aUNMOne[i], lapCoeff, dampCoeff, keepCoeff);
+			aUNPOne[i] = f;
+			energy += (ComputeType)f * f;
+		}
+		return energy;
+	}
+
+private:
+	uint32_t numNodes;
+	uint32_t numClamped;
+	std::vector<uint32_t> rowStart;
+	std::vector<uint32_t> neighbours;
+	std::vector<ComputeType> weight;
+	std::vector<ComputeType> diagonal;
+};
+
+typedef BasicCsrKernel<double> CsrKernel;
+
+//==============================================================================
+// ELLPACK: every row padded to the largest degree and stored slot-major, so each slot is a unit-stride pass over
+// the rows. Rows are summed in blocks that fit a stack buffer. Padding points at the row's own node with zero weight;
+template <typename StateType, typename ComputeType = StateType>
+class BasicEllKernel : public BasicStencilKernel<StateType, ComputeType>
+{
+public:
+	typedef BasicStencilKernel<StateType, ComputeType> Base;
+
+	explicit BasicEllKernel(const MoleculeTopology& aTopology)
+		: numNodes(aTopology.numNodes), firstRow(std::min(aTopology.numClamped, aTopology.numNodes)), numRows(numNodes - firstRow),
+		  diagonal(numRows)
+	{
+		for (uint32_t i = firstRow; i < numNodes; ++i)
+			width = std::max(width, aTopology.rowStart[i + 1] - aTopology.rowStart[i]);
+
+		neighbours.resize((size_t)width * numRows);
+		weight.assign((size_t)width * numRows, 0);
+		for (uint32_t r = 0; r != numRows; ++r)
+		{
+			const uint32_t i = firstRow + r;
+			for (uint32_t k = 0; k != width; ++k)
+			{
+				const uint32_t e = aTopology.rowStart[i] + k;
+				const bool isBond = e < aTopology.rowStart[i + 1];
+				neighbours[(size_t)k * numRows + r] = isBond ? aTopology.neighbours[e] : i;
+				weight[(size_t)k * numRows + r] = isBond ? Base::getWeight(aTopology, i, e) : 0;
+			}
+			diagonal[r] = Base::getDiagonal(aTopology, i);
+		}
+	}
+
+	std::string getName() const override { return "ELL"; }
+
+	double step(const StateType* aUN, const StateType* aUNMOne, StateType* aUNPOne, double aLapCoeff, double aDampCoeff) const override
+	{
+		const ComputeType lapCoeff = (ComputeType)aLapCoeff, dampCoeff = (ComputeType)aDampCoeff, keepCoeff = (ComputeType)(1.0 - aDampCoeff);
+		ComputeType energy = 0;
+		for (uint32_t firstBlockRow = 0; firstBlockRow < numRows; firstBlockRow += blockRows)
+		{
+			const uint32_t numBlockRows = std::min(blockRows, numRows - firstBlockRow);
+			const StateType* uRow = aUN + firstRow + firstBlockRow;
+			ComputeType sum[blockRows] = {};
+			for (uint32_t k = 0; k != width; ++k)
+			{
+				const uint32_t* slotNeighbours = neighbours.data() + (size_t)k * numRows + firstBlockRow;
+				const ComputeType* slotWeight = weight.data() + (size_t)k * numRows + firstBlockRow;
+				for (uint32_t r = 0; r != numBlockRows; ++r)
+					sum[r] += Base::bond(slotWeight[r], aUN[slotNeighbours[r]], uRow[r]);
+			}
+
+			for (uint32_t r = 0; r != numBlockRows; ++r)
+			{
+				const uint32_t i = firstRow + firstBlockRow + r;
+				const StateType f = Base::update(sum[r], diagonal[firstBlockRow + r], aUN[i], aUNMOne[i], lapCoeff, dampCoeff, keepCoeff);
+				aUNPOne[i] = f;
+				energy += (ComputeType)f * f;
+			}
+		}
+		return energy;
+	}
+
+private:
+	static constexpr uint32_t blockRows = 512;		// At most 4 kB of sums, well inside L1;
+
+	uint32_t numNodes;
+	uint32_t firstRow;					// Rows are the free nodes, starting after the clamped ones;
+	uint32_t numRows;
+	uint32_t width = 0;
+	std::vector<uint32_t> neighbours;	// [slot][row];
+	std::vector<ComputeType> weight;	// [slot][row];
+	std::vector<ComputeType> diagonal;
+};
+
+typedef BasicEllKernel<double> EllKernel;
+
+//==============================================================================
+// SELL-C-sigma: rows sorted by degree within windows of sigma rows, then cut into chunks of C rows, each padded
+// only to its own widest row. Keeps ELLPACK's unit-stride slots without padding everything to the hub atoms.
+// The last chunk's padding lanes are accumulated but never stored;
+template <typename StateType, typename ComputeType, uint32_t chunkSize, uint32_t sigma>
+class BasicSellKernel : public BasicStencilKernel<StateType, ComputeType>
+{
+public:
+	typedef BasicStencilKernel<StateType, ComputeType> Base;
+
+	static_assert(sigma % chunkSize == 0, "sigma must be a multiple of the chunk size");
+
+	explicit BasicSellKernel(const MoleculeTopology& aTopology)
+	{
+		const uint32_t firstRow = std::min(aTopology.numClamped, aTopology.numNodes);
+		numRows = aTopology.numNodes - firstRow;
+		auto getDegree = [&aTopology](uint32_t i) { return aTopology.rowStart[i + 1] - aTopology.rowStart[i]; };
+
+		std::vector<uint32_t> order(numRows);
+		std::iota(order.begin(), order.end(), firstRow);
+		for (uint32_t w = 0; w < numRows; w += sigma)
+		{
+			std::stable_sort(order.begin() + w, order.begin() + std::min(numRows, w + sigma),
+							 [&getDegree](uint32_t a, uint32_t b) { return getDegree(a) > getDegree(b); });
+		}
+
+		numChunks = (numRows + chunkSize - 1) / chunkSize;
+		rowNode.assign((size_t)numChunks * chunkSize, 0);
+		diagonal.assign((size_t)numChunks * chunkSize, 0);
+		chunkStart.assign(1, 0);
+		for (uint32_t c = 0; c != numChunks; ++c)
+		{
+			uint32_t chunkWidth = 0;
+			for (uint32_t lane = 0; lane != chunkSize && c * chunkSize + lane < numRows; ++lane)
+				chunkWidth = std::max(chunkWidth, getDegree(order[c * chunkSize + lane]));
+
+			const size_t base = neighbours.size();
+			neighbours.resize(base + (size_t)chunkWidth * chunkSize, 0);
+			weight.resize(base + (size_t)chunkWidth * chunkSize, 0);
+			for (uint32_t lane = 0; lane != chunkSize && c * chunkSize + lane < numRows; ++lane)
+			{
+				const uint32_t i = order[c * chunkSize + lane];
+				rowNode[c * chunkSize + lane] = i;
+				diagonal[c * chunkSize + lane] = Base::getDiagonal(aTopology, i);
+				for (uint32_t k = 0; k != chunkWidth; ++k)
+				{
+					const uint32_t e = aTopology.rowStart[i] + k;
+					const bool isBond = e < aTopology.rowStart[i + 1];
+					neighbours[base + (size_t)k * chunkSize + lane] = isBond ? aTopology.neighbours[e] : i;
+					weight[base + (size_t)k * chunkSize + lane] = isBond ? Base::getWeight(aTopology, i, e) : 0;
+				}
+			}
+			chunkStart.push_back((uint32_t)neighbours.size());
+		}
+	}
+
+	std::string getName() const override { return "SELL-" + std::to_string(chunkSize) + "-" + std::to_string(sigma); }
+
+	double step(const StateType* aUN, const StateType* aUNMOne, StateType* aUNPOne, double aLapCoeff, double aDampCoeff) const override
+	{
+		const ComputeType lapCoeff = (ComputeType)aLapCoeff, dampCoeff = (ComputeType)aDampCoeff, keepCoeff = (ComputeType)(1.0 - aDampCoeff);
+		ComputeType energy = 0;
+		for (uint32_t c = 0; c != numChunks; ++c)
+		{
+			const uint32_t* nodes = rowNode.data() + (size_t)c * chunkSize;
+			ComputeType u[chunkSize];
+			for (uint32_t lane = 0; lane != chunkSize; ++lane)
+				u[lane] = aUN[nodes[lane]];
+
+			ComputeType sum[chunkSize] = {};
+			for (uint32_t idx = chunkStart[c]; idx != chunkStart[c + 1]; idx += chunkSize)
+			{
+				for (uint32_t lane = 0; lane != chunkSize; ++lane)
+					sum[lane] += Base::bond(weight[idx + lane], aUN[neighbours[idx + lane]], u[lane]);
+			}
+
+			const ComputeType* diag = diagonal.data() + (size_t)c * chunkSize;
+			const uint32_t numLanes = std::min(chunkSize, numRows - c * chunkSize);
+			for (uint32_t lane = 0; lane != numLanes; ++lane)
+			{
+				const uint32_t i = nodes[lane];
+				const StateType f = Base::update(sum[lane], diag[lane], u[lane], aUNMOne[i], lapCoeff, dampCoeff, keepCoeff);
+				aUNPOne[i] = f;
+				energy += (ComputeType)f * f;
+			}
+		}
+		return energy;
+	}
+
+private:
+	uint32_t numRows = 0;
+	uint32_t numChunks = 0;
+	std::vector<uint32_t> chunkStart;	// Offsets into neighbours, numChunks + 1;
+	std::vector<uint32_t> neighbours;	// [chunk][slot][lane];
+	std::vector<ComputeType> weight;	// [chunk][slot][lane];
+	std::vector<uint32_t> rowNode;		// [chunk][lane] -> node;
+	std::vector<ComputeType> diagonal;	// [chunk][lane];
+};
+
+template <uint32_t chunkSize, uint32_t sigma>
+using SellKernel = BasicSellKernel<double, double, chunkSize, sigma>;
+
+//==============================================================================
+// Nodes grouped by degree, so the bond loop of each group has a fixed trip count. Degrees up to maxUnrolledDegree
+// are fully unrolled, which covers carbon lattices;
+template <typename StateType, typename ComputeType = StateType>
+class BasicBucketedKernel : public BasicStencilKernel<StateType, ComputeType>
+{
+public:
+	typedef BasicStencilKernel<StateType, ComputeType> Base;
+
+	static constexpr uint32_t maxUnrolledDegree = 4;
+
+	explicit BasicBucketedKernel(const MoleculeTopology& aTopology)
+	{
+		for (uint32_t i = aTopology.numClamped; i < aTopology.numNodes; ++i)
+		{
+			const uint32_t degree = aTopology.rowStart[i + 1] - aTopology.rowStart[i];
+			if (degree >= buckets.size())
+				buckets.resize(degree + 1);
+
+			Bucket& bucket = buckets[degree];
+			bucket.nodes.push_back(i);
+			bucket.diagonal.push_back(Base::getDiagonal(aTopology, i));
+			for (uint32_t e = aTopology.rowStart[i]; e != aTopology.rowStart[i + 1]; ++e)
+			{
+				bucket.neighbours.push_back(aTopology.neighbours[e]);
+				bucket.weight.push_back(Base::getWeight(aTopology, i, e));
+			}
+		}
+	}
+
+	std::string getName() const override { return "Bucketed"; }
+
+	double step(const StateType* aUN, const StateType* aUNMOne, StateType* aUNPOne, double aLapCoeff, double aDampCoeff) const override
+	{
+		const Coefficients coeffs { (ComputeType)aLapCoeff, (ComputeType)aDampCoeff, (ComputeType)(1.0 - aDampCoeff) };
+		ComputeType energy = 0;
+		for (uint32_t degree = 0; degree != (uint32_t)buckets.size(); ++degree)
+		{
+			const Bucket& bucket = buckets[degree];
+			switch (degree)
+			{
+				case 0:  energy += sweepBucket(bucket, FixedDegree<0> {}, aUN, aUNMOne, aUNPOne, coeffs); break;
+				case 1:  energy += sweepBucket(bucket, FixedDegree<1> {}, aUN, aUNMOne, aUNPOne, coeffs); break;
+				case 2:  energy += sweepBucket(bucket, FixedDegree<2> {}, aUN, aUNMOne, aUNPOne, coeffs); break;
+				case 3:  energy += sweepBucket(bucket, FixedDegree<3> {}, aUN, aUNMOne, aUNPOne, coeffs); break;
+				case 4:  energy += sweepBucket(bucket, FixedDegree<4> {}, aUN, aUNMOne, aUNPOne, coeffs); break;
+				default: energy += sweepBucket(bucket, degree, aUN, aUNMOne, aUNPOne, coeffs); break;
+			}
+		}
+		return energy;
+	}
+
+private:
+	struct Bucket
+	{
+		std::vector<uint32_t> nodes;
+		std::vector<ComputeType> diagonal;
+		std::vector<uint32_t> neighbours;	// [node][degree];
+		std::vector<ComputeType> weight;	// [node][degree];
+	};
+
+	struct Coefficients
+	{
+		ComputeType lap, damp, keep;
+	};
+
+	template <uint32_t degree>
+	using FixedDegree = std::integral_constant<uint32_t, degree>;
+
+	// aDegree is either a FixedDegree, making the bond loop trip count a constant, or a plain uint32_t;
+	template <typename DegreeType>
+	static ComputeType sweepBucket(const Bucket& aBucket, DegreeType aDegree, const StateType* aUN, const StateType* aUNMOne, StateType* aUNPOne,
+								   const Coefficients& aCoeffs)
+	{
+		const uint32_t degree = aDegree;
+		const uint32_t* neighbours = aBucket.neighbours.data();
+		const ComputeType* weight = aBucket.weight.data();
+
+		ComputeType energy = 0;
+		for (size_t k = 0; k != aBucket.nodes.size(); ++k)
+		{
+			const uint32_t i = aBucket.nodes[k];
+			const ComputeType u = aUN[i];
+			ComputeType sum = 0;
+			for (uint32_t e = 0; e != degree; ++e)
+				sum += Base::bond(weight[k * degree + e], aUN[neighbours[k * degree + e]], u);
+
+			const StateType f = Base::update(sum, aBucket.diagonal[k], u, aUNMOne[i], aCoeffs.lap, aCoeffs.damp, aCoeffs.keep);
+			aUNPOne[i] = f;
+			energy += (ComputeType)f * f;
+		}
+		return energy;
+	}
+
+	std::vector<Bucket> buckets;		// Indexed by degree;
+};
+
+typedef BasicBucketedKernel<double> BucketedKernel;
+
+//==============================================================================
+// Small molecules as a dense matrix with the diagonal folded in. Wasteful in arithmetic, but the row loop is
+// contiguous and free of index loads. Lane-wise accumulators let it vectorise without fast-math;
+class DenseSmallKernel : public StencilKernel
+{
+public:
+	static constexpr uint32_t maxNodes = 32;
+
+	explicit DenseSmallKernel(const MoleculeTopology& aTopology)
+		: numNodes(aTopology.numNodes), numClamped(aTopology.numClamped), stride((aTopology.numNodes + simdWidth - 1) / simdWidth * simdWidth),
+		  matrix((size_t)aTopology.numNodes * stride, 0.0)
+	{
+		for (uint32_t i = numClamped; i < numNodes; ++i)
+		{
+			for (uint32_t e = aTopology.rowStart[i]; e != aTopology.rowStart[i + 1]; ++e)
+				matrix[(size_t)i * stride + aTopology.neighbours[e]] += getWeight(aTopology, i, e);
+			matrix[(size_t)i * stride + i] -= getDiagonal(aTopology, i);
+		}
+	}
+
+	std::string getName() const override { return "DenseSmall"; }
+
+	double step(const double* aUN, const double* aUNMOne, double* aUNPOne, double aLapCoeff, double aDampCoeff) const override
+	{
+		double state[maxStride] = {};		// Current displacements, zero padded to stride;
+		std::copy(aUN, aUN + numNodes, state);
+
+		double energy = 0.0;
+		for (uint32_t i = numClamped; i < numNodes; ++i)
+		{
+			const double* row = matrix.data() + (size_t)i * stride;
+			double lanes[simdWidth] = {};
+			for (uint32_t j = 0; j != stride; j += simdWidth)
+			{
+				for (uint32_t l = 0; l != simdWidth; ++l)
+					lanes[l] += row[j + l] * state[j + l];
+			}
+
+			double sum = 0.0;
+			for (uint32_t l = 0; l != simdWidth; ++l)
+				sum += lanes[l];
+
+			const double f = update(sum, 0.0, aUN[i], aUNMOne[i], aLapCoeff, aDampCoeff, 1.0 - aDampCoeff);
+			aUNPOne[i] = f;
+			energy += f * f;
+		}
+		return energy;
+	}
+
+private:
+	static constexpr uint32_t simdWidth = 4;
+	static constexpr uint32_t maxStride = (maxNodes + simdWidth - 1) / simdWidth * simdWidth;
+
+	uint32_t numNodes;
+	uint32_t numClamped;
+	uint32_t stride;				// Row length padded to simdWidth;
+	std::vector<double> matrix;		// [row][column];
+};
+
+//==============================================================================
+// Every layout worth trying on aTopology, generic CSR first. The dense matrix folds the diagonal in, so it is exact only;
+template <typename StateType = double, typename ComputeType = StateType>
+std::vector<std::unique_ptr<BasicStencilKernel<StateType, ComputeType>>> makeStencilKernels(const MoleculeTopology& aTopology)
+{
+	std::vector<std::unique_ptr<BasicStencilKernel<StateType, ComputeType>>> kernels;
+	kernels.emplace_back(new BasicCsrKernel<StateType, ComputeType>(aTopology));
+	kernels.emplace_back(new BasicEllKernel<StateType, ComputeType>(aTopology));
+	kernels.emplace_back(new BasicSellKernel<StateType, ComputeType, 8, 64>(aTopology));
+	kernels.emplace_back(new BasicBucketedKernel<StateType, ComputeType>(aTopology));
+	if constexpr (std::is_same<StateType, double>::value && std::is_same<ComputeType, double>::value)
+	{
+		if (aTopology.numNodes <= DenseSmallKernel::maxNodes)
+			kernels.emplace_back(new DenseSmallKernel(aTopology));
+	}
+	return kernels;
+}
+
+// The layout named aName in StateType and ComputeType, such as the tuner's pick for the exact sweep, or CSR if there
+// is none of that name;
+template <typename StateType, typename ComputeType = StateType>
+std::unique_ptr<BasicStencilKernel<StateType, ComputeType>> makeStencilKernel(const std::string& aName, const MoleculeTopology& aTopology)
+{
+	for (auto& kernel : makeStencilKernels<StateType, ComputeType>(aTopology))
+	{
+		if (kernel->getName() == aName)
+			return std::move(kernel);
+	}
+	return std::make_unique<BasicCsrKernel<StateType, ComputeType>>(aTopology);
+}
+
+//==============================================================================
+// KernelTuner's pick for one compiled molecule, shared by every engine playing it. The first engine to claim it
+// tunes and publishes the winner, and the others take that instead of tuning again;
+class KernelChoice
+{
+public:
+	// Returns true if the caller is now the one to tune, and must publish() or release();
+	bool claim()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (isClaimed || isChosen)
+			return false;
+		isClaimed = true;
+		return true;
+	}
+
+	// Give up a claim without a result, as when the claimant moves on to another molecule;
+	void release()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		isClaimed = false;
+	}
+
+	// aKernel is nullptr when tiling won;
+	void publish(std::shared_ptr<const StencilKernel> aKernel, bool aIsTiled)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		kernel = std::move(aKernel);
+		isTiled = aIsTiled;
+		isChosen = true;
+		isClaimed = false;
+	}
+
+	// Whether the choice has been published, and if so what it is;
+	bool get(std::shared_ptr<const StencilKernel>& aKernel, bool& aIsTiled) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (isChosen)
+		{
+			aKernel = kernel;
+			aIsTiled = isTiled;
+		}
+		return isChosen;
+	}
+
+	bool isUnclaimed() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return !isClaimed && !isChosen;
+	}
+
+private:
+	mutable std::mutex mutex;
+	std::shared_ptr<const StencilKernel> kernel;
+	bool isTiled = false;
+	bool isChosen = false;
+	bool isClaimed = false;
+};
@@ -0,0 +1,241 @@
+/*
+  ==============================================================================
+
+    TemporalTiler.h
+
+    Time-skewed tiling of the dense sweep for molecules too big for cache.
+    The topology is expected in a bandwidth-reduced order (see
+    MoleculeOrdering.h), so every bond spans at most `bandwidth` rows and the
+    molecule behaves like a 1D stencil of that radius. Tiles of rows are then
+    advanced up to maxDepth steps each, shifting left by one bandwidth per
+    step so every dependency has already been computed.
+
+    Intermediate time levels live in small ring buffers indexed by row modulo
+    windowRows. They stay in cache, so each block of depth steps streams the
+    full state through memory about once instead of once per step.
+
+    The tables prepare() derives from the topology are immutable and shared
+    by copies, so tilers copied from one prepared tiler only own their ring
+    buffers.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "MoleculeBoundary.h"
+#include "MoleculeOrdering.h"
+
+class TemporalTiler
+{
+public:
+	static constexpr int maxDepth = 8;
+
+	// Returns whether tiling is worthwhile: the working set must exceed aCacheBytes and the band must be narrow
+	// enough for tiles to overlap little;
+	bool prepare(const MoleculeTopology& aTopology, size_t aCacheBytes)
+	{
+		auto newPlan = std::make_shared<Plan>();
+		Plan& p = *newPlan;
+		p.numNodes = aTopology.numNodes;
+		p.numClamped = std::min(aTopology.numClamped, aTopology.numNodes);
+		p.rowStart = aTopology.rowStart;
+		p.neighbours = aTopology.neighbours;
+		p.weight.resize(p.neighbours.size());
+		p.diagonal.resize(p.numNodes);
+		for (uint32_t i = 0; i != p.numNodes; ++i)
+		{
+			for (uint32_t e = p.rowStart[i]; e != p.rowStart[i + 1]; ++e)
+				p.weight[e] = (double)aTopology.stiffness[e] * aTopology.invMass[i];
+			p.diagonal[i] = (double)aTopology.degree[i] * aTopology.invMass[i];
+		}
+		p.bandwidth = std::max(1u, getBandwidth(aTopology));
+
+		// Three time levels plus the row's share of the topology;
+		const size_t bytesPerRow = 4 * sizeof(double) + sizeof(uint32_t) + (p.numNodes > 0 ? p.neighbours.size() / p.numNodes : 0) * (sizeof(uint32_t) + sizeof(double));
+		const size_t bytesPerTileRow = bytesPerRow + maxDepth * sizeof(double);
+
+		// Tiles take about half the cache, and must be wide compared to the skew across their depth;
+		p.tileRows = std::max((uint32_t)(aCacheBytes / 2 / bytesPerTileRow), 4 * p.bandwidth * maxDepth);
+		p.windowRows = 1;
+		while (p.windowRows < p.tileRows + 2 * p.bandwidth)
+			p.windowRows *= 2;
+
+		p.isWorthwhile = (size_t)p.numNodes * bytesPerRow > aCacheBytes && (size_t)p.tileRows * 2 <= p.numNodes;
+		plan = std::move(newPlan);
+		window.assign((size_t)maxDepth * plan->windowRows, 0.0);
+		return plan->isWorthwhile;
+	}
+
+	bool isActive() const { return plan != nullptr && plan->isWorthwhile; }
+
+	// Bytes of the shared tables, which copies don't duplicate;
+	size_t getSharedBytes() const
+	{
+		if (plan == nullptr)
+			return 0;
+		return plan->rowStart.size() * sizeof(uint32_t) + plan->neighbours.size() * sizeof(uint32_t)
+			   + (plan->weight.size() + plan->diagonal.size()) * sizeof(double);
+	}
+
+	// Advance aNumSteps (at most maxDepth) steps. aLevels are the caller's three time levels, selected by rotation
+	// indices in cyclic order, which are updated to point at the new N-1, N and spare levels on return. aInput[t] drives
+	// aBoundary's driven nodes and each of its pickups is added to aOutputs[channel][t] after step t, as in the generic
+	// kernel. Returns the sum of squared new displacements;
+	double process(double* const* aLevels, int& aIdxNMOne, int& aIdxN, int& aIdxNPOne, const float* aInput, float* const* aOutputs, int aNumSteps,
+				   const BoundaryNodes& aBoundary, double aLapCoeff, double aDampCoeff)
+	{
+		const int depth = std::min(aNumSteps, maxDepth);
+		const uint32_t numNodes = plan->numNodes;
+		const uint32_t bandwidth = plan->bandwidth;
+		const uint32_t tileRows = plan->tileRows;
+		const uint32_t windowRows = plan->windowRows;
+		double* levelNMOne = aLevels[aIdxNMOne];
+		double* levelN = aLevels[aIdxN];
+		double* levelSpare = aLevels[aIdxNPOne];
+
+		// Level n-1 is only read by each row's own first step, so it can take level n+depth. Level n is read by the
+		// first two steps of neighbouring rows and is left alone. This keeps the three indices in the cyclic order
+		// the caller's per-step rotation relies on;
+		const LevelView full[2] = { { levelNMOne, fullMask }, { levelN, fullMask } };
+		auto getLevel = [&](int t) -> LevelView
+		{
+			if (t <= 0)
+				return full[t + 1];
+			return { window.data() + (size_t)(t - 1) * windowRows, windowRows - 1 };
+		};
+
+		double energy = 0.0;
+		const int64_t numTiles = ((int64_t)numNodes + (int64_t)depth * bandwidth + tileRows - 1) / tileRows;
+		for (int64_t k = 0; k != numTiles; ++k)
+		{
+			for (int t = 1; t <= depth; ++t)
+			{
+				const int64_t skew = (int64_t)t * bandwidth;
+				const uint32_t begin = (uint32_t)std::max<int64_t>(0, k * tileRows - skew);
+				const uint32_t end = (uint32_t)std::min<int64_t>(numNodes, (k + 1) * tileRows - skew);
+				if (begin >= end)
+					continue;
+
+				double* finalLevel = nullptr;
+				if (t == depth)
+					finalLevel = depth >= 2 ? levelNMOne : levelSpare;
+				else if (t == depth - 1)
+					finalLevel = levelSpare;
+				energy += sweepRows(begin, end, getLevel(t - 1), getLevel(t - 2), getLevel(t), finalLevel,
+									aInput[t - 1], aOutputs, t - 1, aBoundary, aLapCoeff, aDampCoeff);
+			}
+		}
+
+		// One step rotates the levels once as usual. Two or more land on the old N-1 and spare, which is two rotations;
+		const int numRotations = depth >= 2 ? 2 : 1;
+		aIdxNMOne = (aIdxNMOne + numRotations) % 3;
+		aIdxN = (aIdxN + numRotations) % 3;
+		aIdxNPOne = (aIdxNPOne + numRotations) % 3;
+		return energy;
+	}
+
+	uint32_t getBandwidthRows() const { return plan != nullptr ? plan->bandwidth : 1u; }
+	uint32_t getTileRows() const { return plan != nullptr ? plan->tileRows : 1u; }
+
+private:
+	static constexpr uint32_t fullMask = UINT32_MAX;
+
+	// Everything prepare() derives from the topology, read-only once built;
+	struct Plan
+	{
+		uint32_t numNodes = 0;
+		uint32_t numClamped = 0;
+		std::vector<uint32_t> rowStart;
+		std::vector<uint32_t> neighbours;
+		std::vector<double> weight;
+		std::vector<double> diagonal;
+
+		uint32_t bandwidth = 1;
+		uint32_t tileRows = 1;
+		uint32_t windowRows = 1;		// Power of two, at least tileRows + 2 * bandwidth;
+		bool isWorthwhile = false;
+	};
+
+	// A time level, either a full array or a ring buffer indexed by row & mask;
+	struct LevelView
+	{
+		double* data;
+		uint32_t mask;
+	};
+
+	double sweepRows(uint32_t aBegin, uint32_t aEnd, LevelView aUN, LevelView aUNMOne, LevelView aUNPOne, double* aFinal,
+					 float aInput, float* const* aOutputs, int aIdxOutput, const BoundaryNodes& aBoundary, double aLapCoeff, double aDampCoeff)
+	{
+		// Clamped rows carry their value forward, as ring buffer levels must hold them for their neighbours;
+		const uint32_t rangeBegin = aBegin;
+		for (; aBegin < aEnd && aBegin < plan->numClamped; ++aBegin)
+		{
+			aUNPOne.data[aBegin & aUNPOne.mask] = aUN.data[aBegin & aUN.mask];
+			if (aFinal != nullptr)
+				aFinal[aBegin] = aUN.data[aBegin & aUN.mask];
+		}
+
+		double energy = aFinal != nullptr ? sweepRange<true>(aBegin, aEnd, aUN, aUNMOne, aUNPOne, aFinal, aLapCoeff, aDampCoeff)
+										  : sweepRange<false>(aBegin, aEnd, aUN, aUNMOne, aUNPOne, aFinal, aLapCoeff, aDampCoeff);
+
+		// Boundary conditions are applied after the range so the row loop stays branch-free;
+		for (const auto& d : aBoundary.driven)
+		{
+			if (d.index >= aBegin && d.index < aEnd)
+			{
+				const double value = (double)(d.weight * aInput);
+				double& driven = aUNPOne.data[d.index & aUNPOne.mask];
+				energy += value * value - driven * driven;
+				driven = value;
+				if (aFinal != nullptr)
+					aFinal[d.index] = value;
+			}
+		}
+		for (uint32_t c = 0; c != aBoundary.numChannels; ++c)
+		{
+			for (const auto& p : aBoundary.pickups[c])
+			{
+				if (p.index >= rangeBegin && p.index < aEnd)
+					aOutputs[c][aIdxOutput] += p.weight * (float)aUNPOne.data[p.index & aUNPOne.mask];
+			}
+		}
+		return energy;
+	}
+
+	template <bool isFinal>
+	double sweepRange(uint32_t aBegin, uint32_t aEnd, LevelView aUN, LevelView aUNMOne, LevelView aUNPOne, double* aFinal,
+					  double aLapCoeff, double aDampCoeff) const
+	{
+		const uint32_t* rows = plan->rowStart.data();
+		const uint32_t* bonds = plan->neighbours.data();
+		const double* weights = plan->weight.data();
+		const double* diagonal = plan->diagonal.data();
+
+		double energy = 0.0;
+		for (uint32_t r = aBegin; r < aEnd; ++r)
+		{
+			double sum = 0.0;
+			for (uint32_t e = rows[r]; e != rows[r + 1]; ++e)
+				sum += weights[e] * aUN.data[bonds[e] & aUN.mask];
+
+			const double u = aUN.data[r & aUN.mask];
+			const double uMOne = aUNMOne.data[r & aUNMOne.mask];
+			const double f = aLapCoeff * (sum - diagonal[r] * u) - aDampCoeff * (u - uMOne) + 2.0 * u - uMOne;
+
+			aUNPOne.data[r & aUNPOne.mask] = f;
+			if (isFinal)
+				aFinal[r] = f;
+			energy += f * f;
+		}
+		return energy;
+	}
+
+	std::shared_ptr<const Plan> plan;
+	std::vector<double> window;		// [level n+1 .. n+maxDepth][row & (plan->windowRows - 1)], owned by each copy;
+};
@@ -0,0 +1,240 @@
+/*
+  ==============================================================================
+
+    TraceRecorder.h
+
+    Timeline tracing across the audio callback, UI timer, paint and worker
+    threads, written as Chrome trace-event JSON for chrome://tracing or
+    ui.perfetto.dev. Each thread records complete events into its own
+    fixed ring; a background thread drains the rings to disk, so recording
+    is a couple of stores with no lock or allocation. Rings that fill
+    between flushes drop events and count them.
+
+    Unless MOLSYNTH_TRACING is defined to 1 all of this is compiled out and
+    TRACE_SCOPE, TRACE_INSTANT and TRACE_THREAD expand to nothing. Event
+    and thread names must be string literals.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#ifndef MOLSYNTH_TRACING
+ #define MOLSYNTH_TRACING 0
+#endif
+
+#if MOLSYNTH_TRACING
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class TraceRecorder
+{
+public:
+	static constexpr int maxThreads = 32;
+	static constexpr uint32_t eventsPerThread = 8192;		// Power of two;
+	static constexpr uint64_t instantEvent = UINT64_MAX;	// Duration of an event with none;
+
+	static TraceRecorder& getInstance()
+	{
+		static TraceRecorder recorder;
+		return recorder;
+	}
+
+	// Nanoseconds since the recorder was created;
+	static uint64_t now()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - getInstance().origin).count();
+	}
+
+	// Write events to aPath until stop(), draining every aFlushMilliseconds;
+	void start(const std::string& aPath, int aFlushMilliseconds = 50)
+	{
+		stop();
+		flTrace.open(aPath);
+		isFirstEvent = true;
+		for (int t = 0; t != maxThreads; ++t)
+		{
+			buffers[t].isNameWritten = false;
+			buffers[t].numDroppedWritten = buffers[t].numDropped.load();
+		}
+		flTrace << "[\n";
+
+		isRunning = true;
+		flusher = std::thread([this, aFlushMilliseconds]
+		{
+			std::unique_lock<std::mutex> lock(flushMutex);
+			while (!flushWake.wait_for(lock, std::chrono::milliseconds(aFlushMilliseconds), [this] { return !isRunning; }))
+				flush();
+		});
+	}
+
+	void stop()
+	{
+		if (!flusher.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(flushMutex);
+			isRunning = false;
+		}
+		flushWake.notify_one();
+		flusher.join();
+
+		flush();
+		flTrace << "\n]\n";
+		flTrace.close();
+	}
+
+	// Labels the calling thread's track;
+	void setThreadName(const char* aName)
+	{
+		if (ThreadBuffer* buffer = getThreadBuffer())
+			buffer->name.store(aName, std::memory_order_release);
+	}
+
+	// aDuration of instantEvent marks a point in time;
+	void record(const char* aName, uint64_t aStart, uint64_t aDuration)
+	{
+		ThreadBuffer* buffer = getThreadBuffer();
+		if (buffer == nullptr)
+			return;
+
+		const uint32_t head = buffer->head.load(std::memory_order_relaxed);
+		if (head - buffer->tail.load(std::memory_order_acquire) == eventsPerThread)
+		{
+			buffer->numDropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		buffer->events[head & (eventsPerThread - 1)] = { aName, aStart, aDuration };
+		buffer->head.store(head + 1, std::memory_order_release);
+	}
+
+	~TraceRecorder() { stop(); }
+
+private:
+	struct Event
+	{
+		const char* name;
+		uint64_t start;
+		uint64_t duration;
+	};
+
+	// Single producer, the owning thread, and single consumer, the flusher;
+	struct ThreadBuffer
+	{
+		std::atomic<uint32_t> head { 0 };
+		std::atomic<uint32_t> tail { 0 };
+		std::atomic<const char*> name { nullptr };
+		std::atomic<uint64_t> numDropped { 0 };
+		bool isNameWritten = false;
+		uint64_t numDroppedWritten = 0;
+		Event events[eventsPerThread];
+	};
+
+	TraceRecorder() : origin(std::chrono::steady_clock::now()), buffers(new ThreadBuffer[maxThreads]) {}
+
+	// Claimed on a thread's first event. Threads past maxThreads go unrecorded;
+	ThreadBuffer* getThreadBuffer()
+	{
+		thread_local ThreadBuffer* buffer = nullptr;
+		thread_local bool isClaimed = false;
+		if (!isClaimed)
+		{
+			const int idxBuffer = numBuffers.fetch_add(1);
+			buffer = idxBuffer < maxThreads ? &buffers[idxBuffer] : nullptr;
+			isClaimed = true;
+		}
+		return buffer;
+	}
+
+	// Flusher thread, or the caller of stop() once it has exited;
+	void flush()
+	{
+		const int numClaimed = std::min(numBuffers.load(), maxThreads);
+		for (int t = 0; t != numClaimed; ++t)
+		{
+			ThreadBuffer& buffer = buffers[t];
+			const char* name = buffer.name.load(std::memory_order_acquire);
+			if (name != nullptr && !buffer.isNameWritten)
+			{
+				writeSeparator();
+				flTrace << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t << ",\"args\":{\"name\":\"" << name << "\"}}";
+				buffer.isNameWritten = true;
+			}
+
+			const uint32_t head = buffer.head.load(std::memory_order_acquire);
+			for (uint32_t e = buffer.tail.load(std::memory_order_relaxed); e != head; ++e)
+			{
+				const Event& event = buffer.events[e & (eventsPerThread - 1)];
+				writeSeparator();
+				flTrace << "{\"name\":\"" << event.name << "\",\"pid\":1,\"tid\":" << t << ",\"ts\":" << event.start / 1000.0;
+				if (event.duration == instantEvent)
+					flTrace << ",\"ph\":\"i\",\"s\":\"t\"}";
+				else
+					flTrace << ",\"ph\":\"X\",\"dur\":" << event.duration / 1000.0 << "}";
+			}
+			buffer.tail.store(head, std::memory_order_release);
+
+			// Drops show up as a counter on the thread's track;
+			const uint64_t numDropped = buffer.numDropped.load(std::memory_order_relaxed);
+			if (numDropped != buffer.numDroppedWritten)
+			{
+				writeSeparator();
+				flTrace << "{\"name\":\"dropped events\",\"ph\":\"C\",\"pid\":1,\"tid\":" << t << ",\"ts\":" << now() / 1000.0
+						<< ",\"args\":{\"count\":" << numDropped << "}}";
+				buffer.numDroppedWritten = numDropped;
+			}
+		}
+		flTrace.flush();
+	}
+
+	void writeSeparator()
+	{
+		if (!isFirstEvent)
+			flTrace << ",\n";
+		isFirstEvent = false;
+	}
+
+	const std::chrono::steady_clock::time_point origin;
+	std::unique_ptr<ThreadBuffer[]> buffers;
+	std::atomic<int> numBuffers { 0 };
+
+	std::ofstream flTrace;
+	bool isFirstEvent = true;
+	std::thread flusher;
+	std::mutex flushMutex;
+	std::condition_variable flushWake;
+	bool isRunning = false;
+};
+
+// Records the enclosing scope as one complete event;
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* aName) : name(aName), start(TraceRecorder::now()) {}
+	~TraceScope() { TraceRecorder::getInstance().record(name, start, TraceRecorder::now() - start); }
+
+private:
+	const char* name;
+	uint64_t start;
+};
+
+ #define MOLSYNTH_TRACE_CONCAT_(a, b) a##b
+ #define MOLSYNTH_TRACE_CONCAT(a, b) MOLSYNTH_TRACE_CONCAT_(a, b)
+ #define TRACE_SCOPE(aName) const TraceScope MOLSYNTH_TRACE_CONCAT(traceScope, __LINE__)(aName)
+ #define TRACE_INSTANT(aName) TraceRecorder::getInstance().record(aName, TraceRecorder::now(), TraceRecorder::instantEvent)
+ #define TRACE_THREAD(aName) TraceRecorder::getInstance().setThreadName(aName)
+#else
+ #define TRACE_SCOPE(aName)
+ #define TRACE_INSTANT(aName)
+ #define TRACE_THREAD(aName)
+#endif